@@ -0,0 +1,323 @@
+/*
+  Memory for the module's large native structures.
+
+  Every structure that can grow large owns a struct jk_memory and takes
+  its memory from jk_map(), directly for big tables or through a
+  jk_arena, a bump allocator over large chunks, for many small objects.
+  The jk_memory decides where the pages come from:
+
+  * anonymous memory (the default);
+  * anonymous memory with transparent huge pages requested through
+    madvise(MADV_HUGEPAGE) ("madvise"), which cuts TLB misses on
+    random probes into tables of many megabytes;
+  * explicit huge pages through MAP_HUGETLB ("hugetlb"), falling back to
+    "madvise" when none are reserved;
+  * a file, extended as mappings are added and mapped shared, so that a
+    structure larger than RAM is paged by the kernel.  The file holds
+    scratch data and is truncated when the structure is freed.
+
+  Each jk_memory counts the bytes mapped for it and the bytes its owner
+  reports as in use, and is linked into a registry so that
+  jenkins.memory_usage() can list every live structure.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JK_HUGE_PAGE   ((size_t) 2 << 20)
+#define JK_ARENA_CHUNK ((size_t) 1 << 20)
+
+enum jk_pages {
+  JK_PAGES_DEFAULT,
+  JK_PAGES_MADVISE,
+  JK_PAGES_HUGETLB
+};
+
+static const char *jk_pages_names[] = {"default", "madvise", "hugetlb"};
+
+struct jk_memory {
+  const char *owner;            /* type name, for memory_usage() */
+  struct jk_memory *prev, *next;
+  int pages;                    /* enum jk_pages */
+  int fd;                       /* backing file, or -1 */
+  PyObject *path;               /* backing file name, or NULL */
+  uint64_t file_size;           /* bytes of the file mapped so far */
+  size_t reserved;              /* bytes mapped */
+  size_t live;                  /* bytes the owner reports in use */
+  pthread_mutex_t lock;         /* mapping the file */
+};
+
+static struct jk_memory *jk_memory_list = NULL;
+static pthread_mutex_t jk_memory_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+  Set up m for an owner.  pages is None/False, True ("madvise"),
+  "madvise" or "hugetlb"; path, if not None, names a backing file.
+  Returns 0, or -1 with an exception set.
+ */
+static int jk_memory_init(struct jk_memory *m, const char *owner,
+                          PyObject *pages, PyObject *path) {
+  PyObject *bytes = NULL;
+  int truth;
+
+  memset(m, 0, sizeof(*m));
+  m->fd = -1;
+
+  if (pages && pages != Py_None) {
+    if (PyUnicode_Check(pages) || PyBytes_Check(pages)) {
+      PyObject *s = PyUnicode_Check(pages) ? PyUnicode_AsUTF8String(pages)
+                                           : (Py_INCREF(pages), pages);
+      if (!s)
+        return -1;
+      if (strcmp(PyBytes_AS_STRING(s), "madvise") == 0)
+        m->pages = JK_PAGES_MADVISE;
+      else if (strcmp(PyBytes_AS_STRING(s), "hugetlb") == 0)
+        m->pages = JK_PAGES_HUGETLB;
+      else if (strcmp(PyBytes_AS_STRING(s), "default") != 0) {
+        Py_DECREF(s);
+        PyErr_SetString(PyExc_ValueError, "huge_pages must be a bool, "
+                        "'default', 'madvise' or 'hugetlb'");
+        return -1;
+      }
+      Py_DECREF(s);
+    } else {
+      truth = PyObject_IsTrue(pages);
+      if (truth < 0)
+        return -1;
+      m->pages = truth ? JK_PAGES_MADVISE : JK_PAGES_DEFAULT;
+    }
+  }
+
+  if (path && path != Py_None) {
+#if PY_MAJOR_VERSION >= 3
+    if (!PyUnicode_FSConverter(path, &bytes))
+      return -1;
+#else
+    if (!PyBytes_Check(path)) {
+      PyErr_SetString(PyExc_TypeError, "path must be a string");
+      return -1;
+    }
+    bytes = path;
+    Py_INCREF(bytes);
+#endif
+    m->fd = open(PyBytes_AS_STRING(bytes), O_RDWR | O_CREAT | O_TRUNC |
+                 O_CLOEXEC, 0600);
+    if (m->fd < 0) {
+      PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(bytes));
+      Py_DECREF(bytes);
+      return -1;
+    }
+    m->path = bytes;
+  }
+
+  /* set last: a non-NULL owner tells jk_memory_free() m is registered */
+  m->owner = owner;
+  pthread_mutex_init(&m->lock, NULL);
+  pthread_mutex_lock(&jk_memory_list_lock);
+  m->next = jk_memory_list;
+  if (jk_memory_list)
+    jk_memory_list->prev = m;
+  jk_memory_list = m;
+  pthread_mutex_unlock(&jk_memory_list_lock);
+  return 0;
+}
+
+/* Unregister m; every mapping must have been unmapped already. */
+static void jk_memory_free(struct jk_memory *m) {
+  if (!m->owner)
+    return;
+  pthread_mutex_lock(&jk_memory_list_lock);
+  if (m->prev)
+    m->prev->next = m->next;
+  else
+    jk_memory_list = m->next;
+  if (m->next)
+    m->next->prev = m->prev;
+  pthread_mutex_unlock(&jk_memory_list_lock);
+
+  /* the mappings are gone, so the file can only have been emptied */
+  if (m->fd >= 0)
+    close(m->fd);
+  Py_CLEAR(m->path);
+  pthread_mutex_destroy(&m->lock);
+  m->owner = NULL;
+}
+
+static void jk_memory_live(struct jk_memory *m, ssize_t delta) {
+  __atomic_fetch_add(&m->live, (size_t) delta, __ATOMIC_RELAXED);
+}
+
+/* Account for a mapping made elsewhere (e.g. of an existing file). */
+static void jk_memory_mapped(struct jk_memory *m, ssize_t delta) {
+  __atomic_fetch_add(&m->reserved, (size_t) delta, __ATOMIC_RELAXED);
+}
+
+/*
+  Map *size bytes of zeroed memory for m, rounding *size up to whole
+  pages.  Returns NULL with errno set on failure; callable without the
+  GIL.
+ */
+static void *jk_map(struct jk_memory *m, size_t *size) {
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  void *p = MAP_FAILED;
+
+  *size = (*size + page - 1) & ~(page - 1);
+
+  if (m->fd >= 0) {
+    pthread_mutex_lock(&m->lock);
+    if (ftruncate(m->fd, (off_t) (m->file_size + *size)) == 0) {
+      p = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd,
+               (off_t) m->file_size);
+      if (p != MAP_FAILED) {
+        m->file_size += *size;
+        m->reserved += *size;
+      }
+    }
+    pthread_mutex_unlock(&m->lock);
+    return p == MAP_FAILED ? NULL : p;
+  }
+
+#ifdef MAP_HUGETLB
+  if (m->pages == JK_PAGES_HUGETLB && *size >= JK_HUGE_PAGE) {
+    size_t huge = (*size + JK_HUGE_PAGE - 1) & ~(JK_HUGE_PAGE - 1);
+
+    p = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+      *size = huge;
+  }
+#endif
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      return NULL;
+#ifdef MADV_HUGEPAGE
+    if (m->pages != JK_PAGES_DEFAULT)
+      madvise(p, *size, MADV_HUGEPAGE);
+#endif
+  }
+  jk_memory_mapped(m, (ssize_t) *size);
+  return p;
+}
+
+/* Unmap a mapping from jk_map(); size as returned by it. */
+static void jk_unmap(struct jk_memory *m, void *p, size_t size) {
+  if (!p)
+    return;
+  munmap(p, size);
+  if (m->fd < 0) {
+    jk_memory_mapped(m, -(ssize_t) size);
+    return;
+  }
+  /* the file is only ever appended to; give it back once it is unused */
+  pthread_mutex_lock(&m->lock);
+  m->reserved -= size;
+  if (m->reserved == 0 && ftruncate(m->fd, 0) == 0)
+    m->file_size = 0;
+  pthread_mutex_unlock(&m->lock);
+}
+
+/*
+  Move a mapping from jk_map() of old bytes to a new one of at least
+  *size bytes, keeping its contents; *size is rounded as by jk_map().
+  Returns NULL with errno set, and p still mapped, on failure.
+ */
+static void *jk_remap(struct jk_memory *m, void *p, size_t old,
+                      size_t *size) {
+  void *q = jk_map(m, size);
+
+  if (!q)
+    return NULL;
+  if (p) {
+    memcpy(q, p, old < *size ? old : *size);
+    jk_unmap(m, p, old);
+  }
+  return q;
+}
+
+/* The accounting of one structure, as returned by memory_usage(). */
+static PyObject *jk_memory_dict(struct jk_memory *m) {
+  return Py_BuildValue("{sssnsnsssO}",
+                       "type", m->owner,
+                       "reserved", (Py_ssize_t) m->reserved,
+                       "live", (Py_ssize_t) m->live,
+                       "huge_pages", jk_pages_names[m->pages],
+                       "path", m->path ? m->path : Py_None);
+}
+
+static char memory_usage_doc[] = "Returns a list with a dict for each live HLLArena, FileHashCache and other native structure: its type, the bytes mapped for it (reserved), the bytes it has in use (live), its huge_pages setting and its backing file, if any.";
+
+static PyObject* memory_usage_py(PyObject* self, PyObject* args) {
+  struct jk_memory *m;
+  PyObject *list = PyList_New(0);
+
+  if (!list)
+    return NULL;
+  pthread_mutex_lock(&jk_memory_list_lock);
+  for (m = jk_memory_list; m; m = m->next) {
+    PyObject *d = jk_memory_dict(m);
+
+    if (!d || PyList_Append(list, d) < 0) {
+      Py_XDECREF(d);
+      Py_CLEAR(list);
+      break;
+    }
+    Py_DECREF(d);
+  }
+  pthread_mutex_unlock(&jk_memory_list_lock);
+  return list;
+}
+
+/* Bump allocation from large chunks; nothing is freed until reset. */
+struct jk_arena_chunk {
+  struct jk_arena_chunk *next;
+  size_t size, used;            /* used includes this header */
+};
+
+struct jk_arena {
+  struct jk_memory *mem;
+  struct jk_arena_chunk *chunks;
+};
+
+static void jk_arena_init(struct jk_arena *a, struct jk_memory *mem) {
+  a->mem = mem;
+  a->chunks = NULL;
+}
+
+/* bytes from the arena, aligned to 16; callers serialize access */
+static void *jk_arena_alloc(struct jk_arena *a, size_t bytes) {
+  struct jk_arena_chunk *chunk = a->chunks;
+  void *p;
+
+  bytes = (bytes + 15) & ~(size_t) 15;
+  if (!chunk || chunk->size - chunk->used < bytes) {
+    size_t size = JK_ARENA_CHUNK;
+
+    if (a->mem->pages == JK_PAGES_HUGETLB)
+      size = JK_HUGE_PAGE;
+    while (size - sizeof(struct jk_arena_chunk) < bytes + 16)
+      size *= 2;
+    chunk = jk_map(a->mem, &size);
+    if (!chunk)
+      return NULL;
+    chunk->next = a->chunks;
+    chunk->size = size;
+    chunk->used = (sizeof(struct jk_arena_chunk) + 15) & ~(size_t) 15;
+    a->chunks = chunk;
+  }
+  p = (char *) chunk + chunk->used;
+  chunk->used += bytes;
+  return p;
+}
+
+static void jk_arena_reset(struct jk_arena *a) {
+  struct jk_arena_chunk *chunk, *next;
+
+  for (chunk = a->chunks; chunk; chunk = next) {
+    next = chunk->next;
+    jk_unmap(a->mem, chunk, chunk->size);
+  }
+  a->chunks = NULL;
+}
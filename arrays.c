@@ -0,0 +1,360 @@
+/*
+  Elementwise hashing of NumPy arrays.
+
+  hashlittle_array() and friends behave like ufuncs: keys and seeds
+  broadcast against each other, results go to a new array or to out=,
+  and where= masks elements out.  The work is driven by NumPy's NpyIter,
+  which takes care of striding, byte order, casting of seeds and
+  chunked (buffered) iteration; the GIL is released around the loop.
+
+  Keys are hashed as follows:
+
+  * fixed-width bytes ('S'): the item with trailing NULs removed, which is
+    what NumPy itself returns for the element;
+  * unicode ('U'): the item's code points encoded as UTF-8, without
+    trailing NULs, so a['x'] hashes like jenkins.hashlittle(u'x'.encode('utf-8'));
+  * signed and unsigned integers: the little-endian bytes of the value at
+    the array's item size, so results agree across machines.
+
+  hashlittle2_array() returns the two hashes packed into one uint64 as
+  pc + (pb << 32), as suggested in lookup3.c.
+
+  Only compiled when NumPy's headers were found at build time
+  (JENKINS_NUMPY); NumPy is not needed to import the module.
+ */
+#ifdef JENKINS_NUMPY
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+static int jk_numpy_ready = 0;
+
+/* Called from module init; a missing NumPy only disables these functions. */
+static void jk_numpy_init(void) {
+  if (_import_array() < 0) {
+    PyErr_Clear();
+    return;
+  }
+  jk_numpy_ready = 1;
+}
+
+/* UCS4 to UTF-8; returns the encoded length or -1 on an invalid code point */
+static Py_ssize_t jk_utf8(const uint32_t *s, size_t n, char *out) {
+  char *p = out;
+  size_t i;
+
+  for (i = 0; i < n; ++i) {
+    uint32_t c = s[i];
+
+    if (c < 0x80) {
+      *p++ = (char) c;
+    } else if (c < 0x800) {
+      *p++ = (char) (0xc0 | (c >> 6));
+      *p++ = (char) (0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+      if (c >= 0xd800 && c <= 0xdfff)
+        return -1;
+      *p++ = (char) (0xe0 | (c >> 12));
+      *p++ = (char) (0x80 | ((c >> 6) & 0x3f));
+      *p++ = (char) (0x80 | (c & 0x3f));
+    } else if (c < 0x110000) {
+      *p++ = (char) (0xf0 | (c >> 18));
+      *p++ = (char) (0x80 | ((c >> 12) & 0x3f));
+      *p++ = (char) (0x80 | ((c >> 6) & 0x3f));
+      *p++ = (char) (0x80 | (c & 0x3f));
+    } else {
+      return -1;
+    }
+  }
+  return p - out;
+}
+
+static PyObject* jk_array_hash(enum jk_func fn, PyObject *keys_obj,
+                               PyObject *seedc_obj, PyObject *seedb_obj,
+                               PyObject *out_obj, PyObject *where_obj) {
+  PyArrayObject *op[5] = {NULL, NULL, NULL, NULL, NULL};
+  PyArray_Descr *op_dtypes[5] = {NULL, NULL, NULL, NULL, NULL};
+  npy_uint32 op_flags[5];
+  int nop = 0, nseeds, key_op, seedc_op = -1, seedb_op = -1, where_op = -1;
+  int out_op, type_num, bad_char = 0;
+  PyArrayObject *result = NULL;
+  NpyIter *iter = NULL;
+  PyObject *zero = NULL;
+  char *utf8 = NULL;
+
+  if (!jk_numpy_ready) {
+    PyErr_SetString(PyExc_ImportError, "numpy could not be imported");
+    return NULL;
+  }
+
+  nseeds = (fn == JK_ONEATATIME) ? 0 : (fn == JK_HASHLITTLE2) ? 2 : 1;
+  zero = PyLong_FromLong(0);
+  if (!zero)
+    return NULL;
+
+  /* keys */
+  key_op = nop++;
+  op[key_op] = (PyArrayObject *) PyArray_FROM_O(keys_obj);
+  if (!op[key_op])
+    goto done;
+  type_num = PyArray_TYPE(op[key_op]);
+  if (type_num == NPY_STRING) {
+    op_dtypes[key_op] = PyArray_DESCR(op[key_op]);
+    Py_INCREF(op_dtypes[key_op]);
+  } else if (type_num == NPY_UNICODE) {
+    op_dtypes[key_op] = PyArray_DescrNewByteorder(PyArray_DESCR(op[key_op]),
+                                                  NPY_NATIVE);
+  } else if (PyTypeNum_ISINTEGER(type_num)) {
+    op_dtypes[key_op] = PyArray_DescrNewByteorder(PyArray_DESCR(op[key_op]),
+                                                  NPY_LITTLE);
+  } else {
+    PyErr_SetString(PyExc_TypeError,
+                    "keys must be a bytes ('S'), unicode ('U') or integer array");
+    goto done;
+  }
+  if (!op_dtypes[key_op])
+    goto done;
+  op_flags[key_op] = NPY_ITER_READONLY | NPY_ITER_NBO | NPY_ITER_ALIGNED;
+
+  /* seeds, wrapped to 32 bits like the scalar functions do */
+  if (nseeds >= 1) {
+    seedc_op = nop++;
+    op[seedc_op] = (PyArrayObject *) PyArray_FROM_OTF(
+      seedc_obj ? seedc_obj : zero, NPY_UINT32, NPY_ARRAY_FORCECAST);
+    if (!op[seedc_op])
+      goto done;
+    op_flags[seedc_op] = NPY_ITER_READONLY | NPY_ITER_NBO | NPY_ITER_ALIGNED;
+  }
+  if (nseeds >= 2) {
+    seedb_op = nop++;
+    op[seedb_op] = (PyArrayObject *) PyArray_FROM_OTF(
+      seedb_obj ? seedb_obj : zero, NPY_UINT32, NPY_ARRAY_FORCECAST);
+    if (!op[seedb_op])
+      goto done;
+    op_flags[seedb_op] = NPY_ITER_READONLY | NPY_ITER_NBO | NPY_ITER_ALIGNED;
+  }
+
+  if (where_obj && where_obj != Py_True) {
+    where_op = nop++;
+    op[where_op] = (PyArrayObject *) PyArray_FROM_OTF(where_obj, NPY_BOOL,
+                                                      NPY_ARRAY_FORCECAST);
+    if (!op[where_op])
+      goto done;
+    op_flags[where_op] = NPY_ITER_READONLY;
+  }
+
+  /* output; read back in when masked so skipped elements are preserved */
+  out_op = nop++;
+  if (out_obj && out_obj != Py_None) {
+    if (!PyArray_Check(out_obj)) {
+      PyErr_SetString(PyExc_TypeError, "out must be an array");
+      goto done;
+    }
+    op[out_op] = (PyArrayObject *) out_obj;
+    Py_INCREF(out_obj);
+  }
+  op_dtypes[out_op] = PyArray_DescrFromType(fn == JK_HASHLITTLE2 ? NPY_UINT64
+                                                                 : NPY_UINT32);
+  op_flags[out_op] = NPY_ITER_ALLOCATE | NPY_ITER_NBO | NPY_ITER_ALIGNED |
+                     (where_op >= 0 ? NPY_ITER_READWRITE : NPY_ITER_WRITEONLY);
+
+  iter = NpyIter_MultiNew(nop, op,
+                          NPY_ITER_EXTERNAL_LOOP | NPY_ITER_BUFFERED |
+                          NPY_ITER_GROWINNER | NPY_ITER_ZEROSIZE_OK |
+                          NPY_ITER_DELAY_BUFALLOC,
+                          NPY_KEEPORDER, NPY_SAME_KIND_CASTING,
+                          op_flags, op_dtypes);
+  if (!iter)
+    goto done;
+
+  result = NpyIter_GetOperandArray(iter)[out_op];
+  Py_INCREF(result);
+  if (!op[out_op] && where_op >= 0)
+    PyArray_FILLWBYTE(result, 0);
+  if (NpyIter_Reset(iter, NULL) != NPY_SUCCEED)
+    goto fail;
+
+  if (NpyIter_GetIterSize(iter) > 0) {
+    NpyIter_IterNextFunc *iternext = NpyIter_GetIterNext(iter, NULL);
+    char **data = NpyIter_GetDataPtrArray(iter);
+    npy_intp *strides = NpyIter_GetInnerStrideArray(iter);
+    npy_intp *innersize = NpyIter_GetInnerLoopSizePtr(iter);
+    npy_intp itemsize = PyArray_ITEMSIZE(NpyIter_GetOperandArray(iter)[key_op]);
+    enum jk_func afn = fn == JK_HASHLITTLE ? JK_HASHLITTLE_ARRAY :
+                       fn == JK_HASHLITTLE2 ? JK_HASHLITTLE2_ARRAY :
+                       fn == JK_HASHBIG ? JK_HASHBIG_ARRAY :
+                       JK_ONEATATIME_ARRAY;
+    NPY_BEGIN_THREADS_DEF;
+
+    if (!iternext)
+      goto fail;
+
+    if (type_num == NPY_UNICODE) {
+      utf8 = malloc(itemsize > 0 ? itemsize : 1);
+      if (!utf8) {
+        PyErr_NoMemory();
+        goto fail;
+      }
+    }
+
+    JK_ENTER_BATCH(afn, NpyIter_GetIterSize(iter) * itemsize,
+                   NpyIter_GetIterSize(iter));
+    if (!NpyIter_IterationNeedsAPI(iter))
+      NPY_BEGIN_THREADS_THRESHOLDED(NpyIter_GetIterSize(iter));
+
+    do {
+      char *key = data[key_op], *out = data[out_op];
+      char *sc = seedc_op >= 0 ? data[seedc_op] : NULL;
+      char *sb = seedb_op >= 0 ? data[seedb_op] : NULL;
+      char *w = where_op >= 0 ? data[where_op] : NULL;
+      npy_intp i, n = *innersize;
+
+      for (i = 0; i < n; ++i) {
+        const char *k = key;
+        Py_ssize_t len = itemsize;
+        uint32_t pc = sc ? *(const uint32_t *) sc : 0;
+        uint32_t pb = sb ? *(const uint32_t *) sb : 0;
+
+        if (w && !*(const npy_bool *) w)
+          goto next;
+
+        if (type_num == NPY_STRING) {
+          while (len > 0 && k[len - 1] == '\0')
+            --len;
+        } else if (type_num == NPY_UNICODE) {
+          const uint32_t *u = (const uint32_t *) key;
+          size_t chars = (size_t) itemsize / 4;
+
+          while (chars > 0 && u[chars - 1] == 0)
+            --chars;
+          len = jk_utf8(u, chars, utf8);
+          if (len < 0) {
+            bad_char = 1;
+            goto stop;
+          }
+          k = utf8;
+        }
+
+        switch (fn) {
+        case JK_HASHLITTLE:
+          *(uint32_t *) out = hashlittle(k, (size_t) len, pc);
+          break;
+        case JK_HASHLITTLE2:
+          hashlittle2(k, (size_t) len, &pc, &pb);
+          *(uint64_t *) out = pc + (((uint64_t) pb) << 32);
+          break;
+        case JK_HASHBIG:
+          *(uint32_t *) out = hashbig(k, (size_t) len, pc);
+          break;
+        default:
+          *(uint32_t *) out = one_at_a_time(k, (size_t) len);
+          break;
+        }
+
+      next:
+        key += strides[key_op];
+        out += strides[out_op];
+        if (sc)
+          sc += strides[seedc_op];
+        if (sb)
+          sb += strides[seedb_op];
+        if (w)
+          w += strides[where_op];
+      }
+    } while (iternext(iter));
+
+  stop:
+    NPY_END_THREADS;
+    JK_EXIT_BATCH(afn, NpyIter_GetIterSize(iter) * itemsize,
+                  NpyIter_GetIterSize(iter));
+
+    if (bad_char) {
+      PyErr_SetString(PyExc_ValueError,
+                      "keys contain a code point that cannot be encoded as UTF-8");
+      goto fail;
+    }
+  }
+
+  /* flush any buffered output back to the result array */
+  if (NpyIter_Deallocate(iter) != NPY_SUCCEED) {
+    iter = NULL;
+    goto fail;
+  }
+  iter = NULL;
+
+  if (op[out_op])
+    goto done;
+  result = (PyArrayObject *) PyArray_Return(result);
+  goto done;
+
+fail:
+  Py_CLEAR(result);
+done:
+  if (iter)
+    NpyIter_Deallocate(iter);
+  free(utf8);
+  Py_DECREF(zero);
+  while (nop-- > 0) {
+    Py_XDECREF(op[nop]);
+    Py_XDECREF(op_dtypes[nop]);
+  }
+  return (PyObject *) result;
+}
+
+static char hashlittle_array_doc[] = "Takes an array of keys (bytes, unicode or integers), an optional broadcastable array of 32 bit initial values and optional out= and where= arguments as for a NumPy ufunc. Returns a uint32 array of hashlittle values.";
+
+static PyObject* hashlittle_array_py(PyObject* self, PyObject* args,
+                                     PyObject* kwds) {
+  static char *kwlist[] = {"keys", "seed", "out", "where", NULL};
+  PyObject *keys, *seed = NULL, *out = NULL, *where = NULL;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOO", kwlist,
+                                   &keys, &seed, &out, &where))
+    return NULL;
+
+  return jk_array_hash(JK_HASHLITTLE, keys, seed, NULL, out, where);
+}
+
+static char hashlittle2_array_doc[] = "Takes an array of keys (bytes, unicode or integers), two optional broadcastable arrays of initial values and optional out= and where= arguments as for a NumPy ufunc. Returns a uint64 array holding pc + (pb << 32) for each key.";
+
+static PyObject* hashlittle2_array_py(PyObject* self, PyObject* args,
+                                      PyObject* kwds) {
+  static char *kwlist[] = {"keys", "initc", "initb", "out", "where", NULL};
+  PyObject *keys, *initc = NULL, *initb = NULL, *out = NULL, *where = NULL;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOOO", kwlist,
+                                   &keys, &initc, &initb, &out, &where))
+    return NULL;
+
+  return jk_array_hash(JK_HASHLITTLE2, keys, initc, initb, out, where);
+}
+
+static char hashbig_array_doc[] = "Takes an array of keys (bytes, unicode or integers), an optional broadcastable array of 32 bit initial values and optional out= and where= arguments as for a NumPy ufunc. Returns a uint32 array of hashbig values.";
+
+static PyObject* hashbig_array_py(PyObject* self, PyObject* args,
+                                  PyObject* kwds) {
+  static char *kwlist[] = {"keys", "seed", "out", "where", NULL};
+  PyObject *keys, *seed = NULL, *out = NULL, *where = NULL;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOO", kwlist,
+                                   &keys, &seed, &out, &where))
+    return NULL;
+
+  return jk_array_hash(JK_HASHBIG, keys, seed, NULL, out, where);
+}
+
+static char oneatatime_array_doc[] = "Takes an array of keys (bytes, unicode or integers) and optional out= and where= arguments as for a NumPy ufunc. Returns a uint32 array of one-at-a-time hashes.";
+
+static PyObject* oneatatime_array_py(PyObject* self, PyObject* args,
+                                     PyObject* kwds) {
+  static char *kwlist[] = {"keys", "out", "where", NULL};
+  PyObject *keys, *out = NULL, *where = NULL;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO", kwlist,
+                                   &keys, &out, &where))
+    return NULL;
+
+  return jk_array_hash(JK_ONEATATIME, keys, NULL, NULL, out, where);
+}
+
+#endif /* JENKINS_NUMPY */
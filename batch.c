@@ -0,0 +1,312 @@
+/*
+  Helpers shared by the batch entry points.
+
+  jk_keys_get() turns a Python sequence of keys into arrays of pointers and
+  lengths that stay valid with the GIL released.  bytes objects are used in
+  place (the sequence is copied to a tuple, which keeps them alive even if
+  the caller mutates the original list); unicode keys are encoded as UTF-8
+  and other buffer objects are copied, matching what hashlittle_array()
+  does for 'U' and 'S' arrays.
+
+  jk_ints_get() reads a sequence of integers, or any buffer of integers
+  such as an array.array or a NumPy array, into a uint64_t array.
+
+  jk_parallel() runs a function on several native threads and waits for
+  them; callers partition the work by the thread index they are given.
+
+  jk_get32() and the like read and write the little-endian integers of
+  the serialized formats, whatever the host byte order and alignment.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define JK_MAX_THREADS 64
+
+/* Batches smaller than this are not worth starting threads for. */
+#define JK_PARALLEL_MIN 16384
+
+static uint32_t jk_get32(const uint8_t *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+         ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t jk_get64(const uint8_t *p) {
+  return jk_get32(p) | ((uint64_t) jk_get32(p + 4) << 32);
+}
+
+static void jk_put32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+  p[2] = (uint8_t) (v >> 16);
+  p[3] = (uint8_t) (v >> 24);
+}
+
+static void jk_put64(uint8_t *p, uint64_t v) {
+  jk_put32(p, (uint32_t) v);
+  jk_put32(p + 4, (uint32_t) (v >> 32));
+}
+
+struct jk_keys {
+  PyObject *owner;          /* tuple holding every key object alive */
+  const char **ptr;
+  size_t *len;
+  Py_ssize_t n;
+  size_t bytes;             /* total key bytes */
+};
+
+static void jk_keys_release(struct jk_keys *keys) {
+  Py_CLEAR(keys->owner);
+  free(keys->ptr);
+  free(keys->len);
+  keys->ptr = NULL;
+  keys->len = NULL;
+  keys->n = 0;
+}
+
+/* Key bytes for one object; *owned receives a new reference if one was made */
+static int jk_key_bytes(PyObject *item, PyObject **owned, const char **ptr,
+                        size_t *len) {
+  Py_buffer view;
+
+  *owned = NULL;
+  if (PyBytes_Check(item)) {
+    *ptr = PyBytes_AS_STRING(item);
+    *len = (size_t) PyBytes_GET_SIZE(item);
+    return 0;
+  }
+  if (PyUnicode_Check(item)) {
+    *owned = PyUnicode_AsUTF8String(item);
+  } else if (PyObject_CheckBuffer(item)) {
+    if (PyObject_GetBuffer(item, &view, PyBUF_SIMPLE) < 0)
+      return -1;
+    *owned = PyBytes_FromStringAndSize((const char *) view.buf, view.len);
+    PyBuffer_Release(&view);
+  } else {
+    PyErr_Format(PyExc_TypeError, "keys must be bytes, unicode or buffers, "
+                 "not %.100s", Py_TYPE(item)->tp_name);
+    return -1;
+  }
+  if (!*owned)
+    return -1;
+  *ptr = PyBytes_AS_STRING(*owned);
+  *len = (size_t) PyBytes_GET_SIZE(*owned);
+  return 0;
+}
+
+static int jk_keys_get(PyObject *obj, struct jk_keys *keys) {
+  PyObject *seq;
+  Py_ssize_t i;
+
+  memset(keys, 0, sizeof(*keys));
+
+  seq = PySequence_Tuple(obj);
+  if (!seq)
+    return -1;
+  keys->owner = seq;
+  keys->n = PyTuple_GET_SIZE(seq);
+  keys->ptr = malloc((keys->n ? keys->n : 1) * sizeof(*keys->ptr));
+  keys->len = malloc((keys->n ? keys->n : 1) * sizeof(*keys->len));
+  if (!keys->ptr || !keys->len) {
+    jk_keys_release(keys);
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  for (i = 0; i < keys->n; ++i) {
+    PyObject *owned;
+
+    if (jk_key_bytes(PyTuple_GET_ITEM(seq, i), &owned,
+                     &keys->ptr[i], &keys->len[i]) < 0) {
+      jk_keys_release(keys);
+      return -1;
+    }
+    /* the tuple is ours alone, so the converted key can replace the item */
+    if (owned) {
+      PyObject *old = PyTuple_GET_ITEM(seq, i);
+      PyTuple_SET_ITEM(seq, i, owned);
+      Py_DECREF(old);
+    }
+    keys->bytes += keys->len[i];
+  }
+  return 0;
+}
+
+/* Read an integer buffer of the given struct format into out. */
+static int jk_ints_from_buffer(Py_buffer *view, uint64_t *out) {
+  const char *fmt = view->format ? view->format : "B";
+  const char *p = (const char *) view->buf;
+  Py_ssize_t i, n = view->len / view->itemsize;
+
+  if (*fmt == '@' || *fmt == '=' || *fmt == '<')
+    ++fmt;
+  if (fmt[0] == '\0' || fmt[1] != '\0')
+    return -1;
+
+#define JK_COPY(type) \
+  for (i = 0; i < n; ++i) { \
+    type v; \
+    memcpy(&v, p + i * sizeof(type), sizeof(type)); \
+    out[i] = (uint64_t) v; \
+  }
+
+  switch (*fmt) {
+  case 'b': if (view->itemsize != 1) return -1; JK_COPY(signed char); break;
+  case 'B': if (view->itemsize != 1) return -1; JK_COPY(unsigned char); break;
+  case 'h': if (view->itemsize != 2) return -1; JK_COPY(int16_t); break;
+  case 'H': if (view->itemsize != 2) return -1; JK_COPY(uint16_t); break;
+  case 'i': case 'l': case 'q': case 'n':
+    if (view->itemsize == 4) {
+      JK_COPY(int32_t);
+    } else if (view->itemsize == 8) {
+      JK_COPY(int64_t);
+    } else {
+      return -1;
+    }
+    break;
+  case 'I': case 'L': case 'Q': case 'N':
+    if (view->itemsize == 4) {
+      JK_COPY(uint32_t);
+    } else if (view->itemsize == 8) {
+      JK_COPY(uint64_t);
+    } else {
+      return -1;
+    }
+    break;
+  default:
+    return -1;
+  }
+#undef JK_COPY
+  return 0;
+}
+
+/*
+  Integers from obj into a new malloc'd array of *n entries.  A contiguous
+  integer buffer is read directly; anything else is iterated.
+ */
+static uint64_t *jk_ints_get(PyObject *obj, Py_ssize_t *n) {
+  Py_buffer view;
+  PyObject *seq;
+  uint64_t *out;
+  Py_ssize_t i;
+
+  if (PyObject_CheckBuffer(obj) && !PyBytes_Check(obj) &&
+      PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) == 0) {
+    *n = view.itemsize ? view.len / view.itemsize : 0;
+    out = malloc((*n ? *n : 1) * sizeof(uint64_t));
+    if (!out) {
+      PyBuffer_Release(&view);
+      PyErr_NoMemory();
+      return NULL;
+    }
+    if (jk_ints_from_buffer(&view, out) == 0) {
+      PyBuffer_Release(&view);
+      return out;
+    }
+    /* not an integer buffer: fall back to iterating it */
+    free(out);
+    PyBuffer_Release(&view);
+  }
+  PyErr_Clear();
+
+  seq = PySequence_Fast(obj, "expected a sequence of integers");
+  if (!seq)
+    return NULL;
+  *n = PySequence_Fast_GET_SIZE(seq);
+  out = malloc((*n ? *n : 1) * sizeof(uint64_t));
+  if (!out) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  for (i = 0; i < *n; ++i) {
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+    PyObject *lng = PyNumber_Long(item);
+
+    if (!lng) {
+      free(out);
+      Py_DECREF(seq);
+      return NULL;
+    }
+    out[i] = (uint64_t) PyLong_AsUnsignedLongLongMask(lng);
+    Py_DECREF(lng);
+    if (PyErr_Occurred()) {
+      free(out);
+      Py_DECREF(seq);
+      return NULL;
+    }
+  }
+  Py_DECREF(seq);
+  return out;
+}
+
+/* Number of threads to use for n items when the caller asked for threads. */
+static int jk_thread_count(Py_ssize_t n, int threads) {
+  long cpus;
+
+  if (threads <= 0) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (int) cpus : 1;
+    if (threads > 16)
+      threads = 16;
+  }
+  if (threads > JK_MAX_THREADS)
+    threads = JK_MAX_THREADS;
+  if (n < JK_PARALLEL_MIN)
+    threads = 1;
+  return threads;
+}
+
+struct jk_parallel_arg {
+  void (*fn)(void *ctx, int t, int nt);
+  void *ctx;
+  int t, nt;
+};
+
+static void *jk_parallel_main(void *p) {
+  struct jk_parallel_arg *a = (struct jk_parallel_arg *) p;
+
+  a->fn(a->ctx, a->t, a->nt);
+  return NULL;
+}
+
+/*
+  Run fn(ctx, t, nt) for t in [0, nt) and wait.  Thread 0 runs on the
+  caller; if a thread cannot be started its share runs on the caller too.
+  Must be called without the GIL if fn can block for long.
+ */
+static void jk_parallel(int nt, void (*fn)(void *, int, int), void *ctx) {
+  pthread_t tids[JK_MAX_THREADS];
+  struct jk_parallel_arg args[JK_MAX_THREADS];
+  int started[JK_MAX_THREADS];
+  int t;
+
+  if (nt < 1)
+    nt = 1;
+  if (nt > JK_MAX_THREADS)
+    nt = JK_MAX_THREADS;
+
+  for (t = 1; t < nt; ++t) {
+    args[t].fn = fn;
+    args[t].ctx = ctx;
+    args[t].t = t;
+    args[t].nt = nt;
+    started[t] = pthread_create(&tids[t], NULL, jk_parallel_main,
+                                &args[t]) == 0;
+  }
+  fn(ctx, 0, nt);
+  for (t = 1; t < nt; ++t) {
+    if (started[t])
+      pthread_join(tids[t], NULL);
+    else
+      fn(ctx, t, nt);
+  }
+}
+
+/* Contiguous share [*lo, *hi) of n items for thread t of nt. */
+static void jk_share(Py_ssize_t n, int t, int nt, Py_ssize_t *lo,
+                     Py_ssize_t *hi) {
+  *lo = n * t / nt;
+  *hi = n * (t + 1) / nt;
+}
@@ -0,0 +1,536 @@
+#!/usr/bin/env python
+"""End-to-end benchmarks for the jenkins extension module.
+
+Measures what a caller sees from Python: per-call overhead, throughput of
+every public function over generated key corpora, multi-threaded scaling,
+the memory held by each result, and the batch, sketch, iterator and file
+APIs where the build has them.  Results are written as JSON so that
+two builds can be compared:
+
+    python bench/bench_jenkins.py run -o before.json
+    (rebuild)
+    python bench/bench_jenkins.py run -o after.json
+    python bench/bench_jenkins.py compare before.json after.json
+
+`compare` exits with status 1 when any metric regresses by more than
+--threshold (10% by default), so it can gate a release.
+
+The corpora are generated from a fixed seed, so runs are comparable
+across machines as long as --seed and --keys match.
+"""
+from __future__ import division, print_function
+
+import argparse
+import bisect
+import gc
+import gzip
+import json
+import os
+import platform
+import random
+import shutil
+import sys
+import tempfile
+import threading
+import time
+import uuid
+
+try:
+    import tracemalloc
+except ImportError:
+    tracemalloc = None
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+try:
+    clock = time.perf_counter
+except AttributeError:
+    clock = time.time
+
+# Imported by run(), so that compare works without the extension built.
+jenkins = None
+
+
+# ---------------------------------------------------------------- corpora
+
+TLDS = ["com", "net", "org", "io", "co.uk", "de"]
+WORDS = ("shop deal sale kick store item cart offer price coupon brand shoe "
+         "shirt phone case cable light lamp desk chair table bag watch ring "
+         "gift card book game toy bike tent boot coat hat sock").split()
+
+
+def corpus_uuids(rng, n):
+    return [str(uuid.UUID(int=rng.getrandbits(128), version=4)).encode("ascii")
+            for _ in range(n)]
+
+
+def corpus_short_ints(rng, n):
+    return [str(rng.randint(0, 99999)).encode("ascii") for _ in range(n)]
+
+
+def corpus_urls(rng, n):
+    keys = []
+    for _ in range(n):
+        host = "%s%s.%s" % (rng.choice(WORDS), rng.choice(WORDS),
+                            rng.choice(TLDS))
+        path = "/".join(rng.choice(WORDS) for _ in range(rng.randint(1, 5)))
+        query = "&".join("%s=%d" % (rng.choice(WORDS), rng.randint(0, 10 ** 6))
+                         for _ in range(rng.randint(0, 3)))
+        url = "https://%s/%s%s" % (host, path, "?" + query if query else "")
+        keys.append(url.encode("ascii"))
+    return keys
+
+
+def corpus_zipf_terms(rng, n, vocab=20000, s=1.1):
+    """Search terms whose frequencies follow a Zipf law over a vocabulary."""
+    terms = [" ".join(rng.choice(WORDS) for _ in range(rng.randint(1, 3)))
+             for _ in range(vocab)]
+    cdf, total = [], 0.0
+    for rank in range(1, vocab + 1):
+        total += 1.0 / rank ** s
+        cdf.append(total)
+    return [terms[bisect.bisect_left(cdf, rng.random() * total)].encode("ascii")
+            for _ in range(n)]
+
+
+def corpus_json_blobs(rng, n):
+    keys = []
+    for _ in range(n):
+        doc = dict(("%s_%d" % (rng.choice(WORDS), i),
+                    rng.choice([rng.randint(0, 10 ** 9), rng.random(),
+                                rng.choice(WORDS) * rng.randint(1, 40)]))
+                   for i in range(int(rng.expovariate(1 / 8.0)) + 1))
+        keys.append(json.dumps(doc, sort_keys=True).encode("ascii"))
+    return keys
+
+
+CORPORA = [
+    ("uuid", corpus_uuids),
+    ("short_int", corpus_short_ints),
+    ("url", corpus_urls),
+    ("zipf_term", corpus_zipf_terms),
+    ("json_blob", corpus_json_blobs),
+]
+
+
+# ------------------------------------------------------------- benchmarks
+
+# Functions that take a buffer and an optional seed.
+BYTE_FUNCS = ["hashlittle", "hashlittle2", "hashbig", "oneatatime"]
+
+# Functions that take a sequence of 32-bit integers.
+WORD_FUNCS = ["hashword", "hashword2"]
+
+# Functions on three 32-bit integers.
+MIX_FUNCS = ["mix", "final"]
+
+
+def best_of(repeat, fn):
+    best = None
+    for _ in range(repeat):
+        gc.collect()
+        t0 = clock()
+        fn()
+        elapsed = clock() - t0
+        if best is None or elapsed < best:
+            best = elapsed
+    return best
+
+
+def bench_call_overhead(repeat, calls=200000):
+    """Cost of a call with an empty key, against a no-op Python call."""
+    results = {}
+    loop = range(calls)
+
+    def noop(key):
+        return key
+
+    def run_noop():
+        for _ in loop:
+            noop(b"")
+    baseline = best_of(repeat, run_noop)
+    results["python_noop"] = {"ns_per_call": baseline / calls * 1e9}
+
+    for name in BYTE_FUNCS:
+        fn = getattr(jenkins, name)
+
+        def run():
+            for _ in loop:
+                fn(b"")
+        results[name] = {"ns_per_call": best_of(repeat, run) / calls * 1e9}
+
+    for name in MIX_FUNCS:
+        fn = getattr(jenkins, name)
+
+        def run():
+            for _ in loop:
+                fn(1, 2, 3)
+        results[name] = {"ns_per_call": best_of(repeat, run) / calls * 1e9}
+    return results
+
+
+def bench_throughput(corpora, repeat):
+    results = {}
+    for cname, keys in corpora:
+        nbytes = sum(len(k) for k in keys)
+        for name in BYTE_FUNCS:
+            fn = getattr(jenkins, name)
+
+            def run():
+                for k in keys:
+                    fn(k)
+            t = best_of(repeat, run)
+            results["%s/%s" % (name, cname)] = {
+                "ns_per_key": t / len(keys) * 1e9,
+                "mb_per_s": nbytes / t / 1e6,
+            }
+
+    words = [list(range(n)) for n in (1, 3, 4, 16, 256)]
+    for name in WORD_FUNCS:
+        fn = getattr(jenkins, name)
+        for w in words:
+            calls = max(1000, 200000 // len(w))
+
+            def run():
+                for _ in range(calls):
+                    fn(w)
+            t = best_of(repeat, run)
+            results["%s/words_%d" % (name, len(w))] = {
+                "ns_per_key": t / calls * 1e9,
+                "mb_per_s": calls * 4 * len(w) / t / 1e6,
+            }
+    return results
+
+
+# Array entry points, present when the module was built with NumPy.
+ARRAY_FUNCS = ["hashlittle_array", "hashlittle2_array", "hashbig_array",
+               "oneatatime_array"]
+
+
+def bench_batch(corpora, repeat):
+    results = {}
+    if numpy is None or not hasattr(jenkins, ARRAY_FUNCS[0]):
+        return results
+    for cname, keys in corpora:
+        arr = numpy.array(keys)
+        nbytes = sum(len(k) for k in keys)
+        for name in ARRAY_FUNCS:
+            fn = getattr(jenkins, name)
+            t = best_of(repeat, lambda: fn(arr))
+            results["%s/%s" % (name, cname)] = {
+                "ns_per_key": t / len(keys) * 1e9,
+                "mb_per_s": nbytes / t / 1e6,
+            }
+    return results
+
+
+def bench_threads(keys, repeat, max_threads):
+    """Throughput of a GIL-releasing entry point over one corpus split
+    across N Python threads.
+
+    hashlittle() holds the GIL, so threads calling it only measure
+    contention; each thread here makes one batch call over its share
+    instead: hashlittle2_array when the build has NumPy, otherwise
+    MultisetHash.update on a single native thread.
+    """
+    results = {}
+    counts, n = [], 1
+    while n <= max_threads:
+        counts.append(n)
+        n *= 2
+
+    if numpy is not None and hasattr(jenkins, "hashlittle2_array"):
+        name = "hashlittle2_array"
+
+        def prepare(part):
+            return numpy.array(part)
+
+        def call(part):
+            jenkins.hashlittle2_array(part)
+    elif hasattr(jenkins, "MultisetHash"):
+        name = "MultisetHash.update"
+
+        def prepare(part):
+            return part
+
+        def call(part):
+            jenkins.MultisetHash().update(part, threads=1)
+    else:
+        return results
+
+    single = None
+    for nthreads in counts:
+        parts = [prepare(keys[i::nthreads]) for i in range(nthreads)]
+
+        def run():
+            threads = [threading.Thread(target=call, args=(p,))
+                       for p in parts]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+        t = best_of(repeat, run)
+        rate = len(keys) / t
+        if single is None:
+            single = rate
+        results["%s/threads_%d" % (name, nthreads)] = {
+            "keys_per_s": rate,
+            "speedup": rate / single,
+        }
+    return results
+
+
+def bench_memory(keys):
+    """Bytes retained per result object, for each buffer function."""
+    results = {}
+    for name in BYTE_FUNCS:
+        fn = getattr(jenkins, name)
+        gc.collect()
+        if tracemalloc is not None:
+            tracemalloc.start()
+            base = tracemalloc.get_traced_memory()[0]
+            held = [fn(k) for k in keys]
+            used = tracemalloc.get_traced_memory()[0] - base
+            tracemalloc.stop()
+            # the list itself is not part of the result
+            used -= sys.getsizeof(held)
+        else:
+            held = [fn(k) for k in keys]
+            used = 0
+            for r in held:
+                used += sys.getsizeof(r)
+                if isinstance(r, tuple):
+                    used += sum(sys.getsizeof(x) for x in r)
+        results[name] = {"bytes_per_result": used / len(keys)}
+        del held
+    return results
+
+
+def keyed_result(t, nkeys, nbytes):
+    return {"ns_per_key": t / nkeys * 1e9, "mb_per_s": nbytes / t / 1e6}
+
+
+def bench_sketches(corpora, repeat):
+    """Batch updates of the sketch types, one corpus at a time."""
+    results = {}
+    for cname, keys in corpora:
+        n = len(keys)
+        nbytes = sum(len(k) for k in keys)
+        codes = [i % 1024 for i in range(n)]
+        weights = [1.0 + (i % 97) for i in range(n)]
+
+        def hll():
+            jenkins.HLLArena(1024).update(codes, keys)
+
+        def multiset():
+            jenkins.MultisetHash().update(keys)
+
+        def priority():
+            jenkins.PrioritySample(1000).update(keys, weights)
+
+        for name, fn in [("HLLArena.update", hll),
+                         ("MultisetHash.update", multiset),
+                         ("PrioritySample.update", priority)]:
+            if hasattr(jenkins, name.split(".")[0]):
+                results["%s/%s" % (name, cname)] = keyed_result(
+                    best_of(repeat, fn), n, nbytes)
+
+    # IBLT keys are fixed size: the first 8 bytes of each uuid
+    if hasattr(jenkins, "IBLT"):
+        keys = [k[:8] for k in dict(corpora)["uuid"]]
+
+        def iblt():
+            jenkins.IBLT(3 * len(keys)).insert(keys)
+
+        def strata():
+            jenkins.StrataEstimator().insert(keys)
+        results["IBLT.insert/uuid8"] = keyed_result(
+            best_of(repeat, iblt), len(keys), 8 * len(keys))
+        results["StrataEstimator.insert/uuid8"] = keyed_result(
+            best_of(repeat, strata), len(keys), 8 * len(keys))
+    return results
+
+
+def bench_ingest(corpora, repeat):
+    """hash_iter over a generator, against draining it into a list first."""
+    results = {}
+    if not hasattr(jenkins, "hash_iter"):
+        return results
+    for cname, keys in corpora:
+        nbytes = sum(len(k) for k in keys)
+        t = best_of(repeat, lambda: jenkins.hash_iter(k for k in keys))
+        results["hash_iter/%s" % cname] = keyed_result(t, len(keys), nbytes)
+        if hasattr(jenkins, "MultisetHash"):
+            t = best_of(repeat, lambda: jenkins.hash_iter(
+                (k for k in keys), into=jenkins.MultisetHash()))
+            results["hash_iter_into/%s" % cname] = keyed_result(
+                t, len(keys), nbytes)
+    return results
+
+
+def bench_files(rng, repeat, nfiles=64, size=256 * 1024):
+    """hashfile, hashfiles and hashgzip over files in a temporary directory."""
+    results = {}
+    if not hasattr(jenkins, "hashfile"):
+        return results
+    tmp = tempfile.mkdtemp(prefix="bench_jenkins")
+    try:
+        paths = []
+        for i in range(nfiles):
+            path = os.path.join(tmp, "f%d" % i)
+            with open(path, "wb") as f:
+                f.write(bytearray(rng.getrandbits(8) for _ in range(size)))
+            paths.append(path)
+        total = nfiles * size
+
+        def one():
+            for p in paths:
+                jenkins.hashfile(p)
+        results["hashfile"] = {"mb_per_s": total / best_of(repeat, one) / 1e6}
+        t = best_of(repeat, lambda: jenkins.hashfiles(paths))
+        results["hashfiles"] = {"mb_per_s": total / t / 1e6}
+
+        if hasattr(jenkins, "hashgzip"):
+            gz = os.path.join(tmp, "data.gz")
+            with gzip.open(gz, "wb") as f:
+                for p in paths[:8]:
+                    with open(p, "rb") as src:
+                        f.write(src.read())
+            t = best_of(repeat, lambda: jenkins.hashgzip(gz))
+            results["hashgzip"] = {"mb_per_s": 8 * size / t / 1e6}
+    finally:
+        shutil.rmtree(tmp)
+    return results
+
+
+def run(args):
+    global jenkins
+    import jenkins
+
+    rng = random.Random(args.seed)
+    corpora = [(name, gen(rng, args.keys)) for name, gen in CORPORA]
+
+    report = {
+        "meta": {
+            "python": platform.python_version(),
+            "implementation": platform.python_implementation(),
+            "machine": platform.machine(),
+            "platform": platform.platform(),
+            "module": getattr(jenkins, "__file__", None),
+            "keys": args.keys,
+            "seed": args.seed,
+            "repeat": args.repeat,
+            "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        },
+        "call_overhead": bench_call_overhead(args.repeat),
+        "throughput": bench_throughput(corpora, args.repeat),
+        "batch": bench_batch(corpora, args.repeat),
+        "threads": bench_threads(dict(corpora)["url"], args.repeat,
+                                 args.threads),
+        "memory": bench_memory(dict(corpora)["uuid"]),
+        "sketches": bench_sketches(corpora, args.repeat),
+        "ingest": bench_ingest(corpora, args.repeat),
+        "files": bench_files(rng, args.repeat),
+    }
+
+    text = json.dumps(report, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+
+# ------------------------------------------------------------- comparison
+
+# For each metric, whether a larger value is better.
+HIGHER_IS_BETTER = {
+    "ns_per_call": False,
+    "ns_per_key": False,
+    "mb_per_s": True,
+    "keys_per_s": True,
+    "speedup": True,
+    "bytes_per_result": False,
+}
+
+
+def compare(args):
+    with open(args.base) as f:
+        base = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+
+    regressions = 0
+    rows = []
+    for section in sorted(base):
+        if section == "meta" or section not in new:
+            continue
+        for bench in sorted(base[section]):
+            if bench not in new[section]:
+                continue
+            for metric, old in sorted(base[section][bench].items()):
+                cur = new[section][bench].get(metric)
+                if metric not in HIGHER_IS_BETTER or cur is None or not old:
+                    continue
+                change = (cur - old) / old
+                worse = -change if HIGHER_IS_BETTER[metric] else change
+                flag = ""
+                if worse > args.threshold:
+                    flag = "REGRESSION"
+                    regressions += 1
+                elif worse < -args.threshold:
+                    flag = "improved"
+                rows.append((section + "/" + bench, metric, old, cur,
+                             change * 100, flag))
+
+    width = max([len(r[0]) for r in rows] + [9])
+    print("%-*s %-16s %14s %14s %8s" % (width, "benchmark", "metric",
+                                        "base", "new", "change"))
+    for name, metric, old, cur, pct, flag in rows:
+        if args.only_changes and not flag:
+            continue
+        print("%-*s %-16s %14.2f %14.2f %+7.1f%% %s"
+              % (width, name, metric, old, cur, pct, flag))
+    print("\n%d regression(s) beyond %.0f%%" % (regressions,
+                                               args.threshold * 100))
+    return 1 if regressions else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = parser.add_subparsers(dest="command")
+
+    p = sub.add_parser("run", help="run the benchmarks")
+    p.add_argument("-o", "--output", help="write JSON here (default stdout)")
+    p.add_argument("--keys", type=int, default=50000,
+                   help="keys per corpus (default %(default)s)")
+    p.add_argument("--repeat", type=int, default=5,
+                   help="repetitions; the best is kept (default %(default)s)")
+    p.add_argument("--threads", type=int, default=8,
+                   help="largest thread count to try (default %(default)s)")
+    p.add_argument("--seed", type=int, default=1234)
+
+    p = sub.add_parser("compare", help="compare two result files")
+    p.add_argument("base")
+    p.add_argument("new")
+    p.add_argument("--threshold", type=float, default=0.10,
+                   help="relative change that counts as a regression "
+                        "(default %(default)s)")
+    p.add_argument("--only-changes", action="store_true",
+                   help="only print rows beyond the threshold")
+
+    args = parser.parse_args()
+    if args.command == "run":
+        run(args)
+    elif args.command == "compare":
+        sys.exit(compare(args))
+    else:
+        parser.print_help()
+        sys.exit(2)
+
+
+if __name__ == "__main__":
+    main()
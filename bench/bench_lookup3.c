@@ -0,0 +1,259 @@
+/*
+  Native microbenchmark for the hash kernels in lookup3.c and oneatatime.c.
+
+  Every kernel is timed over a range of key lengths (0 to 4096 bytes) and
+  key alignments (0 to 3 bytes past a 64-byte boundary), which exercises
+  the aligned, 16-bit and byte-at-a-time paths of hashlittle() and
+  hashlittle2().  Each call feeds its result into the next call's initval,
+  so the numbers are per-key latencies, the same quantity driver1() in
+  lookup3.c used to print with one second resolution.
+
+  Wall time comes from clock_gettime(CLOCK_MONOTONIC).  On x86 the time
+  stamp counter is read around the same window; it ticks at the nominal
+  (not turbo) frequency, so compare cycle figures on the same machine only.
+
+  Results are written as JSON, one record per (kernel, length, alignment),
+  suitable for diffing between builds.
+
+  Usage: bench_lookup3 [-k kernel] [-l len,len,...] [-t ms] [-r reps] [-o file]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lookup3.c"
+#include "../oneatatime.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+# define HAVE_TSC 1
+# define read_tsc() __rdtsc()
+#else
+# define HAVE_TSC 0
+# define read_tsc() 0
+#endif
+
+#define MAX_KEY_LEN 4096
+#define MAX_LENGTHS 64
+
+typedef uint32_t (*kernel_fn)(const uint8_t *key, size_t len, uint32_t seed);
+
+static uint32_t k_hashlittle(const uint8_t *key, size_t len, uint32_t seed) {
+  return hashlittle(key, len, seed);
+}
+
+static uint32_t k_hashlittle2(const uint8_t *key, size_t len, uint32_t seed) {
+  uint32_t pc = seed, pb = 0;
+  hashlittle2(key, len, &pc, &pb);
+  return pc ^ pb;
+}
+
+static uint32_t k_hashbig(const uint8_t *key, size_t len, uint32_t seed) {
+  return hashbig(key, len, seed);
+}
+
+/* hashword() counts its length in uint32_ts; the tail of the key is ignored */
+static uint32_t k_hashword(const uint8_t *key, size_t len, uint32_t seed) {
+  return hashword((const uint32_t *) key, len / 4, seed);
+}
+
+static uint32_t k_hashword2(const uint8_t *key, size_t len, uint32_t seed) {
+  uint32_t pc = seed, pb = 0;
+  hashword2((const uint32_t *) key, len / 4, &pc, &pb);
+  return pc ^ pb;
+}
+
+static uint32_t k_oneatatime(const uint8_t *key, size_t len, uint32_t seed) {
+  return one_at_a_time((const char *) key, len) ^ seed;
+}
+
+static const struct kernel {
+  const char *name;
+  kernel_fn   fn;
+  int         word_aligned; /* only meaningful on 4-byte aligned keys */
+} kernels[] = {
+  {"hashlittle",  k_hashlittle,  0},
+  {"hashlittle2", k_hashlittle2, 0},
+  {"hashbig",     k_hashbig,     0},
+  {"hashword",    k_hashword,    1},
+  {"hashword2",   k_hashword2,   1},
+  {"oneatatime",  k_oneatatime,  0},
+  {NULL, NULL, 0}
+};
+
+static const size_t default_lengths[] = {
+  0, 1, 2, 3, 4, 5, 7, 8, 11, 12, 13, 15, 16, 20, 24, 31, 32, 36, 48, 63,
+  64, 100, 128, 256, 512, 1000, 1024, 2048, 4096
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static volatile uint32_t sink;
+
+/* Run iters chained calls; returns elapsed nanoseconds and TSC ticks. */
+static uint64_t run(kernel_fn fn, const uint8_t *key, size_t len,
+                    uint64_t iters, uint64_t *ticks) {
+  uint64_t i, t0, t1, c0, c1;
+  uint32_t h = 0;
+
+  t0 = now_ns();
+  c0 = read_tsc();
+  for (i = 0; i < iters; ++i)
+    h = fn(key, len, h);
+  c1 = read_tsc();
+  t1 = now_ns();
+
+  sink = h;
+  *ticks = c1 - c0;
+  return t1 - t0;
+}
+
+static void measure(const struct kernel *k, const uint8_t *key, size_t len,
+                    uint64_t target_ns, int reps, double *best_ns,
+                    double *best_ticks, uint64_t *iters_out) {
+  uint64_t iters = 1, elapsed, ticks;
+  int r;
+
+  /* grow the iteration count until one run fills a tenth of the target */
+  for (;;) {
+    elapsed = run(k->fn, key, len, iters, &ticks);
+    if (elapsed >= target_ns / 10 || iters >= ((uint64_t) 1 << 40))
+      break;
+    iters *= 2;
+  }
+  if (elapsed > 0 && elapsed < target_ns)
+    iters = (uint64_t) ((double) iters * target_ns / elapsed) + 1;
+
+  *best_ns = *best_ticks = -1;
+  for (r = 0; r < reps; ++r) {
+    double ns, tk;
+
+    elapsed = run(k->fn, key, len, iters, &ticks);
+    ns = (double) elapsed / iters;
+    tk = (double) ticks / iters;
+    if (*best_ns < 0 || ns < *best_ns) {
+      *best_ns = ns;
+      *best_ticks = tk;
+    }
+  }
+  *iters_out = iters;
+}
+
+static int parse_lengths(const char *arg, size_t *out) {
+  int n = 0;
+  char *end;
+
+  while (*arg && n < MAX_LENGTHS) {
+    unsigned long v = strtoul(arg, &end, 10);
+    if (end == arg || v > MAX_KEY_LEN)
+      return -1;
+    out[n++] = (size_t) v;
+    arg = (*end == ',') ? end + 1 : end;
+  }
+  return n;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-k kernel] [-l len,len,...] [-t ms] [-r reps] [-o file]\n",
+          prog);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  static uint8_t storage[MAX_KEY_LEN + 128];
+  uint8_t *base = (uint8_t *) (((uintptr_t) storage + 63) & ~(uintptr_t) 63);
+  size_t lengths[MAX_LENGTHS];
+  int nlengths, opt, reps = 5, first = 1;
+  const char *only = NULL;
+  double target_ms = 20.0;
+  FILE *out = stdout;
+  const struct kernel *k;
+  size_t i, li;
+
+  nlengths = (int) (sizeof(default_lengths) / sizeof(default_lengths[0]));
+  memcpy(lengths, default_lengths, sizeof(default_lengths));
+
+  while ((opt = getopt(argc, argv, "k:l:t:r:o:h")) != -1) {
+    switch (opt) {
+    case 'k': only = optarg; break;
+    case 'l':
+      nlengths = parse_lengths(optarg, lengths);
+      if (nlengths <= 0)
+        usage(argv[0]);
+      break;
+    case 't': target_ms = atof(optarg); break;
+    case 'r': reps = atoi(optarg); break;
+    case 'o':
+      out = fopen(optarg, "w");
+      if (!out) {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    default: usage(argv[0]);
+    }
+  }
+  if (reps < 1 || target_ms <= 0)
+    usage(argv[0]);
+
+  for (i = 0; i < MAX_KEY_LEN + 64; ++i)
+    base[i] = (uint8_t) (i * 131 + 7);
+
+  fprintf(out, "{\n  \"benchmark\": \"lookup3\",\n");
+  fprintf(out, "  \"timer\": \"clock_gettime(CLOCK_MONOTONIC)\",\n");
+  fprintf(out, "  \"tsc\": %s,\n", HAVE_TSC ? "true" : "false");
+  fprintf(out, "  \"target_ms\": %g,\n  \"reps\": %d,\n", target_ms, reps);
+  fprintf(out, "  \"results\": [");
+
+  for (k = kernels; k->name; ++k) {
+    int align;
+
+    if (only && strcmp(only, k->name) != 0)
+      continue;
+
+    for (li = 0; li < (size_t) nlengths; ++li) {
+      size_t len = lengths[li];
+
+      for (align = 0; align < 4; ++align) {
+        double ns, ticks;
+        uint64_t iters;
+
+        if (k->word_aligned && align != 0)
+          continue;
+
+        measure(k, base + align, len, (uint64_t) (target_ms * 1e6), reps,
+                &ns, &ticks, &iters);
+
+        fprintf(out, "%s\n    {\"kernel\": \"%s\", \"len\": %lu, "
+                "\"align\": %d, \"iters\": %llu, \"ns_per_key\": %.3f, ",
+                first ? "" : ",", k->name, (unsigned long) len, align,
+                (unsigned long long) iters, ns);
+        if (HAVE_TSC)
+          fprintf(out, "\"cycles_per_key\": %.2f, ", ticks);
+        else
+          fprintf(out, "\"cycles_per_key\": null, ");
+        if (HAVE_TSC && len > 0)
+          fprintf(out, "\"cycles_per_byte\": %.3f, ", ticks / len);
+        else
+          fprintf(out, "\"cycles_per_byte\": null, ");
+        fprintf(out, "\"gb_per_s\": %.3f}", ns > 0 ? len / ns : 0.0);
+        first = 0;
+        fflush(out);
+      }
+    }
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
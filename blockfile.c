@@ -0,0 +1,681 @@
+/*
+  Block files: data with a lookup3 checksum for every block, checked when
+  the block is first read instead of all at once when the file is opened.
+
+  write_blockfile() writes the data followed by a table with the 64-bit
+  hash (hll_hash(), i.e. hashlittle2) of each block_size block, the last
+  one possibly short, and a footer:
+
+    magic       "JKBLOCK1"
+    data_len    bytes of data
+    block_size
+    table_hash  hashlittle() of the table
+    footer_hash hashlittle() of the footer up to this field
+    reserved
+
+  all little-endian.  A BlockFile maps the file and checks only the
+  footer and the table when opened, so opening costs one hash of the
+  table, 1/8192 of the data at the default block size.  Every read()
+  first checks each block it touches that has not been checked yet, and
+  records the result in two bitmaps (checked, bad) that any thread may
+  set, so a block is hashed about once however many reads cover it.
+  verify() checks the rest on background threads, which take blocks from
+  a shared counter in runs of BF_RUN.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BF_MAGIC          "JKBLOCK1"
+#define BF_FOOTER_SIZE    40
+#define BF_BLOCK_SIZE     65536
+#define BF_MIN_BLOCK_SIZE 4096
+#define BF_MAX_BLOCK_SIZE (1 << 30)
+#define BF_RUN            16
+
+/* The footer for a file; fills BF_FOOTER_SIZE bytes. */
+static void bf_footer(uint8_t *f, uint64_t data_len, uint32_t block_size,
+                      uint32_t table_hash) {
+  uint32_t footer_hash;
+
+  memset(f, 0, BF_FOOTER_SIZE);
+  memcpy(f, BF_MAGIC, 8);
+  jk_put64(f + 8, data_len);
+  jk_put64(f + 16, block_size | ((uint64_t) table_hash << 32));
+  footer_hash = hashlittle(f, 24, 0);
+  jk_put64(f + 24, footer_hash);
+}
+
+/* ---------------------------------------------------------------- writer */
+
+struct bf_writer {
+  int fd;
+  uint32_t block_size;
+  uint8_t *block;           /* the block being filled */
+  size_t fill;
+  uint64_t data_len;
+  uint8_t *table;           /* 8 bytes per finished block */
+  size_t nblocks, cap;
+};
+
+static int bf_write_all(int fd, const void *buf, size_t len) {
+  const char *p = (const char *) buf;
+
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t) n;
+  }
+  return 0;
+}
+
+/* Hash and write the block being filled; sets errno on failure. */
+static int bf_writer_block(struct bf_writer *w) {
+  if (w->nblocks == w->cap) {
+    size_t cap = w->cap ? w->cap * 2 : 1024;
+    uint8_t *table = realloc(w->table, cap * 8);
+
+    if (!table) {
+      errno = ENOMEM;
+      return -1;
+    }
+    w->table = table;
+    w->cap = cap;
+  }
+  jk_put64(w->table + w->nblocks * 8, hll_hash(w->block, w->fill));
+  ++w->nblocks;
+  if (bf_write_all(w->fd, w->block, w->fill) < 0)
+    return -1;
+  w->fill = 0;
+  return 0;
+}
+
+static int bf_writer_add(struct bf_writer *w, const char *p, size_t len) {
+  while (len) {
+    size_t take = w->block_size - w->fill;
+
+    if (take > len)
+      take = len;
+    memcpy(w->block + w->fill, p, take);
+    w->fill += take;
+    w->data_len += take;
+    p += take;
+    len -= take;
+    if (w->fill == w->block_size && bf_writer_block(w) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int bf_writer_finish(struct bf_writer *w) {
+  uint8_t footer[BF_FOOTER_SIZE];
+
+  if (w->fill && bf_writer_block(w) < 0)
+    return -1;
+  bf_footer(footer, w->data_len, w->block_size,
+            hashlittle(w->table, w->nblocks * 8, 0));
+  if (bf_write_all(w->fd, w->table, w->nblocks * 8) < 0 ||
+      bf_write_all(w->fd, footer, sizeof(footer)) < 0)
+    return -1;
+  return fsync(w->fd);
+}
+
+static char write_blockfile_doc[] = "write_blockfile(path, data[, block_size]) -- Writes data, a bytes-like object or an iterable of them, to path as a block file that BlockFile reads: the data followed by a lookup3 checksum of every block_size bytes (default 65536, a multiple of 4096). The file is written under a temporary name, fsync'd and renamed into place. Returns the number of data bytes.";
+
+static PyObject* write_blockfile_py(PyObject* self, PyObject* args,
+                                    PyObject* kwds) {
+  static char *kwlist[] = {"path", "data", "block_size", NULL};
+  PyObject *path_obj, *data, *iter = NULL, *item = NULL;
+  unsigned int block_size = BF_BLOCK_SIZE;
+  struct bf_writer w;
+  const char *path;
+  char tmp[4096];
+  int rc = 0, saved;
+
+#if PY_MAJOR_VERSION >= 3
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O|I", kwlist,
+                                   PyUnicode_FSConverter, &path_obj, &data,
+                                   &block_size))
+    return NULL;
+#else
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "SO|I", kwlist, &path_obj,
+                                   &data, &block_size))
+    return NULL;
+  Py_INCREF(path_obj);
+#endif
+  path = PyBytes_AS_STRING(path_obj);
+  if (block_size < BF_MIN_BLOCK_SIZE || block_size > BF_MAX_BLOCK_SIZE ||
+      block_size % BF_MIN_BLOCK_SIZE) {
+    Py_DECREF(path_obj);
+    PyErr_Format(PyExc_ValueError, "block_size must be a multiple of %d "
+                 "up to %d", BF_MIN_BLOCK_SIZE, BF_MAX_BLOCK_SIZE);
+    return NULL;
+  }
+  if (!PyObject_CheckBuffer(data)) {
+    iter = PyObject_GetIter(data);
+    if (!iter) {
+      Py_DECREF(path_obj);
+      return NULL;
+    }
+  }
+
+  memset(&w, 0, sizeof(w));
+  w.block_size = block_size;
+  w.block = malloc(block_size);
+  if (!w.block) {
+    Py_XDECREF(iter);
+    Py_DECREF(path_obj);
+    return PyErr_NoMemory();
+  }
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path,
+               (long) getpid()) >= (int) sizeof(tmp)) {
+    errno = ENAMETOOLONG;
+    w.fd = -1;
+  } else {
+    w.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  if (w.fd < 0) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *) path);
+    goto done;
+  }
+
+  item = iter ? PyIter_Next(iter) : (Py_INCREF(data), data);
+  while (item) {
+    Py_buffer view;
+
+    if (PyObject_GetBuffer(item, &view, PyBUF_SIMPLE) < 0)
+      goto done;
+    Py_BEGIN_ALLOW_THREADS
+    rc = bf_writer_add(&w, (const char *) view.buf, (size_t) view.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    Py_CLEAR(item);
+    if (rc < 0) {
+      PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *) path);
+      goto done;
+    }
+    if (iter)
+      item = PyIter_Next(iter);
+  }
+  if (PyErr_Occurred())
+    goto done;
+
+  Py_BEGIN_ALLOW_THREADS
+  rc = bf_writer_finish(&w);
+  if (rc == 0) {
+    rc = close(w.fd);
+    w.fd = -1;
+  }
+  if (rc == 0)
+    rc = rename(tmp, path);
+  Py_END_ALLOW_THREADS
+  if (rc < 0) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *) path);
+    goto done;
+  }
+
+done:
+  saved = PyErr_Occurred() != NULL;
+  Py_XDECREF(item);
+  Py_XDECREF(iter);
+  if (w.fd >= 0)
+    close(w.fd);
+  if (saved)
+    unlink(tmp);
+  free(w.block);
+  free(w.table);
+  Py_DECREF(path_obj);
+  if (saved)
+    return NULL;
+  return PyLong_FromUnsignedLongLong((unsigned long long) w.data_len);
+}
+
+/* ---------------------------------------------------------------- reader */
+
+typedef struct {
+  PyObject_HEAD
+  PyObject *path;           /* bytes */
+  const uint8_t *map;
+  size_t map_size;
+  const uint8_t *table;
+  uint64_t data_len, nblocks;
+  uint32_t block_size;
+  uint64_t *checked, *bad;  /* bitmaps, one bit per block */
+  size_t bitmap_size;       /* bytes mapped for both */
+  uint64_t next;            /* next block for the verifier threads */
+  int stop;
+  int nthreads, joining;    /* guarded by lock */
+  pthread_t threads[JK_MAX_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t joined;
+  struct jk_memory mem;
+} BlockFileObject;
+
+static int bf_test(const uint64_t *bits, uint64_t i) {
+  return (__atomic_load_n(&bits[i / 64], __ATOMIC_ACQUIRE) >> (i % 64)) & 1;
+}
+
+static void bf_set(uint64_t *bits, uint64_t i) {
+  __atomic_fetch_or(&bits[i / 64], (uint64_t) 1 << (i % 64),
+                    __ATOMIC_RELEASE);
+}
+
+/* Check block i unless already checked; returns 0 if it is good. */
+static int bf_check(BlockFileObject *f, uint64_t i) {
+  uint64_t off = i * f->block_size, len = f->block_size;
+
+  if (!bf_test(f->checked, i)) {
+    if (off + len > f->data_len)
+      len = f->data_len - off;
+    if (hll_hash(f->map + off, (size_t) len) != jk_get64(f->table + i * 8))
+      bf_set(f->bad, i);
+    bf_set(f->checked, i);
+  }
+  return bf_test(f->bad, i) ? -1 : 0;
+}
+
+/* Check blocks first..last; returns the first bad one or -1. */
+static int64_t bf_check_range(BlockFileObject *f, uint64_t first,
+                              uint64_t last) {
+  uint64_t i;
+
+  for (i = first; i <= last; ++i)
+    if (bf_check(f, i) < 0)
+      return (int64_t) i;
+  return -1;
+}
+
+static void *bf_verify_main(void *p) {
+  BlockFileObject *f = (BlockFileObject *) p;
+
+  while (!__atomic_load_n(&f->stop, __ATOMIC_RELAXED)) {
+    uint64_t i, first = __atomic_fetch_add(&f->next, BF_RUN,
+                                           __ATOMIC_RELAXED);
+
+    if (first >= f->nblocks)
+      break;
+    for (i = first; i < first + BF_RUN && i < f->nblocks; ++i)
+      bf_check(f, i);
+  }
+  return NULL;
+}
+
+/* Start nt verifier threads unless some are running or being joined. */
+static void bf_start(BlockFileObject *f, int nt) {
+  int t;
+
+  pthread_mutex_lock(&f->lock);
+  if (f->nthreads == 0 && !f->joining) {
+    f->next = 0;
+    f->stop = 0;
+    for (t = 0; t < nt; ++t) {
+      if (pthread_create(&f->threads[t], NULL, bf_verify_main, f) != 0)
+        break;
+      ++f->nthreads;
+    }
+  }
+  pthread_mutex_unlock(&f->lock);
+}
+
+/*
+  Join the verifier threads; call with the GIL released.  One caller joins
+  them and any others wait until it is done.
+*/
+static void bf_join(BlockFileObject *f) {
+  int t, n;
+
+  pthread_mutex_lock(&f->lock);
+  while (f->joining)
+    pthread_cond_wait(&f->joined, &f->lock);
+  n = f->nthreads;
+  if (n == 0) {
+    pthread_mutex_unlock(&f->lock);
+    return;
+  }
+  f->joining = 1;
+  pthread_mutex_unlock(&f->lock);
+
+  for (t = 0; t < n; ++t)
+    pthread_join(f->threads[t], NULL);
+
+  pthread_mutex_lock(&f->lock);
+  f->nthreads = 0;
+  f->joining = 0;
+  pthread_cond_broadcast(&f->joined);
+  pthread_mutex_unlock(&f->lock);
+}
+
+static PyObject* bf_bad_block(BlockFileObject *f, int64_t block) {
+  PyErr_Format(PyExc_ValueError, "block %lld failed its checksum: %s",
+               (long long) block, PyBytes_AS_STRING(f->path));
+  return NULL;
+}
+
+static char blockfile_read_doc[] = "read([offset[, length]]) -- Returns length bytes of data starting at offset (by default everything from offset on). Blocks that have not been checked yet are checked first; ValueError is raised if any fails its checksum.";
+
+static PyObject* blockfile_read(BlockFileObject *self, PyObject *args) {
+  unsigned long long offset = 0, length = (unsigned long long) -1;
+  uint64_t first, last, i;
+  int64_t bad;
+
+  if (!PyArg_ParseTuple(args, "|KK", &offset, &length))
+    return NULL;
+  if (offset > self->data_len)
+    offset = self->data_len;
+  if (length > self->data_len - offset)
+    length = self->data_len - offset;
+  if (length > PY_SSIZE_T_MAX)
+    return PyErr_NoMemory();
+  if (length == 0)
+    return PyBytes_FromStringAndSize("", 0);
+
+  first = offset / self->block_size;
+  last = (offset + length - 1) / self->block_size;
+  /* checked blocks cost a bit test; hash the others without the GIL */
+  for (i = first; i <= last && bf_test(self->checked, i); ++i)
+    ;
+  if (i > last) {
+    bad = bf_check_range(self, first, last);
+  } else {
+    Py_BEGIN_ALLOW_THREADS
+    bad = bf_check_range(self, first, last);
+    Py_END_ALLOW_THREADS
+  }
+  if (bad >= 0)
+    return bf_bad_block(self, bad);
+  return PyBytes_FromStringAndSize((const char *) self->map + offset,
+                                   (Py_ssize_t) length);
+}
+
+static char blockfile_verify_doc[] = "verify(wait=True, threads=0) -- Checks every block not checked yet on background threads (threads=0 picks a count from the number of CPUs). With wait=True, waits for them and raises ValueError for the first bad block; otherwise returns at once and reads go on, checking any block they reach first themselves.";
+
+static PyObject* blockfile_verify(BlockFileObject *self, PyObject *args,
+                                  PyObject *kwds) {
+  static char *kwlist[] = {"wait", "threads", NULL};
+  PyObject *wait_obj = Py_True;
+  int wait, threads = 0, nt;
+  int64_t bad;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oi", kwlist, &wait_obj,
+                                   &threads))
+    return NULL;
+  wait = PyObject_IsTrue(wait_obj);
+  if (wait < 0)
+    return NULL;
+
+  /* about as much hashing per thread as a batch of short keys */
+  nt = jk_thread_count((Py_ssize_t) (self->data_len / 64), threads);
+  if ((uint64_t) nt > (self->nblocks + BF_RUN - 1) / BF_RUN)
+    nt = (int) ((self->nblocks + BF_RUN - 1) / BF_RUN);
+  bf_start(self, nt);
+  if (!wait)
+    Py_RETURN_NONE;
+
+  Py_BEGIN_ALLOW_THREADS
+  bf_join(self);
+  /* also covers the blocks of threads that could not be started */
+  bad = self->nblocks ? bf_check_range(self, 0, self->nblocks - 1) : -1;
+  Py_END_ALLOW_THREADS
+  if (bad >= 0)
+    return bf_bad_block(self, bad);
+  Py_RETURN_NONE;
+}
+
+static uint64_t bf_count(const uint64_t *bits, uint64_t nblocks) {
+  uint64_t i, n = 0;
+
+  for (i = 0; i < (nblocks + 63) / 64; ++i)
+    n += (uint64_t) __builtin_popcountll(__atomic_load_n(&bits[i],
+                                                         __ATOMIC_RELAXED));
+  return n;
+}
+
+static PyObject* blockfile_get_checked(BlockFileObject *self, void *closure) {
+  return PyLong_FromUnsignedLongLong(bf_count(self->checked, self->nblocks));
+}
+
+static PyObject* blockfile_get_bad(BlockFileObject *self, void *closure) {
+  PyObject *list = PyList_New(0);
+  uint64_t i;
+
+  for (i = 0; list && i < self->nblocks; ++i) {
+    if (bf_test(self->bad, i)) {
+      PyObject *n = PyLong_FromUnsignedLongLong(i);
+
+      if (!n || PyList_Append(list, n) < 0)
+        Py_CLEAR(list);
+      Py_XDECREF(n);
+    }
+  }
+  return list;
+}
+
+static PyObject* blockfile_get_block_size(BlockFileObject *self,
+                                          void *closure) {
+  return PyLong_FromUnsignedLong(self->block_size);
+}
+
+static PyObject* blockfile_get_nblocks(BlockFileObject *self, void *closure) {
+  return PyLong_FromUnsignedLongLong(self->nblocks);
+}
+
+static PyObject* blockfile_get_memory(BlockFileObject *self, void *closure) {
+  return jk_memory_dict(&self->mem);
+}
+
+static Py_ssize_t blockfile_len(BlockFileObject *self) {
+  return (Py_ssize_t) self->data_len;
+}
+
+/* Map the file and check its footer and table; sets errno or *why. */
+static int bf_open(BlockFileObject *f, const char *path, const char **why) {
+  const uint8_t *footer;
+  struct stat st;
+  uint64_t word;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  if (st.st_size < BF_FOOTER_SIZE) {
+    close(fd);
+    *why = "not a block file";
+    return -1;
+  }
+  f->map_size = (size_t) st.st_size;
+  f->map = mmap(NULL, f->map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (f->map == MAP_FAILED) {
+    f->map = NULL;
+    return -1;
+  }
+  jk_memory_mapped(&f->mem, (ssize_t) f->map_size);
+
+  footer = f->map + f->map_size - BF_FOOTER_SIZE;
+  if (memcmp(footer, BF_MAGIC, 8) != 0) {
+    *why = "not a block file";
+    return -1;
+  }
+  if (jk_get64(footer + 24) != hashlittle(footer, 24, 0)) {
+    *why = "block file footer failed its checksum";
+    return -1;
+  }
+  f->data_len = jk_get64(footer + 8);
+  word = jk_get64(footer + 16);
+  f->block_size = (uint32_t) word;
+  if (f->block_size < BF_MIN_BLOCK_SIZE) {
+    *why = "not a block file";
+    return -1;
+  }
+  f->nblocks = (f->data_len + f->block_size - 1) / f->block_size;
+  if (f->data_len + f->nblocks * 8 + BF_FOOTER_SIZE != f->map_size) {
+    *why = "block file is truncated or has trailing data";
+    return -1;
+  }
+  f->table = f->map + f->data_len;
+  if (hashlittle(f->table, f->nblocks * 8, 0) != (uint32_t) (word >> 32)) {
+    *why = "block file table failed its checksum";
+    return -1;
+  }
+
+  /* verification touches blocks in order, reads wherever they like */
+  madvise((void *) f->map, f->map_size, MADV_RANDOM);
+  f->bitmap_size = 2 * ((f->nblocks + 63) / 64) * sizeof(uint64_t);
+  if (f->bitmap_size == 0)
+    f->bitmap_size = 2 * sizeof(uint64_t);
+  f->checked = jk_map(&f->mem, &f->bitmap_size);
+  if (!f->checked)
+    return -1;
+  f->bad = f->checked + (f->nblocks + 63) / 64;
+  jk_memory_live(&f->mem, (ssize_t) (f->map_size + f->bitmap_size));
+  return 0;
+}
+
+static int blockfile_init(BlockFileObject *self, PyObject *args,
+                          PyObject *kwds) {
+  static char *kwlist[] = {"path", NULL};
+  const char *why = NULL;
+  PyObject *path;
+  int rc;
+
+#if PY_MAJOR_VERSION >= 3
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist,
+                                   PyUnicode_FSConverter, &path))
+    return -1;
+#else
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "S", kwlist, &path))
+    return -1;
+  Py_INCREF(path);
+#endif
+  if (self->path) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_RuntimeError, "BlockFile already initialized");
+    return -1;
+  }
+  self->path = path;
+  if (jk_memory_init(&self->mem, "BlockFile", Py_None, Py_None) < 0)
+    return -1;
+
+  Py_BEGIN_ALLOW_THREADS
+  rc = bf_open(self, PyBytes_AS_STRING(path), &why);
+  Py_END_ALLOW_THREADS
+  if (rc == 0)
+    return 0;
+  if (why)
+    PyErr_Format(PyExc_ValueError, "%s: %s", why, PyBytes_AS_STRING(path));
+  else
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(path));
+  return -1;
+}
+
+static PyObject* blockfile_new(PyTypeObject *type, PyObject *args,
+                               PyObject *kwds) {
+  BlockFileObject *self = (BlockFileObject *) type->tp_alloc(type, 0);
+
+  if (!self)
+    return NULL;
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_cond_init(&self->joined, NULL);
+  return (PyObject *) self;
+}
+
+static void blockfile_dealloc(BlockFileObject *self) {
+  if (self->nthreads) {
+    __atomic_store_n(&self->stop, 1, __ATOMIC_RELAXED);
+    Py_BEGIN_ALLOW_THREADS
+    bf_join(self);
+    Py_END_ALLOW_THREADS
+  }
+  pthread_cond_destroy(&self->joined);
+  pthread_mutex_destroy(&self->lock);
+  if (self->mem.owner) {
+    if (self->map) {
+      munmap((void *) self->map, self->map_size);
+      jk_memory_mapped(&self->mem, -(ssize_t) self->map_size);
+    }
+    jk_unmap(&self->mem, self->checked, self->bitmap_size);
+    jk_memory_free(&self->mem);
+  }
+  Py_XDECREF(self->path);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef blockfile_methods[] = {
+  {"read",   (PyCFunction) blockfile_read,   METH_VARARGS,
+   blockfile_read_doc},
+  {"verify", (PyCFunction) blockfile_verify, METH_VARARGS | METH_KEYWORDS,
+   blockfile_verify_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef blockfile_getset[] = {
+  {"block_size", (getter) blockfile_get_block_size, NULL,
+   "Bytes of data per checksum.", NULL},
+  {"nblocks",    (getter) blockfile_get_nblocks,    NULL,
+   "Number of blocks.", NULL},
+  {"checked",    (getter) blockfile_get_checked,    NULL,
+   "Number of blocks checked so far.", NULL},
+  {"bad",        (getter) blockfile_get_bad,        NULL,
+   "Indexes of the blocks found to fail their checksum so far.", NULL},
+  {"memory",     (getter) blockfile_get_memory,     NULL,
+   "This file's entry in memory_usage().", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PySequenceMethods blockfile_as_sequence = {
+  (lenfunc) blockfile_len,        /* sq_length */
+};
+
+static char blockfile_type_doc[] = "BlockFile(path) -- Read-only view of a file written by write_blockfile(). Opening maps the file and checks only its checksum table; each block is checked against its checksum the first time it is read, or by verify().";
+
+static PyTypeObject BlockFileType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.BlockFile",            /* tp_name */
+  sizeof(BlockFileObject),        /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) blockfile_dealloc, /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  &blockfile_as_sequence,         /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  blockfile_type_doc,             /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  blockfile_methods,              /* tp_methods */
+  0,                              /* tp_members */
+  blockfile_getset,               /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) blockfile_init,      /* tp_init */
+  0,                              /* tp_alloc */
+  blockfile_new,                  /* tp_new */
+};
@@ -0,0 +1,726 @@
+/*
+  Hashing whole files, with a persistent cache of results.
+
+  hashfile(path) returns hashlittle2() of a file's contents, read with
+  pread() in blocks and hashed as a stream with the GIL released.  A file
+  that shrinks while it is read raises OSError (EIO) rather than faulting
+  on a mapping.  hashfiles(paths, cache) does the same for
+  many files on several threads and can skip files whose hash is already
+  known.
+
+  FileHashCache(path) is an open-addressed table of fixed-size records
+
+    (dev, ino) -> (size, mtime_ns, ctime_ns, pc, pb)
+
+  stored in a flat file that is mmap'd when the cache is opened.  A
+  record is used only if size, mtime and ctime all still match what
+  stat() reports, so re-verifying an unchanged tree costs one stat() per
+  file.  Files modified or changed (the later of mtime and ctime) within
+  JK_FC_RACY_NS of being hashed are not cached, since a later write in
+  the same timestamp tick would go unnoticed (git's "racy clean"
+  problem).
+
+  The mapping is private: updates stay in memory until commit(), which
+  writes the whole table to a temporary file, fsyncs it and renames it
+  over the old one.  A crash leaves either the old or the new table,
+  never a mix.  Entries for deleted files are not removed; clear() starts
+  over.
+
+  hashfiles() looks records up from its worker threads and adds new ones
+  after they finish, both without the GIL, while other threads may be
+  doing the same or calling clear().  Lookups take the cache's rwlock for
+  reading; anything that adds records, grows, remaps or writes the table
+  takes it for writing.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JK_FC_MAGIC    "JKFHC\0\0"
+#define JK_FC_VERSION  1
+#define JK_FC_MIN_CAP  1024
+#define JK_FC_RACY_NS  1000000000LL
+#define JK_FILE_BLOCK  (256 * 1024)
+
+struct jk_fc_header {
+  char magic[7];
+  uint8_t version;
+  uint64_t capacity;        /* power of two */
+  uint64_t count;
+  uint64_t reserved[5];
+};
+
+/* ino == 0 marks an empty slot; no filesystem hands out inode 0 */
+struct jk_fc_entry {
+  uint64_t dev, ino, size;
+  int64_t mtime_ns, ctime_ns;
+  uint32_t pc, pb;
+};
+
+typedef struct {
+  PyObject_HEAD
+  PyObject *path;           /* bytes */
+  void *map;                /* header followed by the entries */
+  size_t map_size;          /* bytes mapped, whole pages */
+  struct jk_memory mem;
+  struct jk_fc_header *header;
+  struct jk_fc_entry *entries;
+  int dirty;
+  pthread_rwlock_t lock;    /* the table; see above */
+} FileHashCacheObject;
+
+/* What stat() says about a file, as compared against a cache record. */
+struct jk_file_id {
+  uint64_t dev, ino, size;
+  int64_t mtime_ns, ctime_ns;
+};
+
+static void jk_file_id(const struct stat *st, struct jk_file_id *id) {
+  id->dev = (uint64_t) st->st_dev;
+  id->ino = (uint64_t) st->st_ino;
+  id->size = (uint64_t) st->st_size;
+  id->mtime_ns = (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+  id->ctime_ns = (int64_t) st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+}
+
+/* When the file last changed, by either timestamp: tools that preserve
+   mtime (cp -p, tar, rsync) still move ctime forward. */
+static int64_t jk_file_changed(const struct jk_file_id *id) {
+  return id->mtime_ns > id->ctime_ns ? id->mtime_ns : id->ctime_ns;
+}
+
+static size_t jk_fc_slot(uint64_t dev, uint64_t ino, uint64_t capacity) {
+  uint32_t words[4];
+
+  words[0] = (uint32_t) dev;
+  words[1] = (uint32_t) (dev >> 32);
+  words[2] = (uint32_t) ino;
+  words[3] = (uint32_t) (ino >> 32);
+  return hashword(words, 4, 0) & (capacity - 1);
+}
+
+static struct jk_fc_entry *jk_fc_find(FileHashCacheObject *c,
+                                      uint64_t dev, uint64_t ino) {
+  uint64_t cap = c->header->capacity;
+  size_t i = jk_fc_slot(dev, ino, cap);
+
+  for (;; i = (i + 1) & (cap - 1)) {
+    struct jk_fc_entry *e = &c->entries[i];
+    if (e->ino == 0 || (e->ino == ino && e->dev == dev))
+      return e;
+  }
+}
+
+static size_t jk_fc_map_size(uint64_t capacity) {
+  return sizeof(struct jk_fc_header) + capacity * sizeof(struct jk_fc_entry);
+}
+
+/* Move the table to a new anonymous mapping, rehashing its records unless
+   drop is set.  On failure the old table is left in place. */
+static int jk_fc_alloc(FileHashCacheObject *c, uint64_t capacity, int drop) {
+  size_t size = jk_fc_map_size(capacity);
+  void *map = jk_map(&c->mem, &size);
+  struct jk_fc_header *header;
+  struct jk_fc_entry *old = c->entries;
+  uint64_t i, old_cap = c->header && !drop ? c->header->capacity : 0;
+
+  if (!map)
+    return -1;
+  header = (struct jk_fc_header *) map;
+  memcpy(header->magic, JK_FC_MAGIC, sizeof(header->magic));
+  header->version = JK_FC_VERSION;
+  header->capacity = capacity;
+  header->count = 0;
+
+  c->header = header;
+  c->entries = (struct jk_fc_entry *) (header + 1);
+  for (i = 0; i < old_cap; ++i) {
+    if (old[i].ino) {
+      *jk_fc_find(c, old[i].dev, old[i].ino) = old[i];
+      ++header->count;
+    }
+  }
+  if (c->map)
+    jk_unmap(&c->mem, c->map, c->map_size);
+  c->map = map;
+  c->map_size = size;
+  c->mem.live = jk_fc_map_size(capacity);
+  return 0;
+}
+
+static int jk_fc_put(FileHashCacheObject *c, const struct jk_file_id *id,
+                     uint32_t pc, uint32_t pb) {
+  struct jk_fc_entry *e;
+
+  if ((c->header->count + 1) * 10 > c->header->capacity * 7 &&
+      jk_fc_alloc(c, c->header->capacity * 2, 0) < 0)
+    return -1;
+  e = jk_fc_find(c, id->dev, id->ino);
+  if (!e->ino)
+    ++c->header->count;
+  e->dev = id->dev;
+  e->ino = id->ino;
+  e->size = id->size;
+  e->mtime_ns = id->mtime_ns;
+  e->ctime_ns = id->ctime_ns;
+  e->pc = pc;
+  e->pb = pb;
+  c->dirty = 1;
+  return 0;
+}
+
+/* Cached hash for id; returns 0 if there is no current record. */
+static int jk_fc_get(FileHashCacheObject *c, const struct jk_file_id *id,
+                     uint32_t *pc, uint32_t *pb) {
+  const struct jk_fc_entry *e = jk_fc_find(c, id->dev, id->ino);
+
+  if (!e->ino || e->size != id->size || e->mtime_ns != id->mtime_ns ||
+      e->ctime_ns != id->ctime_ns)
+    return 0;
+  *pc = e->pc;
+  *pb = e->pb;
+  return 1;
+}
+
+/* Map an existing table file; returns -1 if it is missing or invalid. */
+static int jk_fc_load(FileHashCacheObject *c, const char *path) {
+  struct jk_fc_header header;
+  const struct jk_fc_entry *entries;
+  uint64_t i, used = 0;
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) < 0 ||
+      pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+      memcmp(header.magic, JK_FC_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != JK_FC_VERSION ||
+      header.capacity < JK_FC_MIN_CAP ||
+      (header.capacity & (header.capacity - 1)) != 0 ||
+      header.capacity > ((uint64_t) 1 << 40) ||
+      header.count >= header.capacity ||
+      (uint64_t) st.st_size != jk_fc_map_size(header.capacity)) {
+    close(fd);
+    return -1;
+  }
+  map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  /* jk_fc_find() needs an empty slot to stop at: trust the slots, not
+     the header's count */
+  entries = (const struct jk_fc_entry *) ((struct jk_fc_header *) map + 1);
+  for (i = 0; i < header.capacity; ++i)
+    used += entries[i].ino != 0;
+  if (used != header.count) {
+    munmap(map, (size_t) st.st_size);
+    return -1;
+  }
+
+  c->map = map;
+  c->map_size = (size_t) st.st_size;
+  jk_memory_mapped(&c->mem, (ssize_t) c->map_size);
+  c->mem.live = c->map_size;
+  c->header = (struct jk_fc_header *) map;
+  c->entries = (struct jk_fc_entry *) (c->header + 1);
+  return 0;
+}
+
+/* Write the table to path atomically; sets errno on failure. */
+static int jk_fc_write(FileHashCacheObject *c, const char *path) {
+  char tmp[4096];
+  const char *p = (const char *) c->map;
+  size_t left = jk_fc_map_size(c->header->capacity);
+  int fd, saved;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path,
+               (long) getpid()) >= (int) sizeof(tmp)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+  while (left) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      goto fail;
+    }
+    p += n;
+    left -= (size_t) n;
+  }
+  if (fsync(fd) < 0)
+    goto fail;
+  if (close(fd) < 0) {
+    fd = -1;
+    goto fail;
+  }
+  if (rename(tmp, path) < 0) {
+    fd = -1;
+    goto fail;
+  }
+  return 0;
+
+fail:
+  saved = errno;
+  if (fd >= 0)
+    close(fd);
+  unlink(tmp);
+  errno = saved;
+  return -1;
+}
+
+/*
+  hashlittle2 of the first size bytes of an open regular file; returns 0
+  or an errno value.  A file cut short while it is read gives EIO.
+ */
+static int jk_hash_fd(int fd, uint64_t size, uint32_t *pc, uint32_t *pb) {
+  struct hashlittle2_state s;
+  uint8_t *block;
+  uint64_t off = 0;
+  int err = 0;
+
+  block = malloc(JK_FILE_BLOCK);
+  if (!block)
+    return ENOMEM;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  hashlittle2_init(&s, size, *pc, *pb);
+  JK_ENTER_BATCH(JK_HASHFILE, size, 1);
+  while (off < size) {
+    size_t want = size - off < JK_FILE_BLOCK ? (size_t) (size - off)
+                                             : JK_FILE_BLOCK;
+    ssize_t n = pread(fd, block, want, (off_t) off);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      err = errno;
+      break;
+    }
+    if (n == 0)
+      break;
+    hashlittle2_update(&s, block, (size_t) n);
+    off += (uint64_t) n;
+  }
+  JK_EXIT_BATCH(JK_HASHFILE, size, 1);
+  free(block);
+  if (!err && hashlittle2_final(&s, pc, pb) < 0)
+    err = EIO;
+  return err;
+}
+
+static int64_t jk_wall_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+  Hash one file.  With a cache, a current record is returned instead of
+  reading the file (*cached set to 1).  Returns 0 or an errno value.
+ */
+static int jk_hash_path(const char *path, FileHashCacheObject *cache,
+                        uint32_t *pc, uint32_t *pb, struct jk_file_id *id,
+                        int *cached) {
+  struct stat st;
+  int fd, err;
+
+  *cached = 0;
+  if (cache) {
+    if (stat(path, &st) < 0)
+      return errno;
+    jk_file_id(&st, id);
+    if (S_ISREG(st.st_mode) && jk_fc_get(cache, id, pc, pb)) {
+      *cached = 1;
+      return 0;
+    }
+  }
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return errno;
+  if (fstat(fd, &st) < 0) {
+    err = errno;
+    close(fd);
+    return err;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    return S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+  }
+  jk_file_id(&st, id);
+  err = jk_hash_fd(fd, (uint64_t) st.st_size, pc, pb);
+  close(fd);
+  return err;
+}
+
+static PyTypeObject FileHashCacheType;
+
+static int jk_fc_check(FileHashCacheObject *c) {
+  if (!c->header) {
+    PyErr_SetString(PyExc_ValueError, "FileHashCache is not initialized");
+    return -1;
+  }
+  return 0;
+}
+
+static char hashfile_doc[] = "Takes a path and two optional initial values. Returns hashlittle2 of the file's contents as two unsigned 32 bit integers. The file is read in blocks and hashed with the GIL released; OSError is raised if it shrinks while being read.";
+
+static PyObject* hashfile_py(PyObject* self, PyObject* args) {
+  PyObject *path_obj;
+  const char *path;
+  unsigned long initc = 0, initb = 0;
+  struct stat st;
+  uint32_t pc, pb;
+  int fd, err = 0;
+
+#if PY_MAJOR_VERSION >= 3
+  if (!PyArg_ParseTuple(args, "O&|kk", PyUnicode_FSConverter, &path_obj,
+                        &initc, &initb))
+    return NULL;
+#else
+  if (!PyArg_ParseTuple(args, "S|kk", &path_obj, &initc, &initb))
+    return NULL;
+  Py_INCREF(path_obj);
+#endif
+  path = PyBytes_AS_STRING(path_obj);
+
+  pc = (uint32_t) initc;
+  pb = (uint32_t) initb;
+
+  Py_BEGIN_ALLOW_THREADS
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    err = errno;
+  else if (fstat(fd, &st) < 0)
+    err = errno;
+  else if (!S_ISREG(st.st_mode))
+    err = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+  else
+    err = jk_hash_fd(fd, (uint64_t) st.st_size, &pc, &pb);
+  if (fd >= 0)
+    close(fd);
+  Py_END_ALLOW_THREADS
+
+  if (err) {
+    errno = err;
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *) path);
+    Py_DECREF(path_obj);
+    return NULL;
+  }
+  Py_DECREF(path_obj);
+  return Py_BuildValue("II", pc, pb);
+}
+
+struct jk_hashfiles {
+  struct jk_keys *paths;
+  FileHashCacheObject *cache;
+  uint32_t *pc, *pb;
+  struct jk_file_id *ids;
+  int *errs;                /* errno, or -1 for a cache hit */
+};
+
+static void jk_hashfiles_run(void *ctx, int t, int nt) {
+  struct jk_hashfiles *h = (struct jk_hashfiles *) ctx;
+  Py_ssize_t i, lo, hi;
+
+  jk_share(h->paths->n, t, nt, &lo, &hi);
+  for (i = lo; i < hi; ++i) {
+    int cached;
+
+    h->errs[i] = jk_hash_path(h->paths->ptr[i], h->cache, &h->pc[i],
+                              &h->pb[i], &h->ids[i], &cached);
+    if (!h->errs[i] && cached)
+      h->errs[i] = -1;
+  }
+}
+
+static char hashfiles_doc[] = "hashfiles(paths[, cache][, threads]) -- Returns a list of (pc, pb) tuples, hashfile() of each path, computed on several threads without the GIL. With a FileHashCache, files whose size, mtime and ctime match a cached record are not read, and new results are added to the cache (call its commit() to save them). Raises OSError for the first path that could not be hashed.";
+
+static PyObject* hashfiles_py(PyObject* self, PyObject* args, PyObject* kwds) {
+  static char *kwlist[] = {"paths", "cache", "threads", NULL};
+  PyObject *paths_obj, *cache_obj = Py_None, *result = NULL;
+  struct jk_keys paths;
+  struct jk_hashfiles h;
+  Py_ssize_t i;
+  int threads = 0, nt, failed = 0;
+  int64_t now;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oi", kwlist,
+                                   &paths_obj, &cache_obj, &threads))
+    return NULL;
+  if (cache_obj != Py_None &&
+      !PyObject_TypeCheck(cache_obj, &FileHashCacheType)) {
+    PyErr_SetString(PyExc_TypeError, "cache must be a FileHashCache");
+    return NULL;
+  }
+  if (jk_keys_get(paths_obj, &paths) < 0)
+    return NULL;
+  for (i = 0; i < paths.n; ++i) {
+    if (strlen(paths.ptr[i]) != paths.len[i]) {
+      PyErr_SetString(PyExc_ValueError, "embedded null byte in path");
+      jk_keys_release(&paths);
+      return NULL;
+    }
+  }
+
+  h.paths = &paths;
+  h.cache = cache_obj == Py_None ? NULL : (FileHashCacheObject *) cache_obj;
+  if (h.cache && jk_fc_check(h.cache) < 0) {
+    jk_keys_release(&paths);
+    return NULL;
+  }
+  h.pc = calloc(paths.n ? paths.n : 1, sizeof(uint32_t));
+  h.pb = calloc(paths.n ? paths.n : 1, sizeof(uint32_t));
+  h.ids = calloc(paths.n ? paths.n : 1, sizeof(struct jk_file_id));
+  h.errs = calloc(paths.n ? paths.n : 1, sizeof(int));
+  if (!h.pc || !h.pb || !h.ids || !h.errs) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  /* every file costs a syscall or more, so far fewer make a batch worth
+     splitting than for in-memory keys */
+  nt = jk_thread_count(paths.n * 64, threads);
+  Py_BEGIN_ALLOW_THREADS
+  if (h.cache)
+    pthread_rwlock_rdlock(&h.cache->lock);
+  jk_parallel(nt, jk_hashfiles_run, &h);
+  if (h.cache) {
+    pthread_rwlock_unlock(&h.cache->lock);
+    pthread_rwlock_wrlock(&h.cache->lock);
+    now = jk_wall_ns();
+    for (i = 0; i < paths.n && !failed; ++i)
+      if (h.errs[i] == 0 && now - jk_file_changed(&h.ids[i]) >= JK_FC_RACY_NS)
+        failed = jk_fc_put(h.cache, &h.ids[i], h.pc[i], h.pb[i]) < 0;
+    pthread_rwlock_unlock(&h.cache->lock);
+  }
+  Py_END_ALLOW_THREADS
+
+  if (failed) {
+    PyErr_NoMemory();
+    goto done;
+  }
+  for (i = 0; i < paths.n; ++i) {
+    if (h.errs[i] > 0) {
+      errno = h.errs[i];
+      PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *) paths.ptr[i]);
+      goto done;
+    }
+  }
+
+  result = PyList_New(paths.n);
+  if (!result)
+    goto done;
+  for (i = 0; i < paths.n; ++i) {
+    PyObject *item = Py_BuildValue("II", h.pc[i], h.pb[i]);
+    if (!item) {
+      Py_CLEAR(result);
+      goto done;
+    }
+    PyList_SET_ITEM(result, i, item);
+  }
+
+done:
+  free(h.pc);
+  free(h.pb);
+  free(h.ids);
+  free(h.errs);
+  jk_keys_release(&paths);
+  return result;
+}
+
+static char filehashcache_commit_doc[] = "commit() -- Writes the cache to its file if it changed, atomically: a temporary file is written, fsync'd and renamed over the old one.";
+
+static PyObject* filehashcache_commit(FileHashCacheObject *self) {
+  const char *path;
+  int rc = 0, err = 0;
+
+  if (jk_fc_check(self) < 0)
+    return NULL;
+  path = PyBytes_AS_STRING(self->path);
+  Py_BEGIN_ALLOW_THREADS
+  pthread_rwlock_wrlock(&self->lock);
+  if (self->dirty) {
+    rc = jk_fc_write(self, path);
+    if (rc < 0)
+      err = errno;
+    else
+      self->dirty = 0;
+  }
+  pthread_rwlock_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+  if (rc < 0) {
+    errno = err;
+    return PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *) path);
+  }
+  Py_RETURN_NONE;
+}
+
+static char filehashcache_clear_doc[] = "clear() -- Drops every record. The file is rewritten on the next commit().";
+
+static PyObject* filehashcache_clear(FileHashCacheObject *self) {
+  int rc;
+
+  if (jk_fc_check(self) < 0)
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  pthread_rwlock_wrlock(&self->lock);
+  rc = jk_fc_alloc(self, JK_FC_MIN_CAP, 1);
+  if (rc == 0)
+    self->dirty = 1;
+  pthread_rwlock_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+  if (rc < 0)
+    return PyErr_NoMemory();
+  Py_RETURN_NONE;
+}
+
+static Py_ssize_t filehashcache_len(FileHashCacheObject *self) {
+  Py_ssize_t n;
+
+  if (jk_fc_check(self) < 0)
+    return -1;
+  pthread_rwlock_rdlock(&self->lock);
+  n = (Py_ssize_t) self->header->count;
+  pthread_rwlock_unlock(&self->lock);
+  return n;
+}
+
+static PyObject* filehashcache_get_path(FileHashCacheObject *self,
+                                        void *closure) {
+  Py_INCREF(self->path);
+  return self->path;
+}
+
+static int filehashcache_init(FileHashCacheObject *self, PyObject *args,
+                              PyObject *kwds) {
+  static char *kwlist[] = {"path", "huge_pages", NULL};
+  PyObject *path, *huge_pages = Py_None;
+
+#if PY_MAJOR_VERSION >= 3
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|O", kwlist,
+                                   PyUnicode_FSConverter, &path, &huge_pages))
+    return -1;
+#else
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "S|O", kwlist, &path,
+                                   &huge_pages))
+    return -1;
+  Py_INCREF(path);
+#endif
+  if (self->map) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_RuntimeError, "FileHashCache already initialized");
+    return -1;
+  }
+  self->path = path;
+  if (jk_memory_init(&self->mem, "FileHashCache", huge_pages, Py_None) < 0)
+    return -1;
+
+  /* a missing or unreadable table only means an empty cache */
+  if (jk_fc_load(self, PyBytes_AS_STRING(path)) < 0 &&
+      jk_fc_alloc(self, JK_FC_MIN_CAP, 0) < 0) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject* filehashcache_new(PyTypeObject *type, PyObject *args,
+                                   PyObject *kwds) {
+  FileHashCacheObject *self = (FileHashCacheObject *) type->tp_alloc(type, 0);
+
+  if (!self)
+    return NULL;
+  pthread_rwlock_init(&self->lock, NULL);
+  return (PyObject *) self;
+}
+
+static void filehashcache_dealloc(FileHashCacheObject *self) {
+  if (self->mem.owner) {
+    jk_unmap(&self->mem, self->map, self->map_size);
+    jk_memory_free(&self->mem);
+  }
+  pthread_rwlock_destroy(&self->lock);
+  Py_XDECREF(self->path);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef filehashcache_methods[] = {
+  {"commit", (PyCFunction) filehashcache_commit, METH_NOARGS,
+   filehashcache_commit_doc},
+  {"clear",  (PyCFunction) filehashcache_clear,  METH_NOARGS,
+   filehashcache_clear_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyObject* filehashcache_get_memory(FileHashCacheObject *self,
+                                          void *closure) {
+  return jk_memory_dict(&self->mem);
+}
+
+static PyGetSetDef filehashcache_getset[] = {
+  {"path", (getter) filehashcache_get_path, NULL,
+   "File the cache is loaded from and committed to.", NULL},
+  {"memory", (getter) filehashcache_get_memory, NULL,
+   "This cache's entry in memory_usage().", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PySequenceMethods filehashcache_as_sequence = {
+  (lenfunc) filehashcache_len,    /* sq_length */
+};
+
+static char filehashcache_type_doc[] = "FileHashCache(path, huge_pages=None) -- Cache of hashfile() results keyed by device and inode and checked against size, mtime and ctime, for hashfiles(). The table at path is loaded if it exists and is written back by commit().";
+
+static PyTypeObject FileHashCacheType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.FileHashCache",        /* tp_name */
+  sizeof(FileHashCacheObject),    /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) filehashcache_dealloc, /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  &filehashcache_as_sequence,     /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  filehashcache_type_doc,         /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  filehashcache_methods,          /* tp_methods */
+  0,                              /* tp_members */
+  filehashcache_getset,           /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) filehashcache_init,  /* tp_init */
+  0,                              /* tp_alloc */
+  filehashcache_new,              /* tp_new */
+};
@@ -0,0 +1,342 @@
+/*
+  hashgzip(): hashlittle2 of the decompressed contents of a gzip or zlib
+  file, without holding the decompressed data in memory.
+
+  zlib inflates into small blocks that are fed straight to the
+  incremental hashlittle2 state in stream.c.  With pipeline=True the
+  inflating runs on its own thread and hands blocks over through a ring
+  of JK_GZ_RING blocks, small enough to stay in L2, so decompression and
+  hashing overlap; otherwise both alternate on the calling thread.
+
+  lookup3 needs the total length up front, though it only mixes in the
+  low 32 bits.  For gzip files it is taken from the ISIZE field of the
+  trailer, which is the length modulo 2^32 of the last member only; that
+  is enough for a single member of any size, and only if the low 32 bits
+  of the decompressed length turn out different (multi-member files) is
+  the file hashed again with the length now known.  zlib streams have no length field and are inflated
+  once just to count.  Concatenated gzip members are treated as one
+  stream, as gzip -d does.
+ */
+#include <zlib.h>
+
+#define JK_GZ_IN     (64 * 1024)
+#define JK_GZ_BLOCK  (32 * 1024)
+#define JK_GZ_RING   4
+
+struct jk_gz {
+  int fd;
+  z_stream zs;
+  int eof;                  /* no more compressed input */
+  int mid;                  /* inside a member */
+  int members;              /* members finished */
+  int err;                  /* errno of a failed read */
+  const char *zerr;         /* description of bad compressed data */
+  char zmsg[128];
+  uint8_t in[JK_GZ_IN];
+};
+
+static int jk_gz_start(struct jk_gz *g, int fd) {
+  memset(&g->zs, 0, sizeof(g->zs));
+  g->fd = fd;
+  g->eof = g->mid = g->members = g->err = 0;
+  g->zerr = NULL;
+  if (lseek(fd, 0, SEEK_SET) < 0) {
+    g->err = errno;
+    return -1;
+  }
+  /* 32 added to the window bits detects gzip or zlib headers */
+  if (inflateInit2(&g->zs, 15 + 32) != Z_OK) {
+    g->err = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+static void jk_gz_end(struct jk_gz *g) {
+  inflateEnd(&g->zs);
+}
+
+static void jk_gz_zerror(struct jk_gz *g, const char *what) {
+  snprintf(g->zmsg, sizeof(g->zmsg), "%s%s%s", what,
+           g->zs.msg ? ": " : "", g->zs.msg ? g->zs.msg : "");
+  g->zerr = g->zmsg;
+}
+
+/* Up to cap decompressed bytes into out; returns the count, 0 at the end
+   of the input or -1 on error. */
+static ssize_t jk_gz_read(struct jk_gz *g, uint8_t *out, size_t cap) {
+  z_stream *zs = &g->zs;
+  int rc;
+
+  zs->next_out = out;
+  zs->avail_out = (uInt) cap;
+  while (zs->avail_out > 0) {
+    if (zs->avail_in == 0) {
+      ssize_t n;
+
+      if (g->eof)
+        break;
+      n = read(g->fd, g->in, sizeof(g->in));
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        g->err = errno;
+        return -1;
+      }
+      if (n == 0) {
+        g->eof = 1;
+        break;
+      }
+      zs->next_in = g->in;
+      zs->avail_in = (uInt) n;
+    }
+
+    rc = inflate(zs, Z_NO_FLUSH);
+    if (rc == Z_STREAM_END) {
+      g->mid = 0;
+      ++g->members;
+      inflateReset(zs);
+    } else if (rc == Z_OK || rc == Z_BUF_ERROR) {
+      g->mid = 1;
+    } else {
+      jk_gz_zerror(g, "invalid compressed data");
+      return -1;
+    }
+  }
+
+  if (g->eof && zs->avail_out == cap && (g->mid || !g->members)) {
+    jk_gz_zerror(g, g->mid ? "truncated compressed data"
+                             : "no compressed data");
+    return -1;
+  }
+  return (ssize_t) (cap - zs->avail_out);
+}
+
+/* Decompressed length from the gzip trailer; returns -1 if unknown. */
+static int64_t jk_gz_isize(int fd) {
+  uint8_t b[4];
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < 18 ||
+      pread(fd, b, 2, 0) != 2 || b[0] != 0x1f || b[1] != 0x8b ||
+      pread(fd, b, 4, st.st_size - 4) != 4)
+    return -1;
+  return (int64_t) jk_get32(b);
+}
+
+/* Inflate the whole file, counting bytes; returns 0 or -1. */
+static int jk_gz_count(struct jk_gz *g, uint8_t *block, uint64_t *total) {
+  ssize_t n;
+
+  *total = 0;
+  while ((n = jk_gz_read(g, block, JK_GZ_BLOCK)) > 0)
+    *total += (uint64_t) n;
+  return n < 0 ? -1 : 0;
+}
+
+/* Handing blocks from the inflating thread to the hashing one. */
+struct jk_gz_ring {
+  struct jk_gz *g;
+  uint8_t *blocks;          /* JK_GZ_RING * JK_GZ_BLOCK */
+  size_t len[JK_GZ_RING];
+  uint64_t produced, consumed;
+  int done, failed, stop;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+static void *jk_gz_producer(void *p) {
+  struct jk_gz_ring *r = (struct jk_gz_ring *) p;
+  ssize_t n;
+
+  for (;;) {
+    uint8_t *block;
+
+    pthread_mutex_lock(&r->lock);
+    while (r->produced - r->consumed == JK_GZ_RING && !r->stop)
+      pthread_cond_wait(&r->cond, &r->lock);
+    if (r->stop) {
+      pthread_mutex_unlock(&r->lock);
+      break;
+    }
+    block = r->blocks + (r->produced % JK_GZ_RING) * JK_GZ_BLOCK;
+    pthread_mutex_unlock(&r->lock);
+
+    n = jk_gz_read(r->g, block, JK_GZ_BLOCK);
+
+    pthread_mutex_lock(&r->lock);
+    if (n > 0) {
+      r->len[r->produced % JK_GZ_RING] = (size_t) n;
+      ++r->produced;
+    } else {
+      r->done = 1;
+      r->failed = n < 0;
+    }
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    if (n <= 0)
+      break;
+  }
+  return NULL;
+}
+
+/* Inflate and hash on two threads; returns 0 or -1. */
+static int jk_gz_hash_pipelined(struct jk_gz *g, uint8_t *blocks,
+                                struct hashlittle2_state *s) {
+  struct jk_gz_ring r;
+  pthread_t tid;
+  int failed;
+
+  memset(&r, 0, sizeof(r));
+  r.g = g;
+  r.blocks = blocks;
+  pthread_mutex_init(&r.lock, NULL);
+  pthread_cond_init(&r.cond, NULL);
+  if (pthread_create(&tid, NULL, jk_gz_producer, &r) != 0) {
+    pthread_cond_destroy(&r.cond);
+    pthread_mutex_destroy(&r.lock);
+    g->err = EAGAIN;
+    return -1;
+  }
+
+  pthread_mutex_lock(&r.lock);
+  for (;;) {
+    const uint8_t *block;
+    size_t len;
+
+    while (r.produced == r.consumed && !r.done)
+      pthread_cond_wait(&r.cond, &r.lock);
+    if (r.produced == r.consumed)
+      break;
+    block = r.blocks + (r.consumed % JK_GZ_RING) * JK_GZ_BLOCK;
+    len = r.len[r.consumed % JK_GZ_RING];
+    pthread_mutex_unlock(&r.lock);
+
+    hashlittle2_update(s, block, len);
+
+    pthread_mutex_lock(&r.lock);
+    ++r.consumed;
+    pthread_cond_broadcast(&r.cond);
+  }
+  r.stop = 1;
+  pthread_cond_broadcast(&r.cond);
+  failed = r.failed;
+  pthread_mutex_unlock(&r.lock);
+
+  pthread_join(tid, NULL);
+  pthread_cond_destroy(&r.cond);
+  pthread_mutex_destroy(&r.lock);
+  return failed ? -1 : 0;
+}
+
+/* One hashing pass over the file; returns 0 or -1. */
+static int jk_gz_hash(struct jk_gz *g, uint8_t *blocks, int pipeline,
+                      struct hashlittle2_state *s) {
+  ssize_t n;
+
+  if (pipeline)
+    return jk_gz_hash_pipelined(g, blocks, s);
+  while ((n = jk_gz_read(g, blocks, JK_GZ_BLOCK)) > 0)
+    hashlittle2_update(s, blocks, (size_t) n);
+  return n < 0 ? -1 : 0;
+}
+
+static char hashgzip_doc[] = "hashgzip(path[, initc[, initb]][, pipeline]) -- Returns hashlittle2 of the decompressed contents of a gzip or zlib file, as two unsigned 32 bit integers, streaming the data through a small buffer with the GIL released. With pipeline=True decompression and hashing run on two threads.";
+
+static PyObject* hashgzip_py(PyObject* self, PyObject* args, PyObject* kwds) {
+  static char *kwlist[] = {"path", "initc", "initb", "pipeline", NULL};
+  PyObject *path_obj, *pipeline_obj = Py_False;
+  const char *path;
+  unsigned long initc = 0, initb = 0;
+  struct hashlittle2_state s;
+  struct jk_gz *g;
+  uint8_t *blocks;
+  uint64_t total = 0;
+  int64_t isize;
+  uint32_t pc = 0, pb = 0;
+  int fd = -1, pipeline, rc = -1;
+
+#if PY_MAJOR_VERSION >= 3
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|kkO", kwlist,
+                                   PyUnicode_FSConverter, &path_obj,
+                                   &initc, &initb, &pipeline_obj))
+    return NULL;
+#else
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "S|kkO", kwlist, &path_obj,
+                                   &initc, &initb, &pipeline_obj))
+    return NULL;
+  Py_INCREF(path_obj);
+#endif
+  path = PyBytes_AS_STRING(path_obj);
+  pipeline = PyObject_IsTrue(pipeline_obj);
+  if (pipeline < 0) {
+    Py_DECREF(path_obj);
+    return NULL;
+  }
+
+  g = malloc(sizeof(*g));
+  blocks = malloc((size_t) (pipeline ? JK_GZ_RING : 1) * JK_GZ_BLOCK);
+  if (!g || !blocks) {
+    free(g);
+    free(blocks);
+    Py_DECREF(path_obj);
+    return PyErr_NoMemory();
+  }
+  g->err = 0;
+  g->zerr = NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    g->err = errno;
+  } else {
+    isize = jk_gz_isize(fd);
+    if (isize < 0) {
+      if (jk_gz_start(g, fd) == 0) {
+        rc = jk_gz_count(g, blocks, &total);
+        jk_gz_end(g);
+      }
+    } else {
+      total = (uint64_t) isize;
+      rc = 0;
+    }
+    JK_ENTER_BATCH(JK_HASHGZIP, total, 1);
+    while (rc == 0) {
+      hashlittle2_init(&s, total, (uint32_t) initc, (uint32_t) initb);
+      rc = jk_gz_start(g, fd);
+      if (rc < 0)
+        break;
+      rc = jk_gz_hash(g, blocks, pipeline, &s);
+      jk_gz_end(g);
+      if (rc < 0)
+        break;
+      if ((uint32_t) s.seen == (uint32_t) total) {
+        /* ISIZE is the length mod 2^32, which is all the state used */
+        s.length = total = s.seen;
+        hashlittle2_final(&s, &pc, &pb);
+        break;
+      }
+      /* the trailer's length was not the whole story; go again */
+      total = s.seen;
+    }
+    JK_EXIT_BATCH(JK_HASHGZIP, total, 1);
+    close(fd);
+  }
+  Py_END_ALLOW_THREADS
+
+  free(blocks);
+  if (g->err || g->zerr) {
+    if (g->zerr)
+      PyErr_Format(PyExc_ValueError, "%s: %s", g->zerr, path);
+    else {
+      errno = g->err;
+      PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *) path);
+    }
+    free(g);
+    Py_DECREF(path_obj);
+    return NULL;
+  }
+  free(g);
+  Py_DECREF(path_obj);
+  return Py_BuildValue("II", pc, pb);
+}
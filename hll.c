@@ -0,0 +1,101 @@
+/*
+-------------------------------------------------------------------------------
+hll.c -- HyperLogLog distinct counting on 64-bit lookup3 hashes.
+
+A sketch of precision p has 2^p one-byte registers.  Each key is hashed
+with hashlittle2() and the two halves joined as pc + (pb << 32); the top
+p bits pick a register and the register keeps the largest "position of
+the first set bit" seen in the remaining bits.  The standard error is
+about 1.04 / sqrt(2^p): 0.8% at the default p = 14, which is 16KB.
+
+The serialized form, used by the SQLite extension and the sketch arena,
+is one version byte (HLL_VERSION), one byte holding p, then the 2^p
+registers.  Sketches of equal p merge by taking register-wise maxima.
+
+Like lookup3.c and oneatatime.c this has no Python dependency and is
+meant to be #included.
+-------------------------------------------------------------------------------
+*/
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HLL_VERSION     1
+#define HLL_MIN_P       4
+#define HLL_MAX_P       18
+#define HLL_DEFAULT_P   14
+#define HLL_HEADER      2
+#define hll_registers(p) ((size_t)1 << (p))
+#define hll_size(p)      (HLL_HEADER + hll_registers(p))
+
+/* 64-bit lookup3 hash of a key, as used by every sketch in the module */
+static uint64_t hll_hash(const void *key, size_t len) {
+  uint32_t pc = 0, pb = 0;
+
+  hashlittle2(key, len, &pc, &pb);
+  return pc + (((uint64_t) pb) << 32);
+}
+
+/* Register index and rank for a hash; rank is at most 64 - p + 1. */
+static void hll_split(uint64_t h, int p, size_t *index, uint8_t *rank) {
+  uint64_t rest = (h << p) | ((uint64_t) 1 << (p - 1));
+
+  *index = (size_t) (h >> (64 - p));
+  *rank = (uint8_t) (__builtin_clzll(rest) + 1);
+}
+
+static void hll_add_hash(uint8_t *regs, int p, uint64_t h) {
+  size_t index;
+  uint8_t rank;
+
+  hll_split(h, p, &index, &rank);
+  if (regs[index] < rank)
+    regs[index] = rank;
+}
+
+static void hll_merge(uint8_t *dst, const uint8_t *src, int p) {
+  size_t i, m = hll_registers(p);
+
+  for (i = 0; i < m; ++i)
+    if (dst[i] < src[i])
+      dst[i] = src[i];
+}
+
+/*
+  Estimate from the registers, with linear counting for small
+  cardinalities.  With 64-bit hashes there is no large range correction.
+ */
+static double hll_estimate(const uint8_t *regs, int p) {
+  size_t i, m = hll_registers(p), zeros = 0;
+  double sum = 0.0, alpha, estimate;
+
+  for (i = 0; i < m; ++i) {
+    sum += ldexp(1.0, -regs[i]);
+    if (!regs[i])
+      ++zeros;
+  }
+
+  switch (m) {
+  case 16: alpha = 0.673; break;
+  case 32: alpha = 0.697; break;
+  case 64: alpha = 0.709; break;
+  default: alpha = 0.7213 / (1.0 + 1.079 / m); break;
+  }
+
+  estimate = alpha * m * m / sum;
+  if (estimate <= 2.5 * m && zeros)
+    estimate = m * log((double) m / zeros);
+  return estimate;
+}
+
+/* Returns p for a valid serialized sketch of len bytes, or -1. */
+static int hll_check(const uint8_t *buf, size_t len) {
+  int p;
+
+  if (len < HLL_HEADER || buf[0] != HLL_VERSION)
+    return -1;
+  p = buf[1];
+  if (p < HLL_MIN_P || p > HLL_MAX_P || len != hll_size(p))
+    return -1;
+  return p;
+}
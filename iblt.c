@@ -0,0 +1,990 @@
+/*
+  Set reconciliation: invertible Bloom lookup tables and strata
+  estimators over fixed-size keys.
+
+  An IBLT has `hashes` subtables of cells; each key goes into one cell
+  of every subtable, and a cell holds the number of keys in it, the XOR
+  of those keys and the XOR of their check hashes.  Subtracting the
+  table of one set from the table of another, cell by cell, cancels the
+  keys they share, so what is left describes only the symmetric
+  difference and can be peeled: a cell with a count of +1 or -1 whose
+  check hash matches its key holds exactly one key, which is taken out
+  of its other cells in turn, until nothing is left (success) or no
+  such cell remains (the table was too small).  A table of about 1.5
+  cells per differing key decodes with high probability, whatever the
+  size of the sets themselves.
+
+  Keys are hashed once with hashlittle2 seeded with the table's seed for
+  the cell positions (the cell in subtable j is lookup3's final() of pc,
+  pb and j, reduced), and with hashlittle under a different seed for the
+  check hash, so the two are independent.
+
+  A strata estimator sizes the IBLT to send.  Keys are split into strata
+  by the number of trailing zeros of a third hash, so stratum i holds
+  about 2^-(i+1) of them, and each stratum is a small IBLT.  Comparing two
+  estimators decodes strata from the sparsest down; when one fails, the
+  keys found so far, scaled by the sampling rate, estimate the
+  difference.
+
+  Both serialize to a header followed by the cells, little-endian.
+
+  Every method that reads or writes the cells holds the object's lock,
+  taken with the GIL released, so that insert() from several threads,
+  or insert() racing subtract() or decode(), cannot lose updates.
+ */
+
+#define IB_MAGIC           "JKIBLT01"
+#define SE_MAGIC           "JKSTRA01"
+#define IB_HEADER_SIZE     24
+#define IB_KEY_SIZE        8
+#define IB_HASHES          3
+#define IB_MAX_HASHES      8
+#define IB_MAX_KEY_SIZE    4096
+#define SE_STRATA          32
+#define SE_CELLS           80
+
+/* added to the table seed for the check hash and the stratum hash */
+#define IB_CHECK_SEED      0x6a09e667
+#define SE_STRATUM_SEED    0xbb67ae85
+
+struct iblt {
+  uint32_t ncells;          /* hashes * per-subtable cells */
+  uint32_t key_size;
+  uint32_t hashes;
+  uint32_t seed;
+  size_t stride;            /* bytes per cell */
+  size_t size;              /* bytes mapped for the cells */
+  uint8_t *cells;           /* int32 count, uint32 check, key */
+};
+
+#define IB_COUNT(t, i) ((int32_t *) ((t)->cells + (size_t) (i) * (t)->stride))
+#define IB_CHECK(t, i) ((uint32_t *) (IB_COUNT(t, i) + 1))
+#define IB_KEY(t, i)   ((uint8_t *) (IB_COUNT(t, i) + 2))
+
+/* Set the parameters of an empty table; cells are left unallocated. */
+static void iblt_shape(struct iblt *t, uint32_t ncells, uint32_t key_size,
+                       uint32_t hashes, uint32_t seed) {
+  uint32_t sub = (ncells + hashes - 1) / hashes;
+
+  t->ncells = (sub ? sub : 1) * hashes;
+  t->key_size = key_size;
+  t->hashes = hashes;
+  t->seed = seed;
+  t->stride = (8 + key_size + 7) & ~(size_t) 7;
+  t->size = (size_t) t->ncells * t->stride;
+  t->cells = NULL;
+}
+
+/* Map zeroed cells for a shaped table from mem. */
+static int iblt_alloc(struct iblt *t, struct jk_memory *mem) {
+  t->size = (size_t) t->ncells * t->stride;
+  t->cells = jk_map(mem, &t->size);
+  return t->cells ? 0 : -1;
+}
+
+/* Map a copy of src into t. */
+static int iblt_clone(struct iblt *t, const struct iblt *src,
+                      struct jk_memory *mem) {
+  *t = *src;
+  if (iblt_alloc(t, mem) < 0)
+    return -1;
+  memcpy(t->cells, src->cells, (size_t) src->ncells * src->stride);
+  return 0;
+}
+
+static void iblt_free(struct iblt *t, struct jk_memory *mem) {
+  jk_unmap(mem, t->cells, t->size);
+  t->cells = NULL;
+}
+
+/* Lock two objects' mutexes in address order, once if they are one. */
+static void ib_lock_pair(pthread_mutex_t *a, pthread_mutex_t *b) {
+  pthread_mutex_lock(a < b ? a : b);
+  if (a != b)
+    pthread_mutex_lock(a < b ? b : a);
+}
+
+static void ib_unlock_pair(pthread_mutex_t *a, pthread_mutex_t *b) {
+  if (a != b)
+    pthread_mutex_unlock(b);
+  pthread_mutex_unlock(a);
+}
+
+static int iblt_compatible(const struct iblt *a, const struct iblt *b) {
+  return a->ncells == b->ncells && a->key_size == b->key_size &&
+         a->hashes == b->hashes && a->seed == b->seed;
+}
+
+static uint32_t iblt_check(const struct iblt *t, const uint8_t *key) {
+  return hashlittle(key, t->key_size, t->seed + IB_CHECK_SEED);
+}
+
+static void iblt_positions(const struct iblt *t, const uint8_t *key,
+                           uint32_t *pos) {
+  uint32_t pc = t->seed, pb = 0, sub = t->ncells / t->hashes, j;
+
+  hashlittle2(key, t->key_size, &pc, &pb);
+  for (j = 0; j < t->hashes; ++j) {
+    uint32_t a = pc, b = pb, c = j;
+
+    /* pc + j * pb would give two keys equal in pc and pb mod sub the same
+       cell in every subtable, and make small tables undecodable */
+    final(a, b, c);
+    pos[j] = j * sub + c % sub;
+  }
+}
+
+/* Add (sign 1) or remove (sign -1) a key whose check hash is known. */
+static void iblt_update(struct iblt *t, const uint8_t *key, uint32_t check,
+                        int sign) {
+  uint32_t pos[IB_MAX_HASHES], j, b;
+
+  iblt_positions(t, key, pos);
+  for (j = 0; j < t->hashes; ++j) {
+    uint8_t *k = IB_KEY(t, pos[j]);
+
+    *IB_COUNT(t, pos[j]) += sign;
+    *IB_CHECK(t, pos[j]) ^= check;
+    for (b = 0; b < t->key_size; ++b)
+      k[b] ^= key[b];
+  }
+}
+
+static void iblt_subtract(struct iblt *t, const struct iblt *other) {
+  uint32_t i, b;
+
+  for (i = 0; i < t->ncells; ++i) {
+    uint8_t *k = IB_KEY(t, i);
+    const uint8_t *o = IB_KEY(other, i);
+
+    *IB_COUNT(t, i) -= *IB_COUNT(other, i);
+    *IB_CHECK(t, i) ^= *IB_CHECK(other, i);
+    for (b = 0; b < t->key_size; ++b)
+      k[b] ^= o[b];
+  }
+}
+
+static int iblt_pure(const struct iblt *t, uint32_t i) {
+  int32_t count = *IB_COUNT(t, i);
+
+  return (count == 1 || count == -1) &&
+         *IB_CHECK(t, i) == iblt_check(t, IB_KEY(t, i));
+}
+
+/* Append to a growable array of n items of size bytes; returns 0 or -1. */
+static int ib_push(void *array, size_t *n, size_t *cap, const void *item,
+                   size_t size) {
+  uint8_t **items = (uint8_t **) array;
+
+  if (*n == *cap) {
+    size_t c = *cap ? *cap * 2 : 64;
+    uint8_t *grown = realloc(*items, c * size);
+
+    if (!grown)
+      return -1;
+    *items = grown;
+    *cap = c;
+  }
+  memcpy(*items + *n * size, item, size);
+  ++*n;
+  return 0;
+}
+
+/*
+  Peel t, destroying it.  Keys with a positive count go to *plus, the
+  others to *minus, key_size bytes each, malloc'd; returns 1 if t peeled
+  to empty, 0 if not, -1 if out of memory.
+ */
+static int iblt_peel(struct iblt *t, uint8_t **plus, size_t *nplus,
+                     uint8_t **minus, size_t *nminus) {
+  uint32_t *stack = NULL, i;
+  size_t depth = 0, cap = 0, caps[2] = {0, 0};
+  uint8_t *key;
+  int rc = 1;
+
+  *plus = *minus = NULL;
+  *nplus = *nminus = 0;
+  key = malloc(t->key_size);
+  if (!key)
+    return -1;
+  for (i = 0; i < t->ncells && rc > 0; ++i)
+    if (iblt_pure(t, i) && ib_push(&stack, &depth, &cap, &i, sizeof(i)) < 0)
+      rc = -1;
+
+  while (depth && rc > 0) {
+    uint32_t cell = stack[--depth], pos[IB_MAX_HASHES], j;
+    int side;
+
+    /* cells are pushed whenever they may have become pure */
+    if (!iblt_pure(t, cell))
+      continue;
+    memcpy(key, IB_KEY(t, cell), t->key_size);
+    side = *IB_COUNT(t, cell) > 0 ? 0 : 1;
+    if (ib_push(side ? minus : plus, side ? nminus : nplus, &caps[side], key,
+                t->key_size) < 0) {
+      rc = -1;
+      break;
+    }
+    iblt_update(t, key, iblt_check(t, key), side ? 1 : -1);
+    iblt_positions(t, key, pos);
+    for (j = 0; j < t->hashes; ++j) {
+      if (pos[j] != cell && iblt_pure(t, pos[j]) &&
+          ib_push(&stack, &depth, &cap, &pos[j], sizeof(pos[j])) < 0) {
+        rc = -1;
+        break;
+      }
+    }
+  }
+
+  for (i = 0; i < t->ncells && rc > 0; ++i)
+    if (*IB_COUNT(t, i) || *IB_CHECK(t, i))
+      rc = 0;
+  free(stack);
+  free(key);
+  return rc;
+}
+
+static size_t iblt_cells_size(const struct iblt *t) {
+  return (size_t) t->ncells * (8 + t->key_size);
+}
+
+static void iblt_dump(const struct iblt *t, uint8_t *out) {
+  uint32_t i;
+
+  for (i = 0; i < t->ncells; ++i) {
+    jk_put32(out, (uint32_t) *IB_COUNT(t, i));
+    jk_put32(out + 4, *IB_CHECK(t, i));
+    memcpy(out + 8, IB_KEY(t, i), t->key_size);
+    out += 8 + t->key_size;
+  }
+}
+
+static void iblt_load(struct iblt *t, const uint8_t *in) {
+  uint32_t i;
+
+  for (i = 0; i < t->ncells; ++i) {
+    *IB_COUNT(t, i) = (int32_t) jk_get32(in);
+    *IB_CHECK(t, i) = jk_get32(in + 4);
+    memcpy(IB_KEY(t, i), in + 8, t->key_size);
+    in += 8 + t->key_size;
+  }
+}
+
+/* Header: magic, ncells, key_size, hashes (low byte) | extra << 8, seed. */
+static void ib_header(uint8_t *h, const char *magic, const struct iblt *t,
+                      uint32_t extra) {
+  memcpy(h, magic, 8);
+  jk_put32(h + 8, t->ncells);
+  jk_put32(h + 12, t->key_size);
+  jk_put32(h + 16, t->hashes | (extra << 8));
+  jk_put32(h + 20, t->seed);
+}
+
+/* Keys of a sequence, each exactly key_size bytes. */
+static int ib_keys_get(PyObject *obj, uint32_t key_size,
+                       struct jk_keys *keys) {
+  Py_ssize_t i;
+
+  if (jk_keys_get(obj, keys) < 0)
+    return -1;
+  for (i = 0; i < keys->n; ++i) {
+    if (keys->len[i] != key_size) {
+      PyErr_Format(PyExc_ValueError, "keys must be %u bytes long, not %zu",
+                   key_size, keys->len[i]);
+      jk_keys_release(keys);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* A list of bytes objects from n keys of size bytes each. */
+static PyObject* ib_key_list(const uint8_t *keys, size_t n, uint32_t size) {
+  PyObject *list = PyList_New((Py_ssize_t) n);
+  size_t i;
+
+  for (i = 0; list && i < n; ++i) {
+    PyObject *key = PyBytes_FromStringAndSize((const char *) keys + i * size,
+                                              size);
+    if (!key) {
+      Py_CLEAR(list);
+      break;
+    }
+    PyList_SET_ITEM(list, (Py_ssize_t) i, key);
+  }
+  return list;
+}
+
+static int ib_check_args(unsigned int key_size, unsigned int hashes) {
+  if (key_size < 1 || key_size > IB_MAX_KEY_SIZE) {
+    PyErr_Format(PyExc_ValueError, "key_size must be in 1..%d",
+                 IB_MAX_KEY_SIZE);
+    return -1;
+  }
+  if (hashes < 2 || hashes > IB_MAX_HASHES) {
+    PyErr_Format(PyExc_ValueError, "hashes must be in 2..%d", IB_MAX_HASHES);
+    return -1;
+  }
+  return 0;
+}
+
+/* Parse a serialized header; returns 0 or -1 with ValueError set. */
+static int ib_parse_header(const uint8_t *data, Py_ssize_t len,
+                           const char *magic, uint32_t *ncells,
+                           uint32_t *key_size, uint32_t *hashes,
+                           uint32_t *extra, uint32_t *seed) {
+  uint32_t word;
+
+  if (len < IB_HEADER_SIZE || memcmp(data, magic, 8) != 0) {
+    PyErr_SetString(PyExc_ValueError, "not a serialized table");
+    return -1;
+  }
+  *ncells = jk_get32(data + 8);
+  *key_size = jk_get32(data + 12);
+  word = jk_get32(data + 16);
+  *hashes = word & 0xff;
+  *extra = word >> 8;
+  *seed = jk_get32(data + 20);
+  if (ib_check_args(*key_size, *hashes) < 0)
+    return -1;
+  if (*ncells == 0 || *ncells % *hashes) {
+    PyErr_SetString(PyExc_ValueError, "not a serialized table");
+    return -1;
+  }
+  return 0;
+}
+
+/* ------------------------------------------------------------------ IBLT */
+
+typedef struct {
+  PyObject_HEAD
+  struct iblt t;
+  struct jk_memory mem;
+  pthread_mutex_t lock;     /* cells, held without the GIL */
+} IBLTObject;
+
+static PyTypeObject IBLTType;
+
+static int ib_check(IBLTObject *self) {
+  if (!self->t.cells) {
+    PyErr_SetString(PyExc_ValueError, "IBLT not initialized");
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject* ib_update_keys(IBLTObject *self, PyObject *args,
+                                int sign) {
+  struct iblt *t = &self->t;
+  PyObject *keys_obj;
+  struct jk_keys keys;
+  Py_ssize_t i;
+
+  if (!PyArg_ParseTuple(args, "O", &keys_obj))
+    return NULL;
+  if (ib_keys_get(keys_obj, t->key_size, &keys) < 0)
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  JK_ENTER_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  pthread_mutex_lock(&self->lock);
+  for (i = 0; i < keys.n; ++i) {
+    const uint8_t *key = (const uint8_t *) keys.ptr[i];
+    iblt_update(t, key, iblt_check(t, key), sign);
+  }
+  pthread_mutex_unlock(&self->lock);
+  JK_EXIT_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  Py_END_ALLOW_THREADS
+  jk_keys_release(&keys);
+  Py_RETURN_NONE;
+}
+
+static char iblt_insert_doc[] = "insert(keys) -- Adds each key of a sequence; every key must be key_size bytes.";
+
+static PyObject* iblt_insert(IBLTObject *self, PyObject *args) {
+  if (ib_check(self) < 0)
+    return NULL;
+  return ib_update_keys(self, args, 1);
+}
+
+static char iblt_remove_doc[] = "remove(keys) -- Removes each key of a sequence, which should have been inserted.";
+
+static PyObject* iblt_remove(IBLTObject *self, PyObject *args) {
+  if (ib_check(self) < 0)
+    return NULL;
+  return ib_update_keys(self, args, -1);
+}
+
+static char iblt_subtract_doc[] = "subtract(other) -- Subtracts another IBLT of the same cells, key_size, hashes and seed, cell by cell, leaving a table of the symmetric difference for decode().";
+
+static PyObject* iblt_subtract_py(IBLTObject *self, PyObject *args) {
+  IBLTObject *other;
+
+  if (!PyArg_ParseTuple(args, "O!", &IBLTType, &other))
+    return NULL;
+  if (ib_check(self) < 0 || ib_check(other) < 0)
+    return NULL;
+  if (!iblt_compatible(&self->t, &other->t)) {
+    PyErr_SetString(PyExc_ValueError, "IBLTs differ in cells, key_size, "
+                    "hashes or seed");
+    return NULL;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  ib_lock_pair(&self->lock, &other->lock);
+  iblt_subtract(&self->t, &other->t);
+  ib_unlock_pair(&self->lock, &other->lock);
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+static char iblt_decode_doc[] = "decode() -- Lists the keys in the table: returns (inserted, removed, complete), the keys with a net count of +1 and -1. After a.subtract(b), inserted holds the keys only in a and removed those only in b. complete is False if the table was too small to list every key; the lists then hold the keys that could be recovered. The table itself is left unchanged.";
+
+static PyObject* iblt_decode(IBLTObject *self) {
+  struct iblt copy;
+  uint8_t *plus, *minus;
+  size_t nplus, nminus;
+  PyObject *a, *b;
+  int rc = -1, cloned;
+
+  if (ib_check(self) < 0)
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  cloned = iblt_clone(&copy, &self->t, &self->mem) == 0;
+  pthread_mutex_unlock(&self->lock);
+  if (cloned)
+    rc = iblt_peel(&copy, &plus, &nplus, &minus, &nminus);
+  Py_END_ALLOW_THREADS
+  if (!cloned)
+    return PyErr_NoMemory();
+  iblt_free(&copy, &self->mem);
+  if (rc < 0) {
+    free(plus);
+    free(minus);
+    return PyErr_NoMemory();
+  }
+  a = ib_key_list(plus, nplus, self->t.key_size);
+  b = ib_key_list(minus, nminus, self->t.key_size);
+  free(plus);
+  free(minus);
+  if (!a || !b) {
+    Py_XDECREF(a);
+    Py_XDECREF(b);
+    return NULL;
+  }
+  return Py_BuildValue("(NNO)", a, b, rc ? Py_True : Py_False);
+}
+
+static char iblt_copy_doc[] = "copy() -- Returns a new IBLT with the same cells.";
+
+static PyObject* iblt_copy(IBLTObject *self) {
+  IBLTObject *copy;
+  int rc;
+
+  if (ib_check(self) < 0)
+    return NULL;
+  copy = (IBLTObject *) Py_TYPE(self)->tp_new(Py_TYPE(self), NULL, NULL);
+  if (!copy)
+    return NULL;
+  if (jk_memory_init(&copy->mem, "IBLT", Py_None, Py_None) < 0) {
+    Py_DECREF(copy);
+    return NULL;
+  }
+  copy->mem.pages = self->mem.pages;
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  rc = iblt_clone(&copy->t, &self->t, &copy->mem);
+  pthread_mutex_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+  if (rc < 0) {
+    Py_DECREF(copy);
+    return PyErr_NoMemory();
+  }
+  jk_memory_live(&copy->mem, (ssize_t) iblt_cells_size(&copy->t));
+  return (PyObject *) copy;
+}
+
+static char iblt_tobytes_doc[] = "tobytes() -- Returns the table serialized, for IBLT(data=...) on another node.";
+
+static PyObject* iblt_tobytes(IBLTObject *self) {
+  PyObject *r;
+  uint8_t *p;
+
+  if (ib_check(self) < 0)
+    return NULL;
+  r = PyBytes_FromStringAndSize(NULL, IB_HEADER_SIZE +
+                                (Py_ssize_t) iblt_cells_size(&self->t));
+  if (!r)
+    return NULL;
+  p = (uint8_t *) PyBytes_AS_STRING(r);
+  ib_header(p, IB_MAGIC, &self->t, 0);
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  iblt_dump(&self->t, p + IB_HEADER_SIZE);
+  pthread_mutex_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+  return r;
+}
+
+static PyObject* iblt_get_cells(IBLTObject *self, void *closure) {
+  return PyLong_FromUnsignedLong(self->t.ncells);
+}
+
+static PyObject* iblt_get_key_size(IBLTObject *self, void *closure) {
+  return PyLong_FromUnsignedLong(self->t.key_size);
+}
+
+static PyObject* iblt_get_memory(IBLTObject *self, void *closure) {
+  return jk_memory_dict(&self->mem);
+}
+
+static int iblt_init(IBLTObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"cells", "key_size", "hashes", "seed", "data",
+                           "huge_pages", NULL};
+  unsigned int cells = 0, key_size = IB_KEY_SIZE, hashes = IB_HASHES;
+  unsigned int seed = 0;
+  const uint8_t *data = NULL;
+  Py_ssize_t data_len = 0;
+  PyObject *huge_pages = Py_None;
+  uint32_t extra;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|IIIIz#O", kwlist, &cells,
+                                   &key_size, &hashes, &seed, &data,
+                                   &data_len, &huge_pages))
+    return -1;
+  if (self->t.cells) {
+    PyErr_SetString(PyExc_RuntimeError, "IBLT already initialized");
+    return -1;
+  }
+  if (data) {
+    if (ib_parse_header(data, data_len, IB_MAGIC, &cells, &key_size,
+                        &hashes, &extra, &seed) < 0)
+      return -1;
+    /* a serialized ncells is a multiple of hashes, kept as it is */
+    if ((uint64_t) data_len !=
+        IB_HEADER_SIZE + (uint64_t) cells * (8 + key_size)) {
+      PyErr_SetString(PyExc_ValueError, "serialized IBLT has the wrong size");
+      return -1;
+    }
+  } else if (ib_check_args(key_size, hashes) < 0) {
+    return -1;
+  } else if (cells == 0) {
+    PyErr_SetString(PyExc_ValueError, "cells must be positive");
+    return -1;
+  }
+  if (jk_memory_init(&self->mem, "IBLT", huge_pages, Py_None) < 0)
+    return -1;
+  iblt_shape(&self->t, cells, key_size, hashes, seed);
+  if (iblt_alloc(&self->t, &self->mem) < 0) {
+    jk_memory_free(&self->mem);
+    PyErr_NoMemory();
+    return -1;
+  }
+  jk_memory_live(&self->mem, (ssize_t) iblt_cells_size(&self->t));
+  if (data)
+    iblt_load(&self->t, data + IB_HEADER_SIZE);
+  return 0;
+}
+
+static PyObject* iblt_new(PyTypeObject *type, PyObject *args,
+                          PyObject *kwds) {
+  IBLTObject *self = (IBLTObject *) type->tp_alloc(type, 0);
+
+  if (!self)
+    return NULL;
+  pthread_mutex_init(&self->lock, NULL);
+  return (PyObject *) self;
+}
+
+static void iblt_dealloc(IBLTObject *self) {
+  if (self->mem.owner) {
+    iblt_free(&self->t, &self->mem);
+    jk_memory_free(&self->mem);
+  }
+  pthread_mutex_destroy(&self->lock);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef iblt_methods[] = {
+  {"insert",   (PyCFunction) iblt_insert,      METH_VARARGS,
+   iblt_insert_doc},
+  {"remove",   (PyCFunction) iblt_remove,      METH_VARARGS,
+   iblt_remove_doc},
+  {"subtract", (PyCFunction) iblt_subtract_py, METH_VARARGS,
+   iblt_subtract_doc},
+  {"decode",   (PyCFunction) iblt_decode,      METH_NOARGS,
+   iblt_decode_doc},
+  {"copy",     (PyCFunction) iblt_copy,        METH_NOARGS,
+   iblt_copy_doc},
+  {"tobytes",  (PyCFunction) iblt_tobytes,     METH_NOARGS,
+   iblt_tobytes_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef iblt_getset[] = {
+  {"cells",    (getter) iblt_get_cells,    NULL,
+   "Number of cells, rounded up to a multiple of hashes.", NULL},
+  {"key_size", (getter) iblt_get_key_size, NULL,
+   "Bytes per key.", NULL},
+  {"memory",   (getter) iblt_get_memory,   NULL,
+   "This table's entry in memory_usage().", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static char iblt_type_doc[] = "IBLT(cells, key_size=8, hashes=3, seed=0, data=None, huge_pages=None) -- Invertible Bloom lookup table of fixed-size keys. Two nodes insert their keys into tables of the same parameters; one subtracts the other's table and decode() lists the keys that differ, which succeeds with high probability when cells is at least 1.5 times their number. data restores a table from tobytes().";
+
+static PyTypeObject IBLTType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.IBLT",                 /* tp_name */
+  sizeof(IBLTObject),             /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) iblt_dealloc,      /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  0,                              /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  iblt_type_doc,                  /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  iblt_methods,                   /* tp_methods */
+  0,                              /* tp_members */
+  iblt_getset,                    /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) iblt_init,           /* tp_init */
+  0,                              /* tp_alloc */
+  iblt_new,                       /* tp_new */
+};
+
+/* ------------------------------------------------------ StrataEstimator */
+
+typedef struct {
+  PyObject_HEAD
+  uint32_t nstrata;
+  struct iblt *strata;      /* followed by their cells, in one mapping */
+  size_t size;              /* bytes mapped */
+  struct jk_memory mem;
+  pthread_mutex_t lock;     /* strata, held without the GIL */
+} StrataEstimatorObject;
+
+static PyTypeObject StrataEstimatorType;
+
+static int se_check(StrataEstimatorObject *self) {
+  if (!self->strata) {
+    PyErr_SetString(PyExc_ValueError, "StrataEstimator not initialized");
+    return -1;
+  }
+  return 0;
+}
+
+static uint32_t se_stratum(const StrataEstimatorObject *s,
+                           const uint8_t *key) {
+  const struct iblt *t = &s->strata[0];
+  uint32_t pc = t->seed + SE_STRATUM_SEED, pb = 0, i = 0;
+  uint64_t h;
+
+  hashlittle2(key, t->key_size, &pc, &pb);
+  h = pc + ((uint64_t) pb << 32);
+  while (i + 1 < s->nstrata && !(h & 1)) {
+    h >>= 1;
+    ++i;
+  }
+  return i;
+}
+
+static PyObject* se_update_keys(StrataEstimatorObject *self, PyObject *args,
+                                int sign) {
+  PyObject *keys_obj;
+  struct jk_keys keys;
+  Py_ssize_t i;
+
+  if (!PyArg_ParseTuple(args, "O", &keys_obj))
+    return NULL;
+  if (ib_keys_get(keys_obj, self->strata[0].key_size, &keys) < 0)
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  JK_ENTER_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  pthread_mutex_lock(&self->lock);
+  for (i = 0; i < keys.n; ++i) {
+    const uint8_t *key = (const uint8_t *) keys.ptr[i];
+    struct iblt *t = &self->strata[se_stratum(self, key)];
+
+    iblt_update(t, key, iblt_check(t, key), sign);
+  }
+  pthread_mutex_unlock(&self->lock);
+  JK_EXIT_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  Py_END_ALLOW_THREADS
+  jk_keys_release(&keys);
+  Py_RETURN_NONE;
+}
+
+static char strataestimator_insert_doc[] = "insert(keys) -- Adds each key of a sequence; every key must be key_size bytes.";
+
+static PyObject* strataestimator_insert(StrataEstimatorObject *self,
+                                        PyObject *args) {
+  if (se_check(self) < 0)
+    return NULL;
+  return se_update_keys(self, args, 1);
+}
+
+static char strataestimator_remove_doc[] = "remove(keys) -- Removes each key of a sequence, which should have been inserted.";
+
+static PyObject* strataestimator_remove(StrataEstimatorObject *self,
+                                        PyObject *args) {
+  if (se_check(self) < 0)
+    return NULL;
+  return se_update_keys(self, args, -1);
+}
+
+static char strataestimator_estimate_doc[] = "estimate(other) -- Returns an estimate of the number of keys in exactly one of the sets that this and another StrataEstimator of the same parameters were built from.";
+
+static PyObject* strataestimator_estimate(StrataEstimatorObject *self,
+                                          PyObject *args) {
+  StrataEstimatorObject *other;
+  struct iblt diff;
+  uint64_t count = 0;
+  int64_t i;
+  int rc = 1;
+
+  if (!PyArg_ParseTuple(args, "O!", &StrataEstimatorType, &other))
+    return NULL;
+  if (se_check(self) < 0 || se_check(other) < 0)
+    return NULL;
+  if (self->nstrata != other->nstrata ||
+      !iblt_compatible(&self->strata[0], &other->strata[0])) {
+    PyErr_SetString(PyExc_ValueError, "StrataEstimators differ in strata, "
+                    "cells, key_size or seed");
+    return NULL;
+  }
+  diff = self->strata[0];
+  if (iblt_alloc(&diff, &self->mem) < 0)
+    return PyErr_NoMemory();
+
+  Py_BEGIN_ALLOW_THREADS
+  ib_lock_pair(&self->lock, &other->lock);
+  for (i = (int64_t) self->nstrata - 1; i >= 0; --i) {
+    uint8_t *plus, *minus;
+    size_t nplus, nminus;
+
+    memcpy(diff.cells, self->strata[i].cells,
+           (size_t) diff.ncells * diff.stride);
+    iblt_subtract(&diff, &other->strata[i]);
+    rc = iblt_peel(&diff, &plus, &nplus, &minus, &nminus);
+    free(plus);
+    free(minus);
+    if (rc < 0)
+      break;
+    if (rc == 0) {
+      /* strata above i hold 2^-(i+1) of the keys; if even the sparsest
+         failed, all that is known is that it overflowed */
+      count = (count ? count : diff.ncells) << (i + 1);
+      break;
+    }
+    count += nplus + nminus;
+  }
+  ib_unlock_pair(&self->lock, &other->lock);
+  Py_END_ALLOW_THREADS
+
+  iblt_free(&diff, &self->mem);
+  if (rc < 0)
+    return PyErr_NoMemory();
+  return PyLong_FromUnsignedLongLong(count);
+}
+
+static char strataestimator_tobytes_doc[] = "tobytes() -- Returns the estimator serialized, for StrataEstimator(data=...) on another node.";
+
+static PyObject* strataestimator_tobytes(StrataEstimatorObject *self) {
+  size_t cells;
+  PyObject *r;
+  uint8_t *p;
+  uint32_t i;
+
+  if (se_check(self) < 0)
+    return NULL;
+  cells = iblt_cells_size(&self->strata[0]);
+  r = PyBytes_FromStringAndSize(NULL, IB_HEADER_SIZE +
+                                (Py_ssize_t) (cells * self->nstrata));
+  if (!r)
+    return NULL;
+  p = (uint8_t *) PyBytes_AS_STRING(r);
+  ib_header(p, SE_MAGIC, &self->strata[0], self->nstrata);
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  for (i = 0; i < self->nstrata; ++i)
+    iblt_dump(&self->strata[i], p + IB_HEADER_SIZE + i * cells);
+  pthread_mutex_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+  return r;
+}
+
+static int strataestimator_init(StrataEstimatorObject *self, PyObject *args,
+                                PyObject *kwds) {
+  static char *kwlist[] = {"key_size", "strata", "cells", "seed", "data",
+                           "huge_pages", NULL};
+  unsigned int key_size = IB_KEY_SIZE, strata = SE_STRATA, cells = SE_CELLS;
+  unsigned int seed = 0, hashes = IB_HASHES;
+  const uint8_t *data = NULL;
+  Py_ssize_t data_len = 0;
+  PyObject *huge_pages = Py_None;
+  struct iblt shape, *tables;
+  size_t head;
+  uint32_t i;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|IIIIz#O", kwlist, &key_size,
+                                   &strata, &cells, &seed, &data, &data_len,
+                                   &huge_pages))
+    return -1;
+  if (self->strata) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "StrataEstimator already initialized");
+    return -1;
+  }
+  if (data) {
+    if (ib_parse_header(data, data_len, SE_MAGIC, &cells, &key_size,
+                        &hashes, &strata, &seed) < 0)
+      return -1;
+  } else if (ib_check_args(key_size, hashes) < 0) {
+    return -1;
+  }
+  if (strata < 1 || strata > 48 || cells == 0) {
+    PyErr_SetString(PyExc_ValueError, "strata must be in 1..48 and cells "
+                    "positive");
+    return -1;
+  }
+  if (data && (uint64_t) data_len !=
+      IB_HEADER_SIZE + (uint64_t) strata * cells * (8 + key_size)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "serialized StrataEstimator has the wrong size");
+    return -1;
+  }
+
+  /* the strata are small; map them and their cells together */
+  if (jk_memory_init(&self->mem, "StrataEstimator", huge_pages, Py_None) < 0)
+    return -1;
+  iblt_shape(&shape, cells, key_size, hashes, seed);
+  head = ((size_t) strata * sizeof(struct iblt) + 15) & ~(size_t) 15;
+  self->size = head + strata * shape.size;
+  tables = jk_map(&self->mem, &self->size);
+  if (!tables) {
+    jk_memory_free(&self->mem);
+    PyErr_NoMemory();
+    return -1;
+  }
+  for (i = 0; i < strata; ++i) {
+    tables[i] = shape;
+    tables[i].cells = (uint8_t *) tables + head + i * shape.size;
+  }
+  jk_memory_live(&self->mem, (ssize_t) (head + strata * shape.size));
+  if (data) {
+    size_t size = iblt_cells_size(&shape);
+
+    for (i = 0; i < strata; ++i)
+      iblt_load(&tables[i], data + IB_HEADER_SIZE + i * size);
+  }
+  self->strata = tables;
+  self->nstrata = strata;
+  return 0;
+}
+
+static PyObject* strataestimator_get_memory(StrataEstimatorObject *self,
+                                            void *closure) {
+  return jk_memory_dict(&self->mem);
+}
+
+static PyObject* strataestimator_new(PyTypeObject *type, PyObject *args,
+                                     PyObject *kwds) {
+  StrataEstimatorObject *self =
+      (StrataEstimatorObject *) type->tp_alloc(type, 0);
+
+  if (!self)
+    return NULL;
+  pthread_mutex_init(&self->lock, NULL);
+  return (PyObject *) self;
+}
+
+static void strataestimator_dealloc(StrataEstimatorObject *self) {
+  if (self->mem.owner) {
+    jk_unmap(&self->mem, self->strata, self->size);
+    jk_memory_free(&self->mem);
+  }
+  pthread_mutex_destroy(&self->lock);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef strataestimator_methods[] = {
+  {"insert",   (PyCFunction) strataestimator_insert,   METH_VARARGS,
+   strataestimator_insert_doc},
+  {"remove",   (PyCFunction) strataestimator_remove,   METH_VARARGS,
+   strataestimator_remove_doc},
+  {"estimate", (PyCFunction) strataestimator_estimate, METH_VARARGS,
+   strataestimator_estimate_doc},
+  {"tobytes",  (PyCFunction) strataestimator_tobytes,  METH_NOARGS,
+   strataestimator_tobytes_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef strataestimator_getset[] = {
+  {"memory", (getter) strataestimator_get_memory, NULL,
+   "This estimator's entry in memory_usage().", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static char strataestimator_type_doc[] = "StrataEstimator(key_size=8, strata=32, cells=80, seed=0, data=None, huge_pages=None) -- Estimates how many keys two sets differ in, from a summary of a few tens of KB per set, so that an IBLT of the right size can be exchanged. data restores an estimator from tobytes().";
+
+static PyTypeObject StrataEstimatorType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.StrataEstimator",      /* tp_name */
+  sizeof(StrataEstimatorObject),  /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) strataestimator_dealloc, /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  0,                              /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  strataestimator_type_doc,       /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  strataestimator_methods,        /* tp_methods */
+  0,                              /* tp_members */
+  strataestimator_getset,         /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) strataestimator_init, /* tp_init */
+  0,                              /* tp_alloc */
+  strataestimator_new,            /* tp_new */
+};
@@ -0,0 +1,314 @@
+/*
+  hash_iter(): hashing keys from an iterator, such as a database cursor or
+  a file parser, without materializing them as a list first.
+
+  The batch entry points want a ready-made sequence, so a generator has
+  to be drained into a list, hashed, and drained again, leaving the
+  hashing idle while Python produces keys and Python idle while C
+  hashes.  hash_iter() copies the key bytes into one of two native
+  chunks; when a chunk is full it is handed to a native thread, which
+  hashes it with the GIL released while Python fills the other one.
+  Only one chunk is ever being hashed, so results come out in order and
+  a target sketch is updated by one thread at a time; an IBLT or
+  StrataEstimator target is also locked against its own methods.
+
+  The hashes go into a growing uint64_t array that is returned as an
+  array.array, or straight into a MultisetHash, IBLT or StrataEstimator,
+  in which case nothing per key is kept.  The chunks and the array are
+  mapped from a jk_memory of the call's own, so a running hash_iter()
+  shows up in memory_usage().
+ */
+
+/* A chunk is also handed over once it holds this many key bytes. */
+#define ING_MAX_BYTES (4 * 1024 * 1024)
+
+enum { ING_ARRAY, ING_MULTISET, ING_IBLT, ING_STRATA };
+
+struct ing_chunk {
+  char *data;
+  size_t used, cap;         /* cap: bytes mapped for data */
+  size_t *off;              /* n + 1 offsets into data */
+  size_t off_size;          /* bytes mapped for off */
+  Py_ssize_t n;
+};
+
+struct ing {
+  int kind;
+  PyObject *into;
+  uint32_t key_size;        /* 0 if keys may be any length */
+  struct ing_chunk chunks[2];
+  struct ing_chunk *job;    /* chunk being hashed */
+  pthread_t tid;
+  int running;
+  uint64_t *out;            /* ING_ARRAY results */
+  size_t out_size;          /* bytes mapped for out */
+  Py_ssize_t out_cap, base, total;
+  struct ms_sum sum;        /* ING_MULTISET results */
+  struct jk_memory mem;
+};
+
+static void ing_hash_chunk(struct ing *g) {
+  const struct ing_chunk *c = g->job;
+  pthread_mutex_t *lock = NULL;
+  Py_ssize_t i;
+
+  /* a table's cells are shared with its methods on other threads */
+  if (g->kind == ING_IBLT)
+    lock = &((IBLTObject *) g->into)->lock;
+  else if (g->kind == ING_STRATA)
+    lock = &((StrataEstimatorObject *) g->into)->lock;
+  JK_ENTER_BATCH(JK_HASHLITTLE2_BATCH, c->used, c->n);
+  if (lock)
+    pthread_mutex_lock(lock);
+  for (i = 0; i < c->n; ++i) {
+    const char *key = c->data + c->off[i];
+    size_t len = c->off[i + 1] - c->off[i];
+
+    switch (g->kind) {
+    case ING_ARRAY:
+      g->out[g->base + i] = hll_hash(key, len);
+      break;
+    case ING_MULTISET: {
+      struct ms_sum h;
+
+      ms_hash(key, len, &h);
+      ms_add(&g->sum, &h);
+      break;
+    }
+    case ING_IBLT: {
+      struct iblt *t = &((IBLTObject *) g->into)->t;
+
+      iblt_update(t, (const uint8_t *) key,
+                  iblt_check(t, (const uint8_t *) key), 1);
+      break;
+    }
+    case ING_STRATA: {
+      StrataEstimatorObject *s = (StrataEstimatorObject *) g->into;
+      struct iblt *t = &s->strata[se_stratum(s, (const uint8_t *) key)];
+
+      iblt_update(t, (const uint8_t *) key,
+                  iblt_check(t, (const uint8_t *) key), 1);
+      break;
+    }
+    }
+  }
+  if (lock)
+    pthread_mutex_unlock(lock);
+  JK_EXIT_BATCH(JK_HASHLITTLE2_BATCH, c->used, c->n);
+}
+
+static void *ing_main(void *p) {
+  ing_hash_chunk((struct ing *) p);
+  return NULL;
+}
+
+/* Wait for the chunk being hashed, if any. */
+static void ing_wait(struct ing *g) {
+  if (!g->running)
+    return;
+  Py_BEGIN_ALLOW_THREADS
+  pthread_join(g->tid, NULL);
+  Py_END_ALLOW_THREADS
+  g->running = 0;
+}
+
+/*
+  Start hashing chunk c once the previous one is done; returns the chunk
+  to fill next, or NULL when out of memory.  If no thread can be started
+  the chunk is hashed on the caller, still without the GIL.
+ */
+static struct ing_chunk *ing_flush(struct ing *g, struct ing_chunk *c) {
+  struct ing_chunk *next = c == &g->chunks[0] ? &g->chunks[1]
+                                              : &g->chunks[0];
+
+  ing_wait(g);
+  if (g->kind == ING_ARRAY && g->total + c->n > g->out_cap) {
+    Py_ssize_t cap = g->out_cap ? g->out_cap : c->n;
+    size_t size;
+    uint64_t *out;
+
+    while (cap < g->total + c->n)
+      cap *= 2;
+    size = (size_t) cap * sizeof(uint64_t);
+    out = jk_remap(&g->mem, g->out, g->out_size, &size);
+    if (!out) {
+      PyErr_NoMemory();
+      return NULL;
+    }
+    g->out = out;
+    g->out_size = size;
+    g->out_cap = (Py_ssize_t) (size / sizeof(uint64_t));
+  }
+  g->job = c;
+  g->base = g->total;
+  g->total += c->n;
+  if (g->kind == ING_ARRAY)
+    jk_memory_live(&g->mem, (ssize_t) (c->n * sizeof(uint64_t)));
+  if (pthread_create(&g->tid, NULL, ing_main, g) == 0) {
+    g->running = 1;
+  } else {
+    Py_BEGIN_ALLOW_THREADS
+    ing_hash_chunk(g);
+    Py_END_ALLOW_THREADS
+  }
+  jk_memory_live(&g->mem, -(ssize_t) next->used);
+  next->n = 0;
+  next->used = 0;
+  return next;
+}
+
+/* Append a key to chunk c; returns 0, or -1 when out of memory. */
+static int ing_append(struct ing *g, struct ing_chunk *c, const char *key,
+                      size_t len) {
+  if (c->used + len > c->cap) {
+    size_t cap = c->cap ? c->cap : 4096;
+    char *data;
+
+    while (cap < c->used + len)
+      cap *= 2;
+    data = jk_remap(&g->mem, c->data, c->cap, &cap);
+    if (!data) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    c->data = data;
+    c->cap = cap;
+  }
+  memcpy(c->data + c->used, key, len);
+  c->used += len;
+  jk_memory_live(&g->mem, (ssize_t) len);
+  c->off[++c->n] = c->used;
+  return 0;
+}
+
+static char hash_iter_doc[] = "hash_iter(iterable[, into][, chunk_size][, huge_pages]) -- Hashes the keys an iterable yields (bytes, unicode hashed as UTF-8, or buffers) in chunks of chunk_size keys (default 65536), each on a native thread while the iterable produces the next. Without into, returns an array.array of 64-bit unsigned integers, pc + (pb << 32) of hashlittle2 for each key. With into, a MultisetHash, IBLT or StrataEstimator, adds the keys to it instead and returns their number; into must not be used elsewhere meanwhile. If the iterable raises, the keys before the error have been added. huge_pages applies to the chunks and the result as for HLLArena.";
+
+static PyObject* hash_iter_py(PyObject *self, PyObject *args,
+                              PyObject *kwds) {
+  static char *kwlist[] = {"iterable", "into", "chunk_size", "huge_pages",
+                           NULL};
+  PyObject *iterable, *into = Py_None, *huge_pages = Py_None;
+  PyObject *it, *item, *r = NULL;
+  struct ing g;
+  struct ing_chunk *cur;
+  Py_ssize_t chunk_size = 65536;
+  int i;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OnO", kwlist, &iterable,
+                                   &into, &chunk_size, &huge_pages))
+    return NULL;
+  if (chunk_size < 1) {
+    PyErr_SetString(PyExc_ValueError, "chunk_size must be positive");
+    return NULL;
+  }
+
+  memset(&g, 0, sizeof(g));
+  g.into = into;
+  if (into == Py_None) {
+    g.kind = ING_ARRAY;
+  } else if (PyObject_TypeCheck(into, &MultisetHashType)) {
+    g.kind = ING_MULTISET;
+  } else if (PyObject_TypeCheck(into, &IBLTType)) {
+    if (ib_check((IBLTObject *) into) < 0)
+      return NULL;
+    g.kind = ING_IBLT;
+    g.key_size = ((IBLTObject *) into)->t.key_size;
+  } else if (PyObject_TypeCheck(into, &StrataEstimatorType)) {
+    if (se_check((StrataEstimatorObject *) into) < 0)
+      return NULL;
+    g.kind = ING_STRATA;
+    g.key_size = ((StrataEstimatorObject *) into)->strata[0].key_size;
+  } else {
+    return PyErr_Format(PyExc_TypeError, "into must be a MultisetHash, IBLT "
+                        "or StrataEstimator, not %.100s",
+                        Py_TYPE(into)->tp_name);
+  }
+
+  if ((size_t) chunk_size >= ((size_t) -1) / sizeof(size_t)) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  it = PyObject_GetIter(iterable);
+  if (!it)
+    return NULL;
+  if (jk_memory_init(&g.mem, "hash_iter", huge_pages, Py_None) < 0) {
+    Py_DECREF(it);
+    return NULL;
+  }
+  for (i = 0; i < 2; ++i) {
+    g.chunks[i].off_size = ((size_t) chunk_size + 1) * sizeof(size_t);
+    g.chunks[i].off = jk_map(&g.mem, &g.chunks[i].off_size);
+    if (!g.chunks[i].off) {
+      PyErr_NoMemory();
+      goto done;
+    }
+    jk_memory_live(&g.mem,
+                   (ssize_t) (((size_t) chunk_size + 1) * sizeof(size_t)));
+  }
+
+  cur = &g.chunks[0];
+  while ((item = PyIter_Next(it)) != NULL) {
+    PyObject *owned;
+    const char *ptr;
+    size_t len;
+    int failed;
+
+    if (jk_key_bytes(item, &owned, &ptr, &len) < 0) {
+      Py_DECREF(item);
+      break;
+    }
+    if (g.key_size && len != g.key_size) {
+      PyErr_Format(PyExc_ValueError, "keys must be %u bytes long, not %zu",
+                   g.key_size, len);
+      failed = 1;
+    } else {
+      failed = ing_append(&g, cur, ptr, len) < 0;
+    }
+    Py_XDECREF(owned);
+    Py_DECREF(item);
+    if (failed)
+      break;
+    if (cur->n == chunk_size || cur->used >= ING_MAX_BYTES) {
+      cur = ing_flush(&g, cur);
+      if (!cur)
+        break;
+    }
+  }
+  /* on an error the keys already copied are still added */
+  if (cur && cur->n) {
+    if (PyErr_Occurred()) {
+      PyObject *type, *value, *tb;
+
+      PyErr_Fetch(&type, &value, &tb);
+      ing_flush(&g, cur);
+      PyErr_Restore(type, value, tb);
+    } else {
+      ing_flush(&g, cur);
+    }
+  }
+  ing_wait(&g);
+
+  if (g.kind == ING_MULTISET) {
+    MultisetHashObject *ms = (MultisetHashObject *) into;
+
+    ms_add(&ms->sum, &g.sum);
+    ms->count += (int64_t) g.total;
+  }
+  if (PyErr_Occurred())
+    goto done;
+  if (g.kind == ING_ARRAY)
+    r = jk_array(sizeof(unsigned long) == 8 ? "L" : "Q", g.out,
+                 g.total * (Py_ssize_t) sizeof(uint64_t));
+  else
+    r = PyLong_FromSsize_t(g.total);
+
+done:
+  for (i = 0; i < 2; ++i) {
+    jk_unmap(&g.mem, g.chunks[i].data, g.chunks[i].cap);
+    jk_unmap(&g.mem, g.chunks[i].off, g.chunks[i].off_size);
+  }
+  jk_unmap(&g.mem, g.out, g.out_size);
+  jk_memory_free(&g.mem);
+  Py_DECREF(it);
+  return r;
+}
@@ -0,0 +1,387 @@
+/*
+  Instrumentation shared by the Python entry points.
+
+  Every wrapper brackets its kernel call with JK_ENTER() and JK_EXIT();
+  the batch, array, file and iterator entry points use JK_ENTER_BATCH()
+  and JK_EXIT_BATCH() around the whole batch, under names of their own
+  ("hashlittle2_batch", "hashlittle_array", "hashfile", ...), so that
+  their per-batch latency does not blur the per-key figures.  When the
+  module is built with JENKINS_STATS defined (set the JENKINS_STATS
+  environment variable when running setup.py) those record, per function:
+
+  * calls (keys, for batches) and bytes hashed,
+  * a log2 histogram of key lengths (single keys only),
+  * which hashlittle()/hashbig() read path the key takes (32-bit aligned,
+    16-bit aligned or byte at a time), judged from the key's address the
+    same way lookup3.c does,
+  * a log2 histogram of kernel latency in nanoseconds, one sample per
+    call or batch.
+
+  Counters live in a per-thread block, so the hot path is a handful of
+  uncontended stores; jenkins.stats() sums the blocks of all live threads
+  plus those of threads that have exited.  stats(reset=True) never writes
+  another thread's counters: it records what it read as that block's
+  baseline, and later reads report counts above the baseline, so every
+  count is reported exactly once.  Without JENKINS_STATS the counters
+  are compiled out and stats() returns None.
+
+  Independently of JENKINS_STATS, when <sys/sdt.h> is available the same
+  macros fire the USDT probes jenkins:hash__entry and jenkins:hash__return
+  for bpftrace, perf or SystemTap.  Both carry
+    arg0  the algorithm name (char *),
+    arg1  the number of bytes hashed,
+    arg2  the number of keys (1 except for batch entry points).
+  An unattached probe is a single nop; see tools/bpftrace/ for examples.
+
+  The macros also feed an active jenkins.profile() in the calling thread;
+  when there is none that costs one thread-local load and a branch.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__has_include)
+# if __has_include(<sys/sdt.h>) && !defined(JENKINS_NO_PROBES)
+#  include <sys/sdt.h>
+#  define JK_HAVE_SDT 1
+# endif
+#endif
+#ifndef JK_HAVE_SDT
+# define JK_HAVE_SDT 0
+#endif
+
+enum jk_func {
+  JK_ONEATATIME,
+  JK_HASHWORD,
+  JK_HASHWORD2,
+  JK_HASHLITTLE,
+  JK_HASHLITTLE2,
+  JK_HASHBIG,
+  JK_MIX,
+  JK_FINAL,
+  JK_HASHLITTLE_ARRAY,
+  JK_HASHLITTLE2_ARRAY,
+  JK_HASHBIG_ARRAY,
+  JK_ONEATATIME_ARRAY,
+  JK_HASHLITTLE2_BATCH,     /* sketch updates, hash_iter */
+  JK_HASHFILE,
+  JK_HASHGZIP,
+  JK_NFUNCS
+};
+
+static const char *jk_func_names[JK_NFUNCS] = {
+  "oneatatime",
+  "hashword",
+  "hashword2",
+  "hashlittle",
+  "hashlittle2",
+  "hashbig",
+  "mix",
+  "final",
+  "hashlittle_array",
+  "hashlittle2_array",
+  "hashbig_array",
+  "oneatatime_array",
+  "hashlittle2_batch",
+  "hashfile",
+  "hashgzip"
+};
+
+#if JK_HAVE_SDT
+# define JK_PROBE_ENTRY(fn, len, n) \
+  DTRACE_PROBE3(jenkins, hash__entry, jk_func_names[fn], \
+                (uint64_t) (len), (uint64_t) (n))
+# define JK_PROBE_RETURN(fn, len, n) \
+  DTRACE_PROBE3(jenkins, hash__return, jk_func_names[fn], \
+                (uint64_t) (len), (uint64_t) (n))
+#else
+# define JK_PROBE_ENTRY(fn, len, n)  do { } while (0)
+# define JK_PROBE_RETURN(fn, len, n) do { } while (0)
+#endif
+
+#ifdef JENKINS_STATS
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define JK_LEN_BUCKETS 34 /* 0, then [2^(i-1), 2^i) up to 2^32 and beyond */
+#define JK_LAT_BUCKETS 40 /* [2^(i-1), 2^i) nanoseconds */
+
+enum jk_path { JK_PATH_ALIGNED, JK_PATH_HALF, JK_PATH_BYTE, JK_NPATHS };
+
+static const char *jk_path_names[JK_NPATHS] = {"aligned", "half", "byte"};
+
+struct jk_func_stats {
+  uint64_t calls;
+  uint64_t bytes;
+  uint64_t latency_ns;
+  uint64_t paths[JK_NPATHS];
+  uint64_t lengths[JK_LEN_BUCKETS];
+  uint64_t latency[JK_LAT_BUCKETS];
+};
+
+struct jk_thread_stats {
+  struct jk_func_stats f[JK_NFUNCS];
+  struct jk_func_stats base[JK_NFUNCS]; /* f at the last reset; lock held */
+  struct jk_thread_stats *prev, *next;
+};
+
+static pthread_mutex_t jk_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t jk_stats_key;
+static pthread_once_t jk_stats_once = PTHREAD_ONCE_INIT;
+static struct jk_thread_stats *jk_stats_threads; /* live threads */
+static struct jk_thread_stats jk_stats_retired;  /* exited threads, summed */
+static __thread struct jk_thread_stats *jk_stats_tls;
+
+/* Only the owning thread writes its block; readers may see a stale value. */
+#define JK_BUMP(field, n) \
+  __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+/* Add src's counts since its last reset to dst; with reset, make what was
+   read src's new baseline.  Called with jk_stats_lock held. */
+static void jk_stats_fold(struct jk_thread_stats *dst,
+                          struct jk_thread_stats *src, int reset) {
+  const uint64_t *s = (const uint64_t *) src->f;
+  uint64_t *b = (uint64_t *) src->base;
+  uint64_t *d = (uint64_t *) dst->f;
+  size_t i, n = JK_NFUNCS * sizeof(struct jk_func_stats) / sizeof(uint64_t);
+
+  for (i = 0; i < n; ++i) {
+    uint64_t v = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+
+    d[i] += v - b[i];
+    if (reset)
+      b[i] = v;
+  }
+}
+
+static void jk_stats_thread_exit(void *p) {
+  struct jk_thread_stats *ts = (struct jk_thread_stats *) p;
+
+  pthread_mutex_lock(&jk_stats_lock);
+  jk_stats_fold(&jk_stats_retired, ts, 0);
+  if (ts->prev)
+    ts->prev->next = ts->next;
+  else
+    jk_stats_threads = ts->next;
+  if (ts->next)
+    ts->next->prev = ts->prev;
+  pthread_mutex_unlock(&jk_stats_lock);
+  free(ts);
+}
+
+static void jk_stats_init_key(void) {
+  pthread_key_create(&jk_stats_key, jk_stats_thread_exit);
+}
+
+static struct jk_thread_stats *jk_stats_thread(void) {
+  struct jk_thread_stats *ts = jk_stats_tls;
+
+  if (ts)
+    return ts;
+
+  ts = calloc(1, sizeof(*ts));
+  if (!ts)
+    return NULL;
+
+  pthread_once(&jk_stats_once, jk_stats_init_key);
+  pthread_setspecific(jk_stats_key, ts);
+
+  pthread_mutex_lock(&jk_stats_lock);
+  ts->next = jk_stats_threads;
+  if (jk_stats_threads)
+    jk_stats_threads->prev = ts;
+  jk_stats_threads = ts;
+  pthread_mutex_unlock(&jk_stats_lock);
+
+  jk_stats_tls = ts;
+  return ts;
+}
+
+static inline int jk_log2_bucket(uint64_t v, int nbuckets) {
+  int b = v ? 64 - __builtin_clzll(v) : 0;
+  return b < nbuckets ? b : nbuckets - 1;
+}
+
+static inline uint64_t jk_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static inline void jk_stats_record(enum jk_func fn, const void *key,
+                                   size_t len, uint64_t n, uint64_t t0) {
+  uint64_t ns = jk_now_ns() - t0;
+  struct jk_thread_stats *ts = jk_stats_thread();
+  struct jk_func_stats *fs;
+  uintptr_t addr = (uintptr_t) key;
+
+  if (!ts)
+    return;
+  fs = &ts->f[fn];
+
+  JK_BUMP(fs->calls, n);
+  JK_BUMP(fs->bytes, len);
+  JK_BUMP(fs->latency_ns, ns);
+  if (n == 1)
+    JK_BUMP(fs->lengths[jk_log2_bucket(len, JK_LEN_BUCKETS)], 1);
+  JK_BUMP(fs->latency[jk_log2_bucket(ns, JK_LAT_BUCKETS)], 1);
+
+  /* mirror the path selection at the top of hashlittle() and hashbig() */
+  if (key) {
+    int native = (fn == JK_HASHBIG) ? HASH_BIG_ENDIAN : HASH_LITTLE_ENDIAN;
+    enum jk_path path;
+
+    if (native && (addr & 0x3) == 0)
+      path = JK_PATH_ALIGNED;
+    else if (native && fn != JK_HASHBIG && (addr & 0x1) == 0)
+      path = JK_PATH_HALF;
+    else
+      path = JK_PATH_BYTE;
+    JK_BUMP(fs->paths[path], 1);
+  }
+}
+
+#define JK_STATS_ENTER(fn, key, len) \
+  uint64_t jk_t0_ = jk_now_ns()
+#define JK_STATS_EXIT(fn, key, len, n) \
+  jk_stats_record((fn), (key), (size_t) (len), (uint64_t) (n), jk_t0_)
+
+/* Histogram buckets as [low, high, count] lists, skipping empty buckets. */
+static PyObject* jk_histogram(const uint64_t *h, int n) {
+  PyObject *list = PyList_New(0);
+  int i;
+
+  if (!list)
+    return NULL;
+
+  for (i = 0; i < n; ++i) {
+    PyObject *item;
+    unsigned long long lo, hi;
+
+    if (!h[i])
+      continue;
+    lo = i ? 1ULL << (i - 1) : 0;
+    hi = (i == n - 1) ? ~0ULL : (1ULL << i) - 1;
+    item = Py_BuildValue("[KKK]", lo, hi, (unsigned long long) h[i]);
+    if (!item || PyList_Append(list, item) < 0) {
+      Py_XDECREF(item);
+      Py_DECREF(list);
+      return NULL;
+    }
+    Py_DECREF(item);
+  }
+  return list;
+}
+
+static PyObject* jk_stats_dict(const struct jk_thread_stats *sum) {
+  PyObject *result = PyDict_New();
+  int fn, p;
+
+  if (!result)
+    return NULL;
+
+  for (fn = 0; fn < JK_NFUNCS; ++fn) {
+    const struct jk_func_stats *fs = &sum->f[fn];
+    PyObject *entry, *paths, *lengths, *latency;
+
+    paths = PyDict_New();
+    if (!paths)
+      goto error;
+    for (p = 0; p < JK_NPATHS; ++p) {
+      PyObject *v = PyLong_FromUnsignedLongLong(fs->paths[p]);
+      if (!v || PyDict_SetItemString(paths, jk_path_names[p], v) < 0) {
+        Py_XDECREF(v);
+        Py_DECREF(paths);
+        goto error;
+      }
+      Py_DECREF(v);
+    }
+
+    lengths = jk_histogram(fs->lengths, JK_LEN_BUCKETS);
+    latency = jk_histogram(fs->latency, JK_LAT_BUCKETS);
+    if (!lengths || !latency) {
+      Py_XDECREF(lengths);
+      Py_XDECREF(latency);
+      Py_DECREF(paths);
+      goto error;
+    }
+
+    entry = Py_BuildValue("{sKsKsKsNsNsN}",
+                          "calls", (unsigned long long) fs->calls,
+                          "bytes", (unsigned long long) fs->bytes,
+                          "latency_ns", (unsigned long long) fs->latency_ns,
+                          "paths", paths,
+                          "lengths", lengths,
+                          "latency_hist_ns", latency);
+    if (!entry || PyDict_SetItemString(result, jk_func_names[fn], entry) < 0) {
+      Py_XDECREF(entry);
+      goto error;
+    }
+    Py_DECREF(entry);
+  }
+  return result;
+
+error:
+  Py_DECREF(result);
+  return NULL;
+}
+
+static PyObject* jk_stats_collect(int reset) {
+  struct jk_thread_stats *sum, *ts;
+  PyObject *result;
+
+  sum = calloc(1, sizeof(*sum));
+  if (!sum)
+    return PyErr_NoMemory();
+
+  pthread_mutex_lock(&jk_stats_lock);
+  jk_stats_fold(sum, &jk_stats_retired, reset);
+  for (ts = jk_stats_threads; ts; ts = ts->next)
+    jk_stats_fold(sum, ts, reset);
+  pthread_mutex_unlock(&jk_stats_lock);
+
+  result = jk_stats_dict(sum);
+  free(sum);
+  return result;
+}
+
+#else /* !JENKINS_STATS */
+
+#define JK_STATS_ENTER(fn, key, len) do { } while (0)
+#define JK_STATS_EXIT(fn, key, len, n) do { } while (0)
+
+static PyObject* jk_stats_collect(int reset) {
+  Py_RETURN_NONE;
+}
+
+#endif /* JENKINS_STATS */
+
+/*
+  key is the buffer handed to a byte-oriented kernel, or NULL for the
+  integer kernels, which have no read path to report.  JK_PROFILE_ENTER()
+  and JK_PROFILE_EXIT() come from profile.c.
+ */
+#define JK_ENTER(fn, key, len) \
+  JK_STATS_ENTER(fn, key, len); \
+  JK_PROFILE_ENTER(fn); \
+  JK_PROBE_ENTRY(fn, len, 1)
+#define JK_EXIT(fn, key, len) \
+  JK_PROBE_RETURN(fn, len, 1); \
+  JK_PROFILE_EXIT(fn, len, 1); \
+  JK_STATS_EXIT(fn, key, len, 1)
+
+/*
+  n keys of len bytes in all.  Work that the batch hands to other
+  threads counts towards stats and probes but not towards a profile,
+  which only sees the calling thread's counters.
+ */
+#define JK_ENTER_BATCH(fn, len, n) \
+  JK_STATS_ENTER(fn, NULL, len); \
+  JK_PROFILE_ENTER(fn); \
+  JK_PROBE_ENTRY(fn, len, n)
+#define JK_EXIT_BATCH(fn, len, n) \
+  JK_PROBE_RETURN(fn, len, n); \
+  JK_PROFILE_EXIT(fn, len, n); \
+  JK_STATS_EXIT(fn, NULL, len, n)
@@ -36,23 +36,31 @@
 #include <stdint.h>
 
 #include "lookup3.c"
-
-static uint32_t one_at_a_time(const char *key, Py_ssize_t key_len) {
-  Py_ssize_t i;
-  uint32_t hash = 0;
-
-  for (i = 0; i < key_len; ++i) {
-    hash += key[i];
-    hash += (hash << 10);
-    hash ^= (hash >> 6);
-  }
-
-  hash += (hash << 3);
-  hash ^= (hash >> 11);
-  hash += (hash << 15);
-
-  return hash;
-}
+#include "oneatatime.c"
+#include "instrument.c"
+#include "profile.c"
+#include "arrays.c"
+#include "hll.c"
+#include "stream.c"
+#include "batch.c"
+#include "alloc.c"
+#include "sketch.c"
+#include "filehash.c"
+#include "gzhash.c"
+#include "logstore.c"
+#include "multiset.c"
+#include "blockfile.c"
+#include "ratelimit.c"
+#include "iblt.c"
+#include "priority.c"
+#include "ingest.c"
+
+/* Key arguments: a read-only buffer, which Python 3 spells "y#". */
+#if PY_MAJOR_VERSION >= 3
+#define JK_BUFFER_FORMAT "y#"
+#else
+#define JK_BUFFER_FORMAT "t#"
+#endif
 
 static char oneatatime_doc[] = "Bob Jenkins's One-at-a-time non-cryptographic hash function. Takes a (read-only) buffer. Returns an unsigned 32-bit integer hash of the buffer.";
 
@@ -61,10 +69,12 @@ static PyObject* oneatatime_py(PyObject* self, PyObject* args) {
   Py_ssize_t key_len;
   uint32_t hash;
 
-  if (!PyArg_ParseTuple(args, "t#", &key, &key_len))
+  if (!PyArg_ParseTuple(args, JK_BUFFER_FORMAT, &key, &key_len))
     return NULL;
 
-  hash = one_at_a_time(key, key_len);
+  JK_ENTER(JK_ONEATATIME, key, key_len);
+  hash = one_at_a_time(key, (size_t) key_len);
+  JK_EXIT(JK_ONEATATIME, key, key_len);
 
   return Py_BuildValue("I", hash);
 }
@@ -129,7 +139,9 @@ static PyObject* hashword_py(PyObject* self, PyObject* args) {
   Py_DECREF(seq);
 
   /* Actually hash */
+  JK_ENTER(JK_HASHWORD, NULL, key_len * 4);
   hash = hashword(key, (size_t) key_len, (uint32_t) initval);
+  JK_EXIT(JK_HASHWORD, NULL, key_len * 4);
 
   free(key);
   return Py_BuildValue("I", hash);
@@ -198,7 +210,9 @@ static PyObject* hashword2_py(PyObject* self, PyObject* args) {
   /* Actually hash */
   pc = (uint32_t) initpc;
   pb = (uint32_t) initpb;
+  JK_ENTER(JK_HASHWORD2, NULL, key_len * 4);
   hashword2(key, (size_t) key_len, &pc, &pb);
+  JK_EXIT(JK_HASHWORD2, NULL, key_len * 4);
 
   free(key);
   return Py_BuildValue("II", pc, pb);
@@ -212,12 +226,14 @@ static PyObject* hashlittle_py(PyObject* self, PyObject* args) {
   unsigned long init = 0;
   uint32_t initval, hash;
 
-  if (!PyArg_ParseTuple(args, "t#|k", &key, &key_len, &init))
+  if (!PyArg_ParseTuple(args, JK_BUFFER_FORMAT "|k", &key, &key_len, &init))
     return NULL;
 
   initval = (uint32_t) init;
 
+  JK_ENTER(JK_HASHLITTLE, key, key_len);
   hash = hashlittle(key, key_len, initval);
+  JK_EXIT(JK_HASHLITTLE, key, key_len);
 
   return Py_BuildValue("I", hash);
 }
@@ -231,13 +247,16 @@ static PyObject* hashlittle2_py(PyObject* self, PyObject* args) {
   unsigned long initb = 0;
   uint32_t pc, pb;
 
-  if (!PyArg_ParseTuple(args, "t#|kk", &key, &key_len, &initc, &initb))
+  if (!PyArg_ParseTuple(args, JK_BUFFER_FORMAT "|kk", &key, &key_len,
+                        &initc, &initb))
     return NULL;
 
   pc = (uint32_t) initc;
   pb = (uint32_t) initb;
 
+  JK_ENTER(JK_HASHLITTLE2, key, key_len);
   hashlittle2(key, key_len, &pc, &pb);
+  JK_EXIT(JK_HASHLITTLE2, key, key_len);
 
   return Py_BuildValue("II", pc, pb);
 }
@@ -250,12 +269,14 @@ static PyObject* hashbig_py(PyObject* self, PyObject* args) {
   unsigned long init = 0;
   uint32_t initval, hash;
 
-  if (!PyArg_ParseTuple(args, "t#|k", &key, &key_len, &init))
+  if (!PyArg_ParseTuple(args, JK_BUFFER_FORMAT "|k", &key, &key_len, &init))
     return NULL;
 
   initval = (uint32_t) init;
 
+  JK_ENTER(JK_HASHBIG, key, key_len);
   hash = hashbig(key, key_len, initval);
+  JK_EXIT(JK_HASHBIG, key, key_len);
 
   return Py_BuildValue("I", hash);
 }
@@ -273,7 +294,9 @@ static PyObject* mix_py(PyObject* self, PyObject* args) {
   b = (uint32_t) initb;
   c = (uint32_t) initc;
 
+  JK_ENTER(JK_MIX, NULL, 12);
   mix(a, b, c); /* This is a macro */
+  JK_EXIT(JK_MIX, NULL, 12);
 
   return Py_BuildValue("III", a, b, c);
 }
@@ -291,11 +314,24 @@ static PyObject* final_py(PyObject* self, PyObject* args) {
   b = (uint32_t) initb;
   c = (uint32_t) initc;
 
+  JK_ENTER(JK_FINAL, NULL, 12);
   final(a, b, c); /* This is a macro */
+  JK_EXIT(JK_FINAL, NULL, 12);
 
   return Py_BuildValue("III", a, b, c);
 }
 
+static char stats_doc[] = "Takes an optional flag; if true, counters are zeroed after reading. Returns a dict keyed by function name with call and byte counts, hashlittle/hashbig read path hits and key length and latency histograms as [low, high, count] lists, summed over all threads. Returns None unless the module was built with JENKINS_STATS.";
+
+static PyObject* stats_py(PyObject* self, PyObject* args) {
+  int reset = 0;
+
+  if (!PyArg_ParseTuple(args, "|i", &reset))
+    return NULL;
+
+  return jk_stats_collect(reset);
+}
+
 static PyMethodDef jenkins_funcs[] = {
   {"oneatatime", (PyCFunction) oneatatime_py, METH_VARARGS, oneatatime_doc},
   {"hashword",   (PyCFunction) hashword_py,   METH_VARARGS, hashword_doc},
@@ -305,6 +341,29 @@ static PyMethodDef jenkins_funcs[] = {
   {"hashbig",    (PyCFunction) hashbig_py,    METH_VARARGS, hashbig_doc},
   {"mix",        (PyCFunction) mix_py,        METH_VARARGS, mix_doc},
   {"final",      (PyCFunction) final_py,      METH_VARARGS, final_doc},
+  {"stats",      (PyCFunction) stats_py,      METH_VARARGS, stats_doc},
+  {"profile",    (PyCFunction) profile_py,    METH_VARARGS, profile_doc},
+  {"memory_usage", (PyCFunction) memory_usage_py, METH_NOARGS,
+   memory_usage_doc},
+  {"hashfile",   (PyCFunction) hashfile_py,   METH_VARARGS, hashfile_doc},
+  {"hashfiles",  (PyCFunction) hashfiles_py,
+   METH_VARARGS | METH_KEYWORDS, hashfiles_doc},
+  {"hashgzip",   (PyCFunction) hashgzip_py,
+   METH_VARARGS | METH_KEYWORDS, hashgzip_doc},
+  {"write_blockfile", (PyCFunction) write_blockfile_py,
+   METH_VARARGS | METH_KEYWORDS, write_blockfile_doc},
+  {"hash_iter",  (PyCFunction) hash_iter_py,
+   METH_VARARGS | METH_KEYWORDS, hash_iter_doc},
+#ifdef JENKINS_NUMPY
+  {"hashlittle_array",  (PyCFunction) hashlittle_array_py,
+   METH_VARARGS | METH_KEYWORDS, hashlittle_array_doc},
+  {"hashlittle2_array", (PyCFunction) hashlittle2_array_py,
+   METH_VARARGS | METH_KEYWORDS, hashlittle2_array_doc},
+  {"hashbig_array",     (PyCFunction) hashbig_array_py,
+   METH_VARARGS | METH_KEYWORDS, hashbig_array_doc},
+  {"oneatatime_array",  (PyCFunction) oneatatime_array_py,
+   METH_VARARGS | METH_KEYWORDS, oneatatime_array_doc},
+#endif
   {NULL, NULL, 0, NULL}
 };
 
@@ -320,10 +379,89 @@ static struct PyModuleDef jenkins = {
 };
 
 PyMODINIT_FUNC PyInit_jenkins(void) {
-  return PyModule_Create(&jenkins);
+  PyObject *m;
+
+  if (PyType_Ready(&ProfileType) < 0 || PyType_Ready(&HLLArenaType) < 0 ||
+      PyType_Ready(&FileHashCacheType) < 0 ||
+      PyType_Ready(&LogStoreType) < 0 ||
+      PyType_Ready(&MultisetHashType) < 0 ||
+      PyType_Ready(&BlockFileType) < 0 ||
+      PyType_Ready(&RateLimiterType) < 0 || PyType_Ready(&IBLTType) < 0 ||
+      PyType_Ready(&StrataEstimatorType) < 0 ||
+      PyType_Ready(&PrioritySampleType) < 0)
+    return NULL;
+#ifdef JENKINS_NUMPY
+  jk_numpy_init();
+#endif
+
+  m = PyModule_Create(&jenkins);
+  if (!m)
+    return NULL;
+
+  Py_INCREF(&ProfileType);
+  PyModule_AddObject(m, "Profile", (PyObject *) &ProfileType);
+  Py_INCREF(&HLLArenaType);
+  PyModule_AddObject(m, "HLLArena", (PyObject *) &HLLArenaType);
+  Py_INCREF(&FileHashCacheType);
+  PyModule_AddObject(m, "FileHashCache", (PyObject *) &FileHashCacheType);
+  Py_INCREF(&LogStoreType);
+  PyModule_AddObject(m, "LogStore", (PyObject *) &LogStoreType);
+  Py_INCREF(&MultisetHashType);
+  PyModule_AddObject(m, "MultisetHash", (PyObject *) &MultisetHashType);
+  Py_INCREF(&BlockFileType);
+  PyModule_AddObject(m, "BlockFile", (PyObject *) &BlockFileType);
+  Py_INCREF(&RateLimiterType);
+  PyModule_AddObject(m, "RateLimiter", (PyObject *) &RateLimiterType);
+  Py_INCREF(&IBLTType);
+  PyModule_AddObject(m, "IBLT", (PyObject *) &IBLTType);
+  Py_INCREF(&StrataEstimatorType);
+  PyModule_AddObject(m, "StrataEstimator",
+                     (PyObject *) &StrataEstimatorType);
+  Py_INCREF(&PrioritySampleType);
+  PyModule_AddObject(m, "PrioritySample", (PyObject *) &PrioritySampleType);
+  return m;
 }
 #else
 PyMODINIT_FUNC initjenkins(void) {
-  (void) Py_InitModule3("jenkins", jenkins_funcs, jenkins_doc);
+  PyObject *m;
+
+  if (PyType_Ready(&ProfileType) < 0 || PyType_Ready(&HLLArenaType) < 0 ||
+      PyType_Ready(&FileHashCacheType) < 0 ||
+      PyType_Ready(&LogStoreType) < 0 ||
+      PyType_Ready(&MultisetHashType) < 0 ||
+      PyType_Ready(&BlockFileType) < 0 ||
+      PyType_Ready(&RateLimiterType) < 0 || PyType_Ready(&IBLTType) < 0 ||
+      PyType_Ready(&StrataEstimatorType) < 0 ||
+      PyType_Ready(&PrioritySampleType) < 0)
+    return;
+#ifdef JENKINS_NUMPY
+  jk_numpy_init();
+#endif
+
+  m = Py_InitModule3("jenkins", jenkins_funcs, jenkins_doc);
+  if (!m)
+    return;
+
+  Py_INCREF(&ProfileType);
+  PyModule_AddObject(m, "Profile", (PyObject *) &ProfileType);
+  Py_INCREF(&HLLArenaType);
+  PyModule_AddObject(m, "HLLArena", (PyObject *) &HLLArenaType);
+  Py_INCREF(&FileHashCacheType);
+  PyModule_AddObject(m, "FileHashCache", (PyObject *) &FileHashCacheType);
+  Py_INCREF(&LogStoreType);
+  PyModule_AddObject(m, "LogStore", (PyObject *) &LogStoreType);
+  Py_INCREF(&MultisetHashType);
+  PyModule_AddObject(m, "MultisetHash", (PyObject *) &MultisetHashType);
+  Py_INCREF(&BlockFileType);
+  PyModule_AddObject(m, "BlockFile", (PyObject *) &BlockFileType);
+  Py_INCREF(&RateLimiterType);
+  PyModule_AddObject(m, "RateLimiter", (PyObject *) &RateLimiterType);
+  Py_INCREF(&IBLTType);
+  PyModule_AddObject(m, "IBLT", (PyObject *) &IBLTType);
+  Py_INCREF(&StrataEstimatorType);
+  PyModule_AddObject(m, "StrataEstimator",
+                     (PyObject *) &StrataEstimatorType);
+  Py_INCREF(&PrioritySampleType);
+  PyModule_AddObject(m, "PrioritySample", (PyObject *) &PrioritySampleType);
 }
 #endif
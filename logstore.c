@@ -0,0 +1,1729 @@
+/*
+  LogStore: a Bitcask-style persistent key-value store.
+
+  Every put() or delete() appends a record to the active segment file,
+  <directory>/<id>.data:
+
+    crc      hashlittle() of the rest of the header, the key and the value
+    ksz      key length
+    vsz      value length
+    flags    LS_TOMBSTONE for a delete
+    seq      store-wide sequence number
+    key, value
+
+  The keydir, an open-addressed table in memory, maps the 64-bit
+  hashlittle2 of each live key (hll_hash()) to the segment, offset and
+  sizes of its newest record, so a get() is one lookup and one pread().
+  Keys themselves are not kept in memory.  A lookup compares the key
+  stored in the record of each entry with the same hash and size, so
+  two keys with the same 64-bit hash get entries of their own and never
+  overwrite or delete each other.
+
+  Appends go to a write buffer that is written out when it fills.
+  commit() makes everything appended so far durable.  Threads calling
+  commit() at the same time share one fdatasync(): one of them syncs
+  while the others wait for it (group commit).  Segments are closed
+  once they reach segment_size, and a new one is started on every open.
+
+  compact() rewrites the closed segments on a background thread,
+  keeping only records the keydir still points to, into new segments
+  with a hint file, <id>.hint, next to each.  A hint holds one fixed-size
+  entry per record (hash, seq, offset, sizes), so opening the store
+  reads hints instead of scanning data where it can.  Records keep their
+  sequence numbers when copied, and on open the newest record for a key
+  wins whatever file it is in, so a crash during compaction leaves a
+  consistent store.  The inputs are removed only once their copies are on
+  disk, and their ids are first recorded in a file, "drop", that open
+  finishes acting on: a surviving input could otherwise bring back a key
+  whose delete was in an input removed before it.  The tail of the last
+  segment is checked on open and a torn final record is cut off.
+
+  Record headers, hint entries and the ids in "drop" are little-endian,
+  written field by field with jk_put32()/jk_put64().
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LS_TOMBSTONE       1
+#define LS_SEGMENT_SIZE    ((uint64_t) 64 << 20)
+#define LS_BUFFER_SIZE     ((size_t) 1 << 20)
+#define LS_MIN_KEYDIR      1024
+#define LS_HEADER_SIZE     24
+#define LS_HINT_SIZE       32
+
+struct ls_header {
+  uint32_t crc;
+  uint32_t ksz, vsz;
+  uint32_t flags;
+  uint64_t seq;
+};
+
+struct ls_hint {
+  uint64_t h, seq, off;
+  uint32_t ksz, vsz;
+};
+
+static void ls_header_put(uint8_t *p, const struct ls_header *h) {
+  jk_put32(p, h->crc);
+  jk_put32(p + 4, h->ksz);
+  jk_put32(p + 8, h->vsz);
+  jk_put32(p + 12, h->flags);
+  jk_put64(p + 16, h->seq);
+}
+
+static void ls_header_get(struct ls_header *h, const void *p) {
+  const uint8_t *b = (const uint8_t *) p;
+
+  h->crc = jk_get32(b);
+  h->ksz = jk_get32(b + 4);
+  h->vsz = jk_get32(b + 8);
+  h->flags = jk_get32(b + 12);
+  h->seq = jk_get64(b + 16);
+}
+
+static void ls_hint_put(uint8_t *p, const struct ls_hint *h) {
+  jk_put64(p, h->h);
+  jk_put64(p + 8, h->seq);
+  jk_put64(p + 16, h->off);
+  jk_put32(p + 24, h->ksz);
+  jk_put32(p + 28, h->vsz);
+}
+
+static void ls_hint_get(struct ls_hint *h, const uint8_t *p) {
+  h->h = jk_get64(p);
+  h->seq = jk_get64(p + 8);
+  h->off = jk_get64(p + 16);
+  h->ksz = jk_get32(p + 24);
+  h->vsz = jk_get32(p + 28);
+}
+
+/* seg == 0 marks an empty slot; segment ids start at 1 */
+struct ls_entry {
+  uint64_t h, seq, off;
+  uint32_t seg;
+  uint32_t ksz, vsz;
+  uint32_t flags;           /* LS_TOMBSTONE, only while loading */
+};
+
+struct ls_segment {
+  uint32_t id;
+  int fd;
+  uint64_t size;            /* bytes in the file */
+};
+
+typedef struct {
+  PyObject_HEAD
+  PyObject *path;           /* directory, bytes */
+  int dirfd;
+  int closed;
+
+  struct jk_memory mem;
+  struct ls_entry *keydir;
+  size_t keydir_size;       /* bytes mapped */
+  uint64_t mask, count;
+
+  struct ls_segment *segs;  /* sorted by id */
+  size_t nsegs, segs_cap;
+  uint32_t active, next_id;
+  uint64_t next_seq, segment_size;
+
+  char *wbuf;               /* appended, not yet written to the active segment */
+  size_t wlen, wcap, buffer_size;
+  uint64_t written, synced; /* log positions: bytes written / fdatasync'd */
+  int syncing;
+
+  pthread_t compactor;
+  int compacting, compact_err;
+  pthread_mutex_t compact_lock; /* serializes compact() and close() */
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} LogStoreObject;
+
+/* Checksum of a record: its encoded header after the crc, key, value. */
+static uint32_t ls_crc(const struct ls_header *h, const void *key,
+                       const void *value) {
+  uint8_t buf[LS_HEADER_SIZE];
+  uint32_t crc;
+
+  ls_header_put(buf, h);
+  crc = hashlittle(buf + 4, LS_HEADER_SIZE - 4, 0);
+
+  crc = hashlittle(key, h->ksz, crc);
+  return hashlittle(value, h->vsz, crc);
+}
+
+/* ---------------------------------------------------------------- keydir */
+
+/* The entry pointing at the record at seg/off, or NULL if none does. */
+static struct ls_entry *ls_find_at(LogStoreObject *s, uint64_t h,
+                                   uint32_t seg, uint64_t off) {
+  uint64_t i = h & s->mask;
+
+  for (;; i = (i + 1) & s->mask) {
+    struct ls_entry *e = &s->keydir[i];
+    if (!e->seg)
+      return NULL;
+    if (e->h == h && e->seg == seg && e->off == off)
+      return e;
+  }
+}
+
+static int ls_has_hash(LogStoreObject *s, uint64_t h) {
+  uint64_t i = h & s->mask;
+
+  for (; s->keydir[i].seg; i = (i + 1) & s->mask)
+    if (s->keydir[i].h == h)
+      return 1;
+  return 0;
+}
+
+/* The first empty slot of h's probe run. */
+static struct ls_entry *ls_free_slot(LogStoreObject *s, uint64_t h) {
+  uint64_t i = h & s->mask;
+
+  while (s->keydir[i].seg)
+    i = (i + 1) & s->mask;
+  return &s->keydir[i];
+}
+
+/*
+  Move the keydir to a table of the given size.  Deleted keys are carried
+  over, since while loading they must keep outranking older records, unless
+  drop_deleted is set.
+*/
+static int ls_keydir_alloc(LogStoreObject *s, uint64_t slots,
+                           int drop_deleted) {
+  struct ls_entry *old = s->keydir;
+  size_t old_size = s->keydir_size;
+  uint64_t i, old_slots = old ? s->mask + 1 : 0;
+  size_t size = slots * sizeof(struct ls_entry);
+  struct ls_entry *table = jk_map(&s->mem, &size);
+
+  if (!table)
+    return -1;
+  s->keydir = table;
+  s->keydir_size = size;
+  s->mask = slots - 1;
+  s->count = 0;
+  for (i = 0; i < old_slots; ++i) {
+    if (old[i].seg && !(drop_deleted && (old[i].flags & LS_TOMBSTONE))) {
+      *ls_free_slot(s, old[i].h) = old[i];
+      ++s->count;
+    }
+  }
+  jk_unmap(&s->mem, old, old_size);
+  s->mem.live = slots * sizeof(struct ls_entry);
+  return 0;
+}
+
+/* Remove an entry, shifting later entries of its probe run back. */
+static void ls_remove(LogStoreObject *s, struct ls_entry *e) {
+  uint64_t i = (uint64_t) (e - s->keydir), j = i;
+
+  for (;;) {
+    uint64_t home;
+
+    j = (j + 1) & s->mask;
+    if (!s->keydir[j].seg)
+      break;
+    home = s->keydir[j].h & s->mask;
+    /* move j back to i unless its home lies cyclically in (i, j] */
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+      continue;
+    s->keydir[i] = s->keydir[j];
+    i = j;
+  }
+  s->keydir[i].seg = 0;
+  --s->count;
+}
+
+/* -------------------------------------------------------------- segments */
+
+static struct ls_segment *ls_segment(LogStoreObject *s, uint32_t id) {
+  size_t lo = 0, hi = s->nsegs;
+
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (s->segs[mid].id < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < s->nsegs && s->segs[lo].id == id ? &s->segs[lo] : NULL;
+}
+
+static int ls_segment_add(LogStoreObject *s, uint32_t id, int fd,
+                          uint64_t size) {
+  size_t i;
+
+  if (s->nsegs == s->segs_cap) {
+    size_t cap = s->segs_cap ? s->segs_cap * 2 : 16;
+    struct ls_segment *segs = realloc(s->segs, cap * sizeof(*segs));
+
+    if (!segs) {
+      errno = ENOMEM;
+      return -1;
+    }
+    s->segs = segs;
+    s->segs_cap = cap;
+  }
+  for (i = s->nsegs; i > 0 && s->segs[i - 1].id > id; --i)
+    s->segs[i] = s->segs[i - 1];
+  s->segs[i].id = id;
+  s->segs[i].fd = fd;
+  s->segs[i].size = size;
+  ++s->nsegs;
+  return 0;
+}
+
+static void ls_segment_remove(LogStoreObject *s, uint32_t id) {
+  struct ls_segment *seg = ls_segment(s, id);
+  size_t i;
+
+  if (!seg)
+    return;
+  i = (size_t) (seg - s->segs);
+  memmove(seg, seg + 1, (s->nsegs - i - 1) * sizeof(*seg));
+  --s->nsegs;
+}
+
+static void ls_name(char *buf, uint32_t id, const char *ext) {
+  snprintf(buf, 32, "%010u.%s", id, ext);
+}
+
+static int ls_create(LogStoreObject *s, uint32_t id, const char *ext) {
+  char name[32];
+
+  ls_name(name, id, ext);
+  return openat(s->dirfd, name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+/* Write all of buf at off; returns 0 or -1 with errno set. */
+static int ls_pwrite(int fd, const void *buf, size_t len, uint64_t off) {
+  const char *p = (const char *) buf;
+
+  while (len) {
+    ssize_t n = pwrite(fd, p, len, (off_t) off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t) n;
+    off += (uint64_t) n;
+  }
+  return 0;
+}
+
+/* Read all of buf from off; returns 0, or -1 with errno set (EIO if short). */
+static int ls_pread(int fd, void *buf, size_t len, uint64_t off) {
+  char *p = (char *) buf;
+
+  while (len) {
+    ssize_t n = pread(fd, p, len, (off_t) off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0) {
+      errno = EIO;
+      return -1;
+    }
+    p += n;
+    len -= (size_t) n;
+    off += (uint64_t) n;
+  }
+  return 0;
+}
+
+/* ------------------------------------------------------------------ keys */
+
+/*
+  Whether the record e points at is for key; lock held.  Returns 1 or 0,
+  or -1 with errno set.
+ */
+static int ls_is_key(LogStoreObject *s, const struct ls_entry *e,
+                     const void *key, size_t ksz) {
+  struct ls_segment *seg = ls_segment(s, e->seg);
+  uint64_t off = e->off + LS_HEADER_SIZE;
+  const char *k = (const char *) key;
+  char buf[512];
+
+  if (e->ksz != ksz)
+    return 0;
+  if (!seg) {
+    errno = EIO;
+    return -1;
+  }
+  if (e->seg == s->active && e->off >= seg->size)
+    return memcmp(s->wbuf + (off - seg->size), k, ksz) == 0;
+  while (ksz) {
+    size_t n = ksz < sizeof(buf) ? ksz : sizeof(buf);
+
+    if (ls_pread(seg->fd, buf, n, off) < 0)
+      return -1;
+    if (memcmp(buf, k, n) != 0)
+      return 0;
+    k += n;
+    off += n;
+    ksz -= n;
+  }
+  return 1;
+}
+
+/*
+  The entry for key, or the empty slot where it would go; lock held.
+  Returns NULL with errno set if a record could not be read.
+ */
+static struct ls_entry *ls_find(LogStoreObject *s, uint64_t h,
+                                const void *key, size_t ksz) {
+  uint64_t i = h & s->mask;
+
+  for (;; i = (i + 1) & s->mask) {
+    struct ls_entry *e = &s->keydir[i];
+    int rc;
+
+    if (!e->seg)
+      return e;
+    if (e->h != h)
+      continue;
+    rc = ls_is_key(s, e, key, ksz);
+    if (rc < 0)
+      return NULL;
+    if (rc)
+      return e;
+  }
+}
+
+/* Entry for key, inserted empty if absent; NULL with errno set on failure. */
+static struct ls_entry *ls_insert(LogStoreObject *s, uint64_t h,
+                                  const void *key, size_t ksz) {
+  struct ls_entry *e;
+
+  if ((s->count + 1) * 4 > (s->mask + 1) * 3 &&
+      ls_keydir_alloc(s, (s->mask + 1) * 2, 0) < 0) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  e = ls_find(s, h, key, ksz);
+  if (e && !e->seg) {
+    memset(e, 0, sizeof(*e));
+    e->h = h;
+    ++s->count;
+  }
+  return e;
+}
+
+/* ---------------------------------------------------------------- writing */
+
+/* Write the buffer to the active segment; lock held. */
+static int ls_flush(LogStoreObject *s) {
+  struct ls_segment *seg = ls_segment(s, s->active);
+
+  if (!s->wlen)
+    return 0;
+  if (ls_pwrite(seg->fd, s->wbuf, s->wlen, seg->size) < 0)
+    return -1;
+  seg->size += s->wlen;
+  s->written += s->wlen;
+  s->wlen = 0;
+  return 0;
+}
+
+/* Close the active segment and start a new one; lock held. */
+static int ls_rotate(LogStoreObject *s) {
+  struct ls_segment *seg;
+  uint32_t id;
+  int fd;
+
+  if (ls_flush(s) < 0)
+    return -1;
+  seg = ls_segment(s, s->active);
+  if (fdatasync(seg->fd) < 0)
+    return -1;
+  s->synced = s->written;
+
+  id = s->next_id++;
+  fd = ls_create(s, id, "data");
+  if (fd < 0)
+    return -1;
+  if (ls_segment_add(s, id, fd, 0) < 0) {
+    close(fd);
+    return -1;
+  }
+  s->active = id;
+  fsync(s->dirfd);
+  return 0;
+}
+
+/* Append a record and point the keydir at it; lock held. */
+static int ls_append(LogStoreObject *s, const void *key, size_t ksz,
+                     const void *value, size_t vsz, uint32_t flags) {
+  struct ls_header h;
+  struct ls_segment *seg = ls_segment(s, s->active);
+  size_t len = LS_HEADER_SIZE + ksz + vsz;
+  uint64_t hash = hll_hash(key, ksz), off;
+  struct ls_entry *e;
+
+  if (ksz > UINT32_MAX || vsz > UINT32_MAX) {
+    errno = EFBIG;
+    return -1;
+  }
+
+  if (seg->size + s->wlen > 0 &&
+      seg->size + s->wlen + len > s->segment_size) {
+    if (ls_rotate(s) < 0)
+      return -1;
+    seg = ls_segment(s, s->active);
+  }
+  if (s->wlen + len > s->wcap) {
+    size_t cap = s->wcap;
+    char *buf;
+
+    while (cap < s->wlen + len)
+      cap *= 2;
+    buf = realloc(s->wbuf, cap);
+    if (!buf) {
+      errno = ENOMEM;
+      return -1;
+    }
+    s->wbuf = buf;
+    s->wcap = cap;
+  }
+
+  /* find the key's entry first, so that nothing is appended on failure */
+  e = flags & LS_TOMBSTONE ? ls_find(s, hash, key, ksz)
+                           : ls_insert(s, hash, key, ksz);
+  if (!e)
+    return -1;
+
+  h.ksz = (uint32_t) ksz;
+  h.vsz = (uint32_t) vsz;
+  h.flags = flags;
+  h.seq = s->next_seq++;
+  h.crc = ls_crc(&h, key, value);
+  off = seg->size + s->wlen;
+  ls_header_put((uint8_t *) s->wbuf + s->wlen, &h);
+  memcpy(s->wbuf + s->wlen + LS_HEADER_SIZE, key, ksz);
+  memcpy(s->wbuf + s->wlen + LS_HEADER_SIZE + ksz, value, vsz);
+  s->wlen += len;
+
+  if (flags & LS_TOMBSTONE) {
+    if (e->seg)
+      ls_remove(s, e);
+  } else {
+    e->seq = h.seq;
+    e->off = off;
+    e->seg = s->active;
+    e->ksz = h.ksz;
+    e->vsz = h.vsz;
+    e->flags = 0;
+  }
+
+  if (s->wlen >= s->buffer_size)
+    return ls_flush(s);
+  return 0;
+}
+
+/*
+  Make everything appended so far durable; called without the lock.  Fails
+  with EBADF if the store is closed while waiting.
+*/
+static int ls_commit(LogStoreObject *s) {
+  uint64_t target;
+  int rc = 0;
+
+  pthread_mutex_lock(&s->lock);
+  if (s->closed || ls_flush(s) < 0) {
+    if (s->closed)
+      errno = EBADF;
+    pthread_mutex_unlock(&s->lock);
+    return -1;
+  }
+  target = s->written;
+  while (s->synced < target && rc == 0) {
+    if (s->closed) {
+      errno = EBADF;
+      rc = -1;
+      break;
+    }
+    if (s->syncing) {
+      pthread_cond_wait(&s->cond, &s->lock);
+      continue;
+    }
+    {
+      uint64_t pos = s->written;
+      int fd = dup(ls_segment(s, s->active)->fd);
+
+      if (fd < 0) {
+        rc = -1;
+        break;
+      }
+      s->syncing = 1;
+      pthread_mutex_unlock(&s->lock);
+      rc = fdatasync(fd);
+      close(fd);
+      pthread_mutex_lock(&s->lock);
+      s->syncing = 0;
+      if (rc == 0 && pos > s->synced)
+        s->synced = pos;
+      pthread_cond_broadcast(&s->cond);
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  return rc;
+}
+
+/* ---------------------------------------------------------------- reading */
+
+/*
+  Copy the record e points at into a new buffer and check it; lock held.
+  Returns the buffer, or NULL with errno set (EBADMSG if corrupt).
+ */
+static char *ls_read(LogStoreObject *s, const struct ls_entry *e) {
+  struct ls_segment *seg = ls_segment(s, e->seg);
+  size_t len = LS_HEADER_SIZE + e->ksz + e->vsz;
+  struct ls_header h;
+  char *rec;
+
+  rec = malloc(len);
+  if (!rec) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (!seg) {
+    errno = EIO;
+  } else if (e->seg == s->active && e->off >= seg->size) {
+    memcpy(rec, s->wbuf + (e->off - seg->size), len);
+    return rec;
+  } else if (ls_pread(seg->fd, rec, len, e->off) == 0) {
+    ls_header_get(&h, rec);
+    if (h.ksz == e->ksz && h.vsz == e->vsz &&
+        h.crc == ls_crc(&h, rec + LS_HEADER_SIZE,
+                        rec + LS_HEADER_SIZE + h.ksz))
+      return rec;
+    errno = EBADMSG;
+  }
+  free(rec);
+  return NULL;
+}
+
+/* Remove segment files, first recording which in "drop"; returns 0 or -1. */
+static int ls_drop(LogStoreObject *s, const uint32_t *ids, size_t n) {
+  char name[32];
+  uint8_t *buf;
+  size_t i;
+  int fd, rc;
+
+  buf = malloc(n ? n * 4 : 1);
+  if (!buf) {
+    errno = ENOMEM;
+    return -1;
+  }
+  for (i = 0; i < n; ++i)
+    jk_put32(buf + i * 4, ids[i]);
+  fd = openat(s->dirfd, "drop.tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              0644);
+  if (fd < 0) {
+    free(buf);
+    return -1;
+  }
+  rc = ls_pwrite(fd, buf, n * 4, 0) < 0 || fdatasync(fd) < 0 ? -1 : 0;
+  free(buf);
+  if (rc < 0) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  if (renameat(s->dirfd, "drop.tmp", s->dirfd, "drop") < 0)
+    return -1;
+  fsync(s->dirfd);
+
+  for (i = 0; i < n; ++i) {
+    ls_name(name, ids[i], "data");
+    unlinkat(s->dirfd, name, 0);
+    ls_name(name, ids[i], "hint");
+    unlinkat(s->dirfd, name, 0);
+  }
+  fsync(s->dirfd);
+  unlinkat(s->dirfd, "drop", 0);
+  return 0;
+}
+
+/* Finish removing the files of an interrupted ls_drop(). */
+static int ls_drop_resume(LogStoreObject *s) {
+  uint8_t ids[4096];
+  ssize_t n;
+  int fd;
+
+  fd = openat(s->dirfd, "drop", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return errno == ENOENT ? 0 : -1;
+  while ((n = read(fd, ids, sizeof(ids))) > 0) {
+    size_t i;
+
+    for (i = 0; i < (size_t) n / 4; ++i) {
+      char name[32];
+
+      ls_name(name, jk_get32(ids + i * 4), "data");
+      unlinkat(s->dirfd, name, 0);
+      ls_name(name, jk_get32(ids + i * 4), "hint");
+      unlinkat(s->dirfd, name, 0);
+    }
+  }
+  close(fd);
+  if (n < 0)
+    return -1;
+  fsync(s->dirfd);
+  return unlinkat(s->dirfd, "drop", 0);
+}
+
+/* ---------------------------------------------------------------- loading */
+
+/*
+  Merge one record into the keydir being loaded; newest seq wins.  key may
+  be NULL (a hint); it is then read from fd if another entry has hash h.
+ */
+static int ls_load_entry(LogStoreObject *s, uint64_t h, const char *key,
+                         int fd, uint64_t seq, uint32_t seg, uint64_t off,
+                         uint32_t ksz, uint32_t vsz, uint32_t flags) {
+  struct ls_entry *e;
+  char *buf = NULL;
+
+  if (!key && ls_has_hash(s, h)) {
+    buf = malloc(ksz ? ksz : 1);
+    if (!buf) {
+      errno = ENOMEM;
+      return -1;
+    }
+    if (ls_pread(fd, buf, ksz, off + LS_HEADER_SIZE) < 0) {
+      free(buf);
+      return -1;
+    }
+    key = buf;
+  }
+  e = ls_insert(s, h, key, ksz);
+  free(buf);
+  if (!e)
+    return -1;
+  if (e->seg && e->seq > seq)
+    return 0;
+  e->seq = seq;
+  e->seg = seg;
+  e->off = off;
+  e->ksz = ksz;
+  e->vsz = vsz;
+  e->flags = flags;
+  if (seq >= s->next_seq)
+    s->next_seq = seq + 1;
+  return 0;
+}
+
+static int ls_load_hints(LogStoreObject *s, uint32_t id, int data_fd) {
+  uint8_t hints[1024 * LS_HINT_SIZE];
+  struct ls_hint hint;
+  char name[32];
+  ssize_t n;
+  int fd, i;
+
+  ls_name(name, id, "hint");
+  fd = openat(s->dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 1;
+  while ((n = read(fd, hints, sizeof(hints))) > 0) {
+    if (n % LS_HINT_SIZE) {
+      close(fd);
+      return 1;
+    }
+    for (i = 0; i < (int) (n / LS_HINT_SIZE); ++i) {
+      ls_hint_get(&hint, hints + i * LS_HINT_SIZE);
+      if (ls_load_entry(s, hint.h, NULL, data_fd, hint.seq, id, hint.off,
+                        hint.ksz, hint.vsz, 0) < 0) {
+        close(fd);
+        return -1;
+      }
+    }
+  }
+  close(fd);
+  return n < 0 ? 1 : 0;
+}
+
+/* Scan a data file; returns the size of its valid prefix, or -1. */
+static int64_t ls_load_data(LogStoreObject *s, uint32_t id, int fd) {
+  struct stat st;
+  const char *map;
+  uint64_t off = 0;
+
+  if (fstat(fd, &st) < 0)
+    return -1;
+  if (st.st_size == 0)
+    return 0;
+  map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  madvise((void *) map, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+  while (off + LS_HEADER_SIZE <= (uint64_t) st.st_size) {
+    struct ls_header h;
+    const char *key;
+
+    ls_header_get(&h, map + off);
+    if (off + LS_HEADER_SIZE + h.ksz + h.vsz > (uint64_t) st.st_size)
+      break;
+    key = map + off + LS_HEADER_SIZE;
+    if (h.crc != ls_crc(&h, key, key + h.ksz))
+      break;
+    if (ls_load_entry(s, hll_hash(key, h.ksz), key, fd, h.seq, id, off,
+                      h.ksz, h.vsz, h.flags & LS_TOMBSTONE) < 0) {
+      int err = errno;
+
+      munmap((void *) map, (size_t) st.st_size);
+      errno = err;
+      return -1;
+    }
+    off += LS_HEADER_SIZE + h.ksz + h.vsz;
+  }
+  munmap((void *) map, (size_t) st.st_size);
+  return (int64_t) off;
+}
+
+static int ls_id_cmp(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Open every segment in the directory and build the keydir. */
+static int ls_load(LogStoreObject *s) {
+  uint32_t *ids = NULL, max_id = 0;
+  size_t nids = 0, cap = 0, i;
+  struct dirent *d;
+  DIR *dir;
+  int dfd;
+
+  if (ls_drop_resume(s) < 0)
+    return -1;
+  dfd = dup(s->dirfd);
+  if (dfd < 0)
+    return -1;
+  dir = fdopendir(dfd);
+  if (!dir) {
+    close(dfd);
+    return -1;
+  }
+  while ((d = readdir(dir)) != NULL) {
+    char *end;
+    unsigned long id = strtoul(d->d_name, &end, 10);
+
+    if (end == d->d_name || strcmp(end, ".data") != 0 || id == 0 ||
+        id > UINT32_MAX - 1)
+      continue;
+    if (nids == cap) {
+      uint32_t *grown;
+
+      cap = cap ? cap * 2 : 64;
+      grown = realloc(ids, cap * sizeof(*ids));
+      if (!grown) {
+        free(ids);
+        closedir(dir);
+        errno = ENOMEM;
+        return -1;
+      }
+      ids = grown;
+    }
+    ids[nids++] = (uint32_t) id;
+  }
+  closedir(dir);
+  qsort(ids, nids, sizeof(*ids), ls_id_cmp);
+
+  for (i = 0; i < nids; ++i) {
+    char name[32];
+    int64_t size;
+    int fd, rc;
+
+    ls_name(name, ids[i], "data");
+    fd = openat(s->dirfd, name, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+      goto fail;
+    /* added first, so that keys can be compared with its own records;
+       from here on the fd is closed with the other segments */
+    if (ls_segment_add(s, ids[i], fd, 0) < 0) {
+      close(fd);
+      goto fail;
+    }
+    rc = ls_load_hints(s, ids[i], fd);
+    if (rc < 0)
+      goto fail;
+    if (rc == 0) {
+      struct stat st;
+
+      if (fstat(fd, &st) < 0)
+        goto fail;
+      size = st.st_size;
+    } else {
+      size = ls_load_data(s, ids[i], fd);
+      if (size < 0)
+        goto fail;
+      /* a torn record at the end of the newest segment is an unfinished
+         write; anything after it in an older one is left alone */
+      if (i == nids - 1 && ftruncate(fd, (off_t) size) < 0)
+        goto fail;
+    }
+    ls_segment(s, ids[i])->size = (uint64_t) size;
+    max_id = ids[i];
+  }
+  free(ids);
+
+  /* drop deleted keys, which were only kept to outrank older records */
+  if (ls_keydir_alloc(s, s->mask + 1, 1) < 0)
+    return -1;
+  s->next_id = max_id + 1;
+  return 0;
+
+fail:
+  free(ids);
+  return -1;
+}
+
+/* ------------------------------------------------------------- compaction */
+
+struct ls_move {
+  uint64_t h, from_off, to_off;
+  uint32_t from_seg;
+};
+
+struct ls_output {
+  uint32_t id;
+  int fd;
+  uint64_t size;
+  char *buf;
+  size_t len;
+  uint8_t *hints;            /* n encoded entries */
+  struct ls_move *moves;
+  size_t n, cap;
+};
+
+static int ls_output_open(LogStoreObject *s, struct ls_output *o) {
+  pthread_mutex_lock(&s->lock);
+  o->id = s->next_id++;
+  pthread_mutex_unlock(&s->lock);
+  o->fd = ls_create(s, o->id, "data");
+  o->size = 0;
+  o->len = 0;
+  o->n = 0;
+  return o->fd < 0 ? -1 : 0;
+}
+
+/* Write out, sync and install an output segment and its hints. */
+static int ls_output_close(LogStoreObject *s, struct ls_output *o) {
+  char tmp[48], name[32];
+  size_t i;
+  int fd;
+
+  if (o->len && ls_pwrite(o->fd, o->buf, o->len, o->size) < 0)
+    return -1;
+  o->size += o->len;
+  o->len = 0;
+  if (fdatasync(o->fd) < 0)
+    return -1;
+
+  ls_name(name, o->id, "hint");
+  snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+  fd = openat(s->dirfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+  if (ls_pwrite(fd, o->hints, o->n * LS_HINT_SIZE, 0) < 0 ||
+      fdatasync(fd) < 0) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  if (renameat(s->dirfd, tmp, s->dirfd, name) < 0)
+    return -1;
+  fsync(s->dirfd);
+
+  /* point keys at the copies unless they were rewritten meanwhile */
+  pthread_mutex_lock(&s->lock);
+  if (ls_segment_add(s, o->id, o->fd, o->size) < 0) {
+    pthread_mutex_unlock(&s->lock);
+    return -1;
+  }
+  for (i = 0; i < o->n; ++i) {
+    struct ls_entry *e = ls_find_at(s, o->moves[i].h, o->moves[i].from_seg,
+                                    o->moves[i].from_off);
+    if (e) {
+      e->seg = o->id;
+      e->off = o->moves[i].to_off;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  o->fd = -1;
+  return 0;
+}
+
+/* Copy one live record to the output. */
+static int ls_output_add(LogStoreObject *s, struct ls_output *o,
+                         const char *rec, size_t len, uint64_t h,
+                         uint32_t from_seg, uint64_t from_off) {
+  struct ls_header hdr;
+  struct ls_hint hint;
+
+  if (o->size + o->len > 0 && o->size + o->len + len > s->segment_size) {
+    if (ls_output_close(s, o) < 0 || ls_output_open(s, o) < 0)
+      return -1;
+  }
+  if (o->len + len > LS_BUFFER_SIZE) {
+    if (ls_pwrite(o->fd, o->buf, o->len, o->size) < 0)
+      return -1;
+    o->size += o->len;
+    o->len = 0;
+  }
+  if (o->n == o->cap) {
+    size_t cap = o->cap ? o->cap * 2 : 4096;
+    uint8_t *hints = realloc(o->hints, cap * LS_HINT_SIZE);
+    struct ls_move *moves;
+
+    if (!hints)
+      return -1;
+    o->hints = hints;
+    moves = realloc(o->moves, cap * sizeof(*moves));
+    if (!moves)
+      return -1;
+    o->moves = moves;
+    o->cap = cap;
+  }
+  ls_header_get(&hdr, rec);
+  hint.h = h;
+  hint.seq = hdr.seq;
+  hint.off = o->size + o->len;
+  hint.ksz = hdr.ksz;
+  hint.vsz = hdr.vsz;
+  ls_hint_put(o->hints + o->n * LS_HINT_SIZE, &hint);
+  o->moves[o->n].h = h;
+  o->moves[o->n].from_seg = from_seg;
+  o->moves[o->n].from_off = from_off;
+  o->moves[o->n].to_off = o->size + o->len;
+  ++o->n;
+
+  if (len > LS_BUFFER_SIZE) {
+    if (ls_pwrite(o->fd, rec, len, o->size) < 0)
+      return -1;
+    o->size += len;
+    return 0;
+  }
+  memcpy(o->buf + o->len, rec, len);
+  o->len += len;
+  return 0;
+}
+
+/* Copy the live records of one closed segment. */
+static int ls_compact_segment(LogStoreObject *s, struct ls_output *o,
+                              uint32_t id, int fd, uint64_t size) {
+  const char *map;
+  uint64_t off = 0;
+  int rc = 0;
+
+  if (size == 0)
+    return 0;
+  map = mmap(NULL, (size_t) size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  madvise((void *) map, (size_t) size, MADV_SEQUENTIAL);
+
+  while (off + LS_HEADER_SIZE <= size && rc == 0) {
+    struct ls_header h;
+    const char *key = map + off + LS_HEADER_SIZE;
+    size_t len;
+    uint64_t hash;
+    int live;
+
+    ls_header_get(&h, map + off);
+    len = LS_HEADER_SIZE + h.ksz + h.vsz;
+    if (off + len > size || h.crc != ls_crc(&h, key, key + h.ksz))
+      break;
+    if (!(h.flags & LS_TOMBSTONE)) {
+      hash = hll_hash(key, h.ksz);
+      pthread_mutex_lock(&s->lock);
+      live = ls_find_at(s, hash, id, off) != NULL;
+      pthread_mutex_unlock(&s->lock);
+      if (live)
+        rc = ls_output_add(s, o, map + off, len, hash, id, off);
+    }
+    off += len;
+  }
+  munmap((void *) map, (size_t) size);
+  return rc;
+}
+
+static void *ls_compact_main(void *p) {
+  LogStoreObject *s = (LogStoreObject *) p;
+  struct ls_output o;
+  struct ls_segment *inputs;
+  uint32_t *ids = NULL;
+  size_t ninputs = 0, i;
+  char name[32];
+  int err = 0;
+
+  memset(&o, 0, sizeof(o));
+  o.fd = -1;
+
+  /* everything but the active segment, which is rotated first */
+  pthread_mutex_lock(&s->lock);
+  if (ls_segment(s, s->active)->size + s->wlen > 0 && ls_rotate(s) < 0)
+    err = errno;
+  inputs = malloc((s->nsegs ? s->nsegs : 1) * sizeof(*inputs));
+  if (!inputs && !err)
+    err = ENOMEM;
+  if (!err)
+    for (i = 0; i < s->nsegs; ++i)
+      if (s->segs[i].id != s->active)
+        inputs[ninputs++] = s->segs[i];
+  pthread_mutex_unlock(&s->lock);
+
+  o.buf = malloc(LS_BUFFER_SIZE);
+  if (!err && !o.buf)
+    err = ENOMEM;
+  if (!err && ninputs && ls_output_open(s, &o) < 0)
+    err = errno;
+  for (i = 0; i < ninputs && !err; ++i)
+    if (ls_compact_segment(s, &o, inputs[i].id, inputs[i].fd,
+                           inputs[i].size) < 0)
+      err = errno ? errno : EIO;
+  if (!err && o.fd >= 0 && o.n == 0 && o.len == 0) {
+    /* nothing was live */
+    close(o.fd);
+    o.fd = -1;
+    ls_name(name, o.id, "data");
+    unlinkat(s->dirfd, name, 0);
+  } else if (!err && o.fd >= 0 && ls_output_close(s, &o) < 0)
+    err = errno;
+
+  if (!err && ninputs) {
+    ids = malloc(ninputs * sizeof(*ids));
+    if (!ids)
+      err = ENOMEM;
+  }
+  if (!err) {
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < ninputs; ++i) {
+      ids[i] = inputs[i].id;
+      ls_segment_remove(s, inputs[i].id);
+    }
+    pthread_mutex_unlock(&s->lock);
+    for (i = 0; i < ninputs; ++i)
+      close(inputs[i].fd);
+    if (ninputs && ls_drop(s, ids, ninputs) < 0)
+      err = errno;
+  } else if (o.fd >= 0) {
+    /* an unfinished output holds only copies; drop it */
+    close(o.fd);
+    ls_name(name, o.id, "data");
+    unlinkat(s->dirfd, name, 0);
+  }
+
+  free(ids);
+  free(inputs);
+  free(o.buf);
+  free(o.hints);
+  free(o.moves);
+
+  pthread_mutex_lock(&s->lock);
+  s->compact_err = err;
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+/*
+  Wait for a running compaction; returns its errno or 0.  Called with
+  compact_lock held and without the GIL.
+*/
+static int ls_compact_wait(LogStoreObject *s) {
+  int err;
+
+  if (!s->compacting)
+    return 0;
+  pthread_join(s->compactor, NULL);
+  s->compacting = 0;
+  err = s->compact_err;
+  s->compact_err = 0;
+  return err;
+}
+
+/* --------------------------------------------------------------- methods */
+
+static int ls_check_open(LogStoreObject *s) {
+  if (s->closed) {
+    PyErr_SetString(PyExc_ValueError, "I/O operation on closed LogStore");
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject* ls_error(LogStoreObject *s) {
+  if (errno == ENOMEM)
+    return PyErr_NoMemory();
+  if (errno == EBADMSG) {
+    PyErr_SetString(PyExc_ValueError, "LogStore record failed its checksum");
+    return NULL;
+  }
+  return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, s->path);
+}
+
+static char logstore_get_doc[] = "get(key[, default]) -- Returns the value stored for key, or default (None) if there is none.";
+
+static PyObject* logstore_get(LogStoreObject *self, PyObject *args) {
+  PyObject *dflt = Py_None, *result;
+  Py_buffer key;
+  struct ls_entry e;
+  char *rec = NULL;
+  int closed, missing = 1;
+
+  if (!PyArg_ParseTuple(args, "s*|O", &key, &dflt))
+    return NULL;
+  if (ls_check_open(self) < 0) {
+    PyBuffer_Release(&key);
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  closed = self->closed;
+  if (!closed) {
+    uint64_t h = hll_hash(key.buf, (size_t) key.len), i;
+
+    /* entries of the same hash and size, until one's record has the key */
+    for (i = h & self->mask; self->keydir[i].seg; i = (i + 1) & self->mask) {
+      if (self->keydir[i].h != h || self->keydir[i].ksz != (size_t) key.len)
+        continue;
+      e = self->keydir[i];
+      rec = ls_read(self, &e);
+      if (!rec || memcmp(rec + LS_HEADER_SIZE, key.buf,
+                         e.ksz) == 0) {
+        missing = 0;
+        break;
+      }
+      free(rec);
+      rec = NULL;
+    }
+  }
+  pthread_mutex_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+
+  /* closed by another thread while this one waited for the lock */
+  if (closed) {
+    PyBuffer_Release(&key);
+    ls_check_open(self);
+    return NULL;
+  }
+  if (!missing && !rec) {
+    PyBuffer_Release(&key);
+    return ls_error(self);
+  }
+  PyBuffer_Release(&key);
+  if (missing) {
+    free(rec);
+    Py_INCREF(dflt);
+    return dflt;
+  }
+  result = PyBytes_FromStringAndSize(rec + LS_HEADER_SIZE + e.ksz,
+                                     e.vsz);
+  free(rec);
+  return result;
+}
+
+static char logstore_put_doc[] = "put(key, value) -- Stores value under key. The record is buffered; call commit() to make it durable.";
+
+static PyObject* logstore_put(LogStoreObject *self, PyObject *args) {
+  Py_buffer key, value;
+  int closed, rc = 0;
+
+  if (!PyArg_ParseTuple(args, "s*s*", &key, &value))
+    return NULL;
+  if (ls_check_open(self) < 0) {
+    PyBuffer_Release(&key);
+    PyBuffer_Release(&value);
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  closed = self->closed;
+  if (!closed)
+    rc = ls_append(self, key.buf, (size_t) key.len, value.buf,
+                   (size_t) value.len, 0);
+  pthread_mutex_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&key);
+  PyBuffer_Release(&value);
+  if (closed) {
+    ls_check_open(self);
+    return NULL;
+  }
+  if (rc < 0)
+    return ls_error(self);
+  Py_RETURN_NONE;
+}
+
+static char logstore_put_many_doc[] = "put_many(items) -- Stores each (key, value) pair of an iterable, as put() does. The pairs are collected first and stored under one lock, so they land next to each other in the log.";
+
+static PyObject* logstore_put_many(LogStoreObject *self, PyObject *args) {
+  PyObject *items, *seq;
+  Py_buffer *bufs;
+  Py_ssize_t n, i, parsed;
+  int closed = 0, rc = 0;
+
+  if (!PyArg_ParseTuple(args, "O", &items))
+    return NULL;
+  if (ls_check_open(self) < 0)
+    return NULL;
+  seq = PySequence_Fast(items, "put_many() takes an iterable of (key, "
+                        "value) pairs");
+  if (!seq)
+    return NULL;
+  n = PySequence_Fast_GET_SIZE(seq);
+  bufs = malloc((size_t) (n ? n : 1) * 2 * sizeof(Py_buffer));
+  if (!bufs) {
+    Py_DECREF(seq);
+    return PyErr_NoMemory();
+  }
+  for (parsed = 0; parsed < n; ++parsed) {
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, parsed);
+
+    if (!PyTuple_Check(item)) {
+      PyErr_SetString(PyExc_TypeError,
+                      "put_many() items must be (key, value) pairs");
+      break;
+    }
+    if (!PyArg_ParseTuple(item, "s*s*;put_many() items must be (key, value) "
+                          "pairs", &bufs[2 * parsed], &bufs[2 * parsed + 1]))
+      break;
+  }
+
+  /* the whole batch under one lock, without the GIL: an append can
+     write out the buffer or rotate the segment */
+  if (parsed == n) {
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    closed = self->closed;
+    for (i = 0; i < n && !closed && rc == 0; ++i)
+      rc = ls_append(self, bufs[2 * i].buf, (size_t) bufs[2 * i].len,
+                     bufs[2 * i + 1].buf, (size_t) bufs[2 * i + 1].len, 0);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+  }
+
+  for (i = 0; i < parsed; ++i) {
+    PyBuffer_Release(&bufs[2 * i]);
+    PyBuffer_Release(&bufs[2 * i + 1]);
+  }
+  free(bufs);
+  Py_DECREF(seq);
+  if (parsed < n)
+    return NULL;
+  if (closed) {
+    ls_check_open(self);
+    return NULL;
+  }
+  if (rc < 0)
+    return ls_error(self);
+  Py_RETURN_NONE;
+}
+
+static char logstore_delete_doc[] = "delete(key) -- Removes key. Returns True if it was present.";
+
+static PyObject* logstore_delete(LogStoreObject *self, PyObject *args) {
+  Py_buffer key;
+  struct ls_entry *e;
+  int closed, present = 0, rc = 0;
+
+  if (!PyArg_ParseTuple(args, "s*", &key))
+    return NULL;
+  if (ls_check_open(self) < 0) {
+    PyBuffer_Release(&key);
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  closed = self->closed;
+  if (!closed) {
+    e = ls_find(self, hll_hash(key.buf, (size_t) key.len), key.buf,
+                (size_t) key.len);
+    if (!e)
+      rc = -1;
+    else
+      present = e->seg != 0;
+    if (present)
+      rc = ls_append(self, key.buf, (size_t) key.len, "", 0, LS_TOMBSTONE);
+  }
+  pthread_mutex_unlock(&self->lock);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&key);
+  if (closed) {
+    ls_check_open(self);
+    return NULL;
+  }
+  if (rc < 0)
+    return ls_error(self);
+  return PyBool_FromLong(present);
+}
+
+static char logstore_commit_doc[] = "commit() -- Writes out buffered records and waits until everything stored so far is on disk. Concurrent commits from several threads share one fdatasync().";
+
+static PyObject* logstore_commit(LogStoreObject *self) {
+  int rc;
+
+  if (ls_check_open(self) < 0)
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  rc = ls_commit(self);
+  Py_END_ALLOW_THREADS
+  if (rc < 0 && self->closed) {
+    ls_check_open(self);
+    return NULL;
+  }
+  if (rc < 0)
+    return ls_error(self);
+  Py_RETURN_NONE;
+}
+
+static char logstore_compact_doc[] = "compact(wait=False) -- Starts rewriting every segment but the active one without the records that have been overwritten or deleted, on a background thread. With wait=True, returns when it is done. Raises OSError if a previous compaction failed.";
+
+static PyObject* logstore_compact(LogStoreObject *self, PyObject *args,
+                                  PyObject *kwds) {
+  static char *kwlist[] = {"wait", NULL};
+  PyObject *wait_obj = Py_False;
+  int wait, closed, err = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &wait_obj))
+    return NULL;
+  if (ls_check_open(self) < 0)
+    return NULL;
+  wait = PyObject_IsTrue(wait_obj);
+  if (wait < 0)
+    return NULL;
+
+  /* one thread at a time starts, joins or replaces the compactor */
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->compact_lock);
+  closed = self->closed;
+  if (!closed)
+    err = ls_compact_wait(self);
+  if (!closed && !err) {
+    if (pthread_create(&self->compactor, NULL, ls_compact_main, self) != 0)
+      err = EAGAIN;
+    else {
+      self->compacting = 1;
+      if (wait)
+        err = ls_compact_wait(self);
+    }
+  }
+  pthread_mutex_unlock(&self->compact_lock);
+  Py_END_ALLOW_THREADS
+
+  if (closed) {
+    ls_check_open(self);
+    return NULL;
+  }
+  if (err) {
+    errno = err;
+    return ls_error(self);
+  }
+  Py_RETURN_NONE;
+}
+
+static void ls_close(LogStoreObject *s) {
+  struct ls_segment *seg;
+  size_t i;
+
+  pthread_mutex_lock(&s->lock);
+  seg = ls_segment(s, s->active);
+  if (seg && seg->size == 0 && s->wlen == 0) {
+    char name[32];
+
+    /* nothing was written this session */
+    ls_name(name, s->active, "data");
+    unlinkat(s->dirfd, name, 0);
+  }
+  for (i = 0; i < s->nsegs; ++i)
+    close(s->segs[i].fd);
+  s->nsegs = 0;
+  if (s->dirfd >= 0)
+    close(s->dirfd);
+  s->dirfd = -1;
+  jk_unmap(&s->mem, s->keydir, s->keydir_size);
+  s->keydir = NULL;
+  s->closed = 1;
+  /* wake committers waiting for a sync that will not come */
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static char logstore_close_doc[] = "close() -- Waits for a running compaction, commits and closes the store.";
+
+static PyObject* logstore_close(LogStoreObject *self) {
+  int err = 0, rc;
+
+  if (self->closed)
+    Py_RETURN_NONE;
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->compact_lock);
+  if (!self->closed) {
+    err = ls_compact_wait(self);
+    rc = ls_commit(self);
+    if (rc < 0 && !err)
+      err = errno;
+    ls_close(self);
+  }
+  pthread_mutex_unlock(&self->compact_lock);
+  Py_END_ALLOW_THREADS
+  if (err) {
+    errno = err;
+    return ls_error(self);
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject* logstore_enter(LogStoreObject *self) {
+  if (ls_check_open(self) < 0)
+    return NULL;
+  Py_INCREF(self);
+  return (PyObject *) self;
+}
+
+static PyObject* logstore_exit(LogStoreObject *self, PyObject *args) {
+  return logstore_close(self);
+}
+
+static Py_ssize_t logstore_len(LogStoreObject *self) {
+  if (ls_check_open(self) < 0)
+    return -1;
+  return (Py_ssize_t) self->count;
+}
+
+static int logstore_contains(LogStoreObject *self, PyObject *key) {
+  PyObject *args, *r;
+  int found;
+
+  args = PyTuple_Pack(2, key, Py_None);
+  if (!args)
+    return -1;
+  r = logstore_get(self, args);
+  Py_DECREF(args);
+  if (!r)
+    return -1;
+  found = r != Py_None;
+  Py_DECREF(r);
+  return found;
+}
+
+static PyObject* logstore_get_memory(LogStoreObject *self, void *closure) {
+  return jk_memory_dict(&self->mem);
+}
+
+static PyObject* logstore_get_segments(LogStoreObject *self, void *closure) {
+  PyObject *list;
+  size_t i;
+
+  pthread_mutex_lock(&self->lock);
+  list = PyList_New((Py_ssize_t) self->nsegs);
+  for (i = 0; list && i < self->nsegs; ++i) {
+    PyObject *item = Py_BuildValue("(IK)", self->segs[i].id,
+                                   (unsigned long long) self->segs[i].size);
+    if (!item) {
+      Py_CLEAR(list);
+      break;
+    }
+    PyList_SET_ITEM(list, (Py_ssize_t) i, item);
+  }
+  pthread_mutex_unlock(&self->lock);
+  return list;
+}
+
+static int logstore_init(LogStoreObject *self, PyObject *args,
+                         PyObject *kwds) {
+  static char *kwlist[] = {"path", "segment_size", "buffer_size",
+                           "huge_pages", NULL};
+  unsigned long long segment_size = LS_SEGMENT_SIZE;
+  Py_ssize_t buffer_size = (Py_ssize_t) LS_BUFFER_SIZE;
+  PyObject *path, *huge_pages = Py_None;
+  int fd;
+
+#if PY_MAJOR_VERSION >= 3
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|KnO", kwlist,
+                                   PyUnicode_FSConverter, &path,
+                                   &segment_size, &buffer_size, &huge_pages))
+    return -1;
+#else
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "S|KnO", kwlist, &path,
+                                   &segment_size, &buffer_size, &huge_pages))
+    return -1;
+  Py_INCREF(path);
+#endif
+  if (self->path) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_RuntimeError, "LogStore already initialized");
+    return -1;
+  }
+  self->path = path;
+  if (buffer_size < 4096) {
+    PyErr_SetString(PyExc_ValueError, "buffer_size must be at least 4096");
+    return -1;
+  }
+
+  self->segment_size = segment_size;
+  self->buffer_size = (size_t) buffer_size;
+  self->wcap = self->buffer_size;
+  self->wbuf = malloc(self->wcap);
+  if (!self->wbuf) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  if (jk_memory_init(&self->mem, "LogStore", huge_pages, Py_None) < 0)
+    return -1;
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_mutex_init(&self->compact_lock, NULL);
+  pthread_cond_init(&self->cond, NULL);
+  self->next_seq = 1;
+  self->next_id = 1;
+
+  if (mkdir(PyBytes_AS_STRING(path), 0755) < 0 && errno != EEXIST)
+    goto fail;
+  self->dirfd = open(PyBytes_AS_STRING(path),
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (self->dirfd < 0)
+    goto fail;
+  if (ls_keydir_alloc(self, LS_MIN_KEYDIR, 0) < 0 || ls_load(self) < 0)
+    goto fail;
+
+  self->active = self->next_id++;
+  fd = ls_create(self, self->active, "data");
+  if (fd < 0 || ls_segment_add(self, self->active, fd, 0) < 0)
+    goto fail;
+  fsync(self->dirfd);
+  return 0;
+
+fail:
+  ls_error(self);
+  ls_close(self);
+  return -1;
+}
+
+static PyObject* logstore_new(PyTypeObject *type, PyObject *args,
+                              PyObject *kwds) {
+  LogStoreObject *self = (LogStoreObject *) type->tp_alloc(type, 0);
+
+  if (self)
+    self->dirfd = -1;
+  return (PyObject *) self;
+}
+
+static void logstore_dealloc(LogStoreObject *self) {
+  if (self->mem.owner) {
+    if (!self->closed) {
+      PyObject *r;
+
+      r = logstore_close(self);
+      if (!r)
+        PyErr_WriteUnraisable((PyObject *) self);
+      Py_XDECREF(r);
+    }
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->compact_lock);
+    pthread_mutex_destroy(&self->lock);
+    jk_memory_free(&self->mem);
+  }
+  free(self->segs);
+  free(self->wbuf);
+  Py_XDECREF(self->path);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef logstore_methods[] = {
+  {"get",       (PyCFunction) logstore_get,      METH_VARARGS,
+   logstore_get_doc},
+  {"put",       (PyCFunction) logstore_put,      METH_VARARGS,
+   logstore_put_doc},
+  {"put_many",  (PyCFunction) logstore_put_many, METH_VARARGS,
+   logstore_put_many_doc},
+  {"delete",    (PyCFunction) logstore_delete,   METH_VARARGS,
+   logstore_delete_doc},
+  {"commit",    (PyCFunction) logstore_commit,   METH_NOARGS,
+   logstore_commit_doc},
+  {"compact",   (PyCFunction) logstore_compact,
+   METH_VARARGS | METH_KEYWORDS, logstore_compact_doc},
+  {"close",     (PyCFunction) logstore_close,    METH_NOARGS,
+   logstore_close_doc},
+  {"__enter__", (PyCFunction) logstore_enter,    METH_NOARGS, NULL},
+  {"__exit__",  (PyCFunction) logstore_exit,     METH_VARARGS, NULL},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef logstore_getset[] = {
+  {"memory",   (getter) logstore_get_memory,   NULL,
+   "The keydir's entry in memory_usage().", NULL},
+  {"segments", (getter) logstore_get_segments, NULL,
+   "(id, bytes) of each segment file, oldest first.", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PySequenceMethods logstore_as_sequence = {
+  (lenfunc) logstore_len,         /* sq_length */
+  0,                              /* sq_concat */
+  0,                              /* sq_repeat */
+  0,                              /* sq_item */
+  0,                              /* sq_slice */
+  0,                              /* sq_ass_item */
+  0,                              /* sq_ass_slice */
+  (objobjproc) logstore_contains, /* sq_contains */
+};
+
+static char logstore_type_doc[] = "LogStore(path, segment_size=64MB, buffer_size=1MB, huge_pages=None) -- Persistent key-value store in the directory path: an append-only log of checksummed records with an in-memory index of key hashes. Keys and values are bytes.";
+
+static PyTypeObject LogStoreType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.LogStore",             /* tp_name */
+  sizeof(LogStoreObject),         /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) logstore_dealloc,  /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  &logstore_as_sequence,          /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  logstore_type_doc,              /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  logstore_methods,               /* tp_methods */
+  0,                              /* tp_members */
+  logstore_getset,                /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) logstore_init,       /* tp_init */
+  0,                              /* tp_alloc */
+  logstore_new,                   /* tp_new */
+};
@@ -33,8 +33,6 @@ mixing with 12*3 instructions on 3 integers than you can with 3 instructions
 on 1 byte), but shoehorning those bytes into integers efficiently is messy.
 -------------------------------------------------------------------------------
 */
-#define SELF_TEST 1
-
 #include <stdio.h>      /* defines printf for tests */
 #include <time.h>       /* defines time_t for timings in the test */
 #include <stdint.h>     /* defines uint32_t etc */
@@ -766,7 +764,7 @@ uint32_t hashbig( const void *key, size_t length, uint32_t initval)
 
 #ifdef SELF_TEST
 
-/* used for timings */
+/* smoke test only; bench/bench_lookup3.c does the real timings */
 void driver1()
 {
   uint8_t buf[256];
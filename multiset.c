@@ -0,0 +1,411 @@
+/*
+  MultisetHash: an order-independent hash of a multiset of keys that can
+  be updated one key at a time.
+
+  Each key hashes to 128 bits, two hashlittle2() runs with different
+  seeds, and the multiset hashes to the sum of its keys' hashes modulo
+  2^128 together with the number of keys.  Adding or removing a key is
+  one addition or subtraction, the hash of a union is the sum of the two
+  hashes, and equal multisets always have equal hashes however they were
+  built.  Unlike XOR, the sum keeps a key added twice distinct from one
+  added zero times.
+
+  update() and subtract() hash batches of keys with the GIL released,
+  split across threads for large batches, each thread summing its own
+  range before the partial sums are added up.
+ */
+
+/* seeds of the high 64 bits; the low 64 bits are hll_hash() */
+#define MS_SEED_C 0x9e3779b9
+#define MS_SEED_B 0x7f4a7c15
+
+#define MS_DIGEST_SIZE 24
+
+struct ms_sum {
+  uint64_t lo, hi;
+};
+
+typedef struct {
+  PyObject_HEAD
+  struct ms_sum sum;
+  int64_t count;
+} MultisetHashObject;
+
+static PyTypeObject MultisetHashType;
+
+static void ms_hash(const void *key, size_t len, struct ms_sum *h) {
+  uint32_t pc = MS_SEED_C, pb = MS_SEED_B;
+
+  h->lo = hll_hash(key, len);
+  hashlittle2(key, len, &pc, &pb);
+  h->hi = pc + (((uint64_t) pb) << 32);
+}
+
+static void ms_add(struct ms_sum *s, const struct ms_sum *h) {
+  uint64_t lo = s->lo + h->lo;
+
+  s->hi += h->hi + (lo < s->lo);
+  s->lo = lo;
+}
+
+static void ms_sub(struct ms_sum *s, const struct ms_sum *h) {
+  uint64_t lo = s->lo - h->lo;
+
+  s->hi -= h->hi + (lo > s->lo);
+  s->lo = lo;
+}
+
+struct ms_update {
+  struct jk_keys *keys;
+  struct ms_sum partial[JK_MAX_THREADS];
+};
+
+static void ms_update_hash(void *ctx, int t, int nt) {
+  struct ms_update *u = (struct ms_update *) ctx;
+  struct ms_sum sum = {0, 0}, h;
+  Py_ssize_t i, lo, hi;
+
+  jk_share(u->keys->n, t, nt, &lo, &hi);
+  for (i = lo; i < hi; ++i) {
+    ms_hash(u->keys->ptr[i], u->keys->len[i], &h);
+    ms_add(&sum, &h);
+  }
+  u->partial[t] = sum;
+}
+
+/* Sum of the hashes of a sequence of keys; returns its length or -1. */
+static Py_ssize_t ms_hash_keys(PyObject *keys_obj, int threads,
+                               struct ms_sum *sum) {
+  struct ms_update u;
+  struct jk_keys keys;
+  Py_ssize_t n;
+  int nt, t;
+
+  if (jk_keys_get(keys_obj, &keys) < 0)
+    return -1;
+  u.keys = &keys;
+  nt = jk_thread_count(keys.n, threads);
+  Py_BEGIN_ALLOW_THREADS
+  JK_ENTER_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  jk_parallel(nt, ms_update_hash, &u);
+  JK_EXIT_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  Py_END_ALLOW_THREADS
+
+  sum->lo = sum->hi = 0;
+  for (t = 0; t < nt; ++t)
+    ms_add(sum, &u.partial[t]);
+  n = keys.n;
+  jk_keys_release(&keys);
+  return n;
+}
+
+/* Apply keys, or another MultisetHash, to self with the given sign. */
+static PyObject* ms_apply(MultisetHashObject *self, PyObject *obj,
+                          int threads, int sign) {
+  struct ms_sum sum;
+  int64_t n;
+
+  if (PyObject_TypeCheck(obj, &MultisetHashType)) {
+    sum = ((MultisetHashObject *) obj)->sum;
+    n = ((MultisetHashObject *) obj)->count;
+  } else {
+    Py_ssize_t len = ms_hash_keys(obj, threads, &sum);
+
+    if (len < 0)
+      return NULL;
+    n = (int64_t) len;
+  }
+  if (sign > 0) {
+    ms_add(&self->sum, &sum);
+    self->count += n;
+  } else {
+    ms_sub(&self->sum, &sum);
+    self->count -= n;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject* ms_key(MultisetHashObject *self, PyObject *args, int sign) {
+  PyObject *key, *owned;
+  const char *ptr;
+  size_t len;
+  struct ms_sum h;
+
+  if (!PyArg_ParseTuple(args, "O", &key))
+    return NULL;
+  if (jk_key_bytes(key, &owned, &ptr, &len) < 0)
+    return NULL;
+  ms_hash(ptr, len, &h);
+  Py_XDECREF(owned);
+  if (sign > 0) {
+    ms_add(&self->sum, &h);
+    ++self->count;
+  } else {
+    ms_sub(&self->sum, &h);
+    --self->count;
+  }
+  Py_RETURN_NONE;
+}
+
+static char multisethash_add_doc[] = "add(key) -- Adds one occurrence of key, which is bytes, unicode (hashed as UTF-8) or a buffer.";
+
+static PyObject* multisethash_add(MultisetHashObject *self, PyObject *args) {
+  return ms_key(self, args, 1);
+}
+
+static char multisethash_remove_doc[] = "remove(key) -- Removes one occurrence of key. The key is not checked to be present: removing a key that was never added leaves a hash that matches no multiset.";
+
+static PyObject* multisethash_remove(MultisetHashObject *self,
+                                     PyObject *args) {
+  return ms_key(self, args, -1);
+}
+
+static char multisethash_update_doc[] = "update(keys[, threads]) -- Adds every key of a sequence, or every key counted by another MultisetHash. threads=0 picks a thread count from the number of CPUs; small batches always run on one thread.";
+
+static PyObject* multisethash_update(MultisetHashObject *self, PyObject *args,
+                                     PyObject *kwds) {
+  static char *kwlist[] = {"keys", "threads", NULL};
+  PyObject *keys;
+  int threads = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &keys,
+                                   &threads))
+    return NULL;
+  return ms_apply(self, keys, threads, 1);
+}
+
+static char multisethash_subtract_doc[] = "subtract(keys[, threads]) -- Removes every key of a sequence, or every key counted by another MultisetHash, once.";
+
+static PyObject* multisethash_subtract(MultisetHashObject *self,
+                                       PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"keys", "threads", NULL};
+  PyObject *keys;
+  int threads = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &keys,
+                                   &threads))
+    return NULL;
+  return ms_apply(self, keys, threads, -1);
+}
+
+static char multisethash_merge_doc[] = "merge(other) -- Adds the keys counted by another MultisetHash, in constant time.";
+
+static PyObject* multisethash_merge(MultisetHashObject *self,
+                                    PyObject *args) {
+  PyObject *other;
+
+  if (!PyArg_ParseTuple(args, "O!", &MultisetHashType, &other))
+    return NULL;
+  return ms_apply(self, other, 0, 1);
+}
+
+static char multisethash_copy_doc[] = "copy() -- Returns a new MultisetHash with the same contents.";
+
+static PyObject* multisethash_copy(MultisetHashObject *self) {
+  MultisetHashObject *copy;
+
+  copy = PyObject_New(MultisetHashObject, Py_TYPE(self));
+  if (!copy)
+    return NULL;
+  copy->sum = self->sum;
+  copy->count = self->count;
+  return (PyObject *) copy;
+}
+
+static char multisethash_clear_doc[] = "clear() -- Empties the multiset.";
+
+static PyObject* multisethash_clear(MultisetHashObject *self) {
+  self->sum.lo = self->sum.hi = 0;
+  self->count = 0;
+  Py_RETURN_NONE;
+}
+
+static void ms_digest(const MultisetHashObject *self, uint8_t *out) {
+  uint64_t words[3];
+  int i, j;
+
+  words[0] = self->sum.lo;
+  words[1] = self->sum.hi;
+  words[2] = (uint64_t) self->count;
+  for (i = 0; i < 3; ++i)
+    for (j = 0; j < 8; ++j)
+      out[i * 8 + j] = (uint8_t) (words[i] >> (8 * j));
+}
+
+static char multisethash_digest_doc[] = "digest() -- Returns the hash as 24 bytes: the 128-bit sum and the 64-bit key count, little-endian. MultisetHash(digest=...) restores it.";
+
+static PyObject* multisethash_digest(MultisetHashObject *self) {
+  uint8_t out[MS_DIGEST_SIZE];
+
+  ms_digest(self, out);
+  return PyBytes_FromStringAndSize((const char *) out, MS_DIGEST_SIZE);
+}
+
+static char multisethash_hexdigest_doc[] = "hexdigest() -- Returns digest() as a string of hexadecimal digits.";
+
+static PyObject* multisethash_hexdigest(MultisetHashObject *self) {
+  static const char hex[] = "0123456789abcdef";
+  uint8_t out[MS_DIGEST_SIZE];
+  char text[2 * MS_DIGEST_SIZE];
+  int i;
+
+  ms_digest(self, out);
+  for (i = 0; i < MS_DIGEST_SIZE; ++i) {
+    text[2 * i] = hex[out[i] >> 4];
+    text[2 * i + 1] = hex[out[i] & 15];
+  }
+#if PY_MAJOR_VERSION >= 3
+  return PyUnicode_FromStringAndSize(text, 2 * MS_DIGEST_SIZE);
+#else
+  return PyString_FromStringAndSize(text, 2 * MS_DIGEST_SIZE);
+#endif
+}
+
+static PyObject* multisethash_get_count(MultisetHashObject *self,
+                                        void *closure) {
+  return PyLong_FromLongLong((long long) self->count);
+}
+
+static Py_ssize_t multisethash_len(MultisetHashObject *self) {
+  if (self->count < 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "more keys were removed than were added");
+    return -1;
+  }
+  return (Py_ssize_t) self->count;
+}
+
+static PyObject* multisethash_richcompare(PyObject *a, PyObject *b, int op) {
+  const MultisetHashObject *x, *y;
+  int equal;
+
+  if (!PyObject_TypeCheck(a, &MultisetHashType) ||
+      !PyObject_TypeCheck(b, &MultisetHashType) ||
+      (op != Py_EQ && op != Py_NE)) {
+    Py_INCREF(Py_NotImplemented);
+    return Py_NotImplemented;
+  }
+  x = (const MultisetHashObject *) a;
+  y = (const MultisetHashObject *) b;
+  equal = x->sum.lo == y->sum.lo && x->sum.hi == y->sum.hi &&
+          x->count == y->count;
+  return PyBool_FromLong(op == Py_EQ ? equal : !equal);
+}
+
+static int multisethash_init(MultisetHashObject *self, PyObject *args,
+                             PyObject *kwds) {
+  static char *kwlist[] = {"keys", "digest", "threads", NULL};
+  PyObject *keys = Py_None;
+  const uint8_t *digest = NULL;
+  Py_ssize_t digest_len = 0;
+  int threads = 0, i, j;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oz#i", kwlist, &keys,
+                                   &digest, &digest_len, &threads))
+    return -1;
+
+  self->sum.lo = self->sum.hi = 0;
+  self->count = 0;
+  if (digest) {
+    uint64_t words[3] = {0, 0, 0};
+
+    if (digest_len != MS_DIGEST_SIZE) {
+      PyErr_Format(PyExc_ValueError, "digest must be %d bytes",
+                   MS_DIGEST_SIZE);
+      return -1;
+    }
+    for (i = 0; i < 3; ++i)
+      for (j = 0; j < 8; ++j)
+        words[i] |= (uint64_t) digest[i * 8 + j] << (8 * j);
+    self->sum.lo = words[0];
+    self->sum.hi = words[1];
+    self->count = (int64_t) words[2];
+  }
+  if (keys != Py_None) {
+    PyObject *r = ms_apply(self, keys, threads, 1);
+
+    if (!r)
+      return -1;
+    Py_DECREF(r);
+  }
+  return 0;
+}
+
+static void multisethash_dealloc(MultisetHashObject *self) {
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef multisethash_methods[] = {
+  {"add",       (PyCFunction) multisethash_add,       METH_VARARGS,
+   multisethash_add_doc},
+  {"remove",    (PyCFunction) multisethash_remove,    METH_VARARGS,
+   multisethash_remove_doc},
+  {"update",    (PyCFunction) multisethash_update,
+   METH_VARARGS | METH_KEYWORDS, multisethash_update_doc},
+  {"subtract",  (PyCFunction) multisethash_subtract,
+   METH_VARARGS | METH_KEYWORDS, multisethash_subtract_doc},
+  {"merge",     (PyCFunction) multisethash_merge,     METH_VARARGS,
+   multisethash_merge_doc},
+  {"copy",      (PyCFunction) multisethash_copy,      METH_NOARGS,
+   multisethash_copy_doc},
+  {"clear",     (PyCFunction) multisethash_clear,     METH_NOARGS,
+   multisethash_clear_doc},
+  {"digest",    (PyCFunction) multisethash_digest,    METH_NOARGS,
+   multisethash_digest_doc},
+  {"hexdigest", (PyCFunction) multisethash_hexdigest, METH_NOARGS,
+   multisethash_hexdigest_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef multisethash_getset[] = {
+  {"count", (getter) multisethash_get_count, NULL,
+   "Keys added minus keys removed.", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PySequenceMethods multisethash_as_sequence = {
+  (lenfunc) multisethash_len,     /* sq_length */
+};
+
+static char multisethash_type_doc[] = "MultisetHash(keys=None, digest=None, threads=0) -- Order-independent 128-bit lookup3 hash of a multiset of keys, updated in constant time per key added or removed. Two MultisetHash objects compare equal when they hash the same multiset.";
+
+static PyTypeObject MultisetHashType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.MultisetHash",         /* tp_name */
+  sizeof(MultisetHashObject),     /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) multisethash_dealloc, /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  &multisethash_as_sequence,      /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  PyObject_HashNotImplemented,    /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  multisethash_type_doc,          /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  multisethash_richcompare,       /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  multisethash_methods,           /* tp_methods */
+  0,                              /* tp_members */
+  multisethash_getset,            /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) multisethash_init,   /* tp_init */
+  0,                              /* tp_alloc */
+  PyType_GenericNew,              /* tp_new */
+};
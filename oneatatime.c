@@ -0,0 +1,28 @@
+/*
+-------------------------------------------------------------------------------
+oneatatime.c -- Bob Jenkins's one-at-a-time hash.
+
+Kept apart from jenkins.c so that native code which does not link against
+Python (the benchmarks under bench/, for instance) can include it the same
+way it includes lookup3.c.
+-------------------------------------------------------------------------------
+*/
+#include <stddef.h>
+#include <stdint.h>
+
+static uint32_t one_at_a_time(const char *key, size_t key_len) {
+  size_t i;
+  uint32_t hash = 0;
+
+  for (i = 0; i < key_len; ++i) {
+    hash += key[i];
+    hash += (hash << 10);
+    hash ^= (hash >> 6);
+  }
+
+  hash += (hash << 3);
+  hash ^= (hash >> 11);
+  hash += (hash << 15);
+
+  return hash;
+}
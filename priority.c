@@ -0,0 +1,738 @@
+/*
+  PrioritySample: weighted priority sampling (bottom-k by u / w) for
+  estimating subset sums.
+
+  Each key gets a uniform u in (0, 1) from the top 53 bits of its 64-bit
+  hashlittle2 hash and the rank u / w for its weight w; the sketch keeps
+  the k keys of smallest rank, so heavy items are kept preferentially.
+  Because u depends on the key alone, every shard ranks a key the same
+  way, and the union of two samples cut back to the k smallest ranks is
+  exactly the sample of the union of their inputs.
+
+  With tau = 1 / (the (k+1)-th smallest rank), each kept key estimates
+  its weight as max(w, tau), and the sum of these over the kept keys that
+  match a predicate is an unbiased estimate of the total weight of all
+  keys that match it (Duffield, Lund and Thorup).  The sketch keeps k + 1
+  keys in a max-heap on rank so that tau is always at hand.
+
+  update() hashes a batch with the GIL released, across threads for large
+  batches, and then offers the keys whose rank beats the current
+  (k+1)-th to the heap; after the first few multiples of k keys, few do.
+ */
+#include <math.h>
+
+#define PS_MAGIC "JKPRIO01"
+#define PS_MAX_K (1u << 30)
+
+struct ps_item {
+  double rank, weight;
+  uint64_t h;
+  uint32_t len;
+  char *key;
+};
+
+typedef struct {
+  PyObject_HEAD
+  uint32_t k, seed;
+  struct ps_item *heap;     /* max-heap on rank, up to k + 1 items */
+  uint32_t n;
+  uint64_t seen;            /* keys offered, for information */
+  size_t size;              /* bytes mapped for the heap */
+  struct jk_memory mem;
+} PrioritySampleObject;
+
+static PyTypeObject PrioritySampleType;
+
+static uint64_t ps_hash(const void *key, size_t len, uint32_t seed) {
+  uint32_t pc = seed, pb = 0;
+
+  hashlittle2(key, len, &pc, &pb);
+  return pc + (((uint64_t) pb) << 32);
+}
+
+/* Rank of a key: u in (0, 1) from the hash, over its weight. */
+static double ps_rank(uint64_t h, double weight) {
+  return ((double) (h >> 11) + 0.5) / 9007199254740992.0 / weight;
+}
+
+static void ps_sift_down(struct ps_item *heap, uint32_t n, uint32_t i) {
+  struct ps_item item = heap[i];
+
+  for (;;) {
+    uint32_t child = 2 * i + 1;
+
+    if (child >= n)
+      break;
+    if (child + 1 < n && heap[child + 1].rank > heap[child].rank)
+      ++child;
+    if (heap[child].rank <= item.rank)
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = item;
+}
+
+static void ps_sift_up(struct ps_item *heap, uint32_t i) {
+  struct ps_item item = heap[i];
+
+  while (i > 0 && heap[(i - 1) / 2].rank < item.rank) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = item;
+}
+
+/* Rank a new key must beat to be kept. */
+static double ps_cutoff(const PrioritySampleObject *s) {
+  return s->n < s->k + 1 ? INFINITY : s->heap[0].rank;
+}
+
+/* Offer a key; returns 0, or -1 when out of memory. */
+static int ps_offer(PrioritySampleObject *s, const char *key, size_t len,
+                    uint64_t h, double rank, double weight) {
+  struct ps_item item;
+
+  if (rank >= ps_cutoff(s))
+    return 0;
+  item.key = malloc(len ? len : 1);
+  if (!item.key)
+    return -1;
+  memcpy(item.key, key, len);
+  item.len = (uint32_t) len;
+  item.h = h;
+  item.rank = rank;
+  item.weight = weight;
+  if (s->n < s->k + 1) {
+    s->heap[s->n] = item;
+    ps_sift_up(s->heap, s->n++);
+  } else {
+    free(s->heap[0].key);
+    s->heap[0] = item;
+    ps_sift_down(s->heap, s->n, 0);
+  }
+  return 0;
+}
+
+static double ps_tau(const PrioritySampleObject *s) {
+  return s->n < s->k + 1 ? 0.0 : 1.0 / s->heap[0].rank;
+}
+
+/* Weights from a float buffer (array('d'), NumPy) or a sequence. */
+static double *ps_weights_get(PyObject *obj, Py_ssize_t *n) {
+  Py_buffer view;
+  PyObject *seq;
+  double *out;
+  Py_ssize_t i;
+
+  if (PyObject_CheckBuffer(obj) &&
+      PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) == 0) {
+    const char *fmt = view.format ? view.format : "B";
+
+    if (*fmt == '@' || *fmt == '=' || *fmt == '<')
+      ++fmt;
+    if ((strcmp(fmt, "d") == 0 && view.itemsize == 8) ||
+        (strcmp(fmt, "f") == 0 && view.itemsize == 4)) {
+      *n = view.len / view.itemsize;
+      out = malloc((*n ? *n : 1) * sizeof(double));
+      if (!out) {
+        PyBuffer_Release(&view);
+        PyErr_NoMemory();
+        return NULL;
+      }
+      for (i = 0; i < *n; ++i)
+        out[i] = view.itemsize == 8 ? ((const double *) view.buf)[i]
+                                    : ((const float *) view.buf)[i];
+      PyBuffer_Release(&view);
+      return out;
+    }
+    PyBuffer_Release(&view);
+  }
+  PyErr_Clear();
+
+  seq = PySequence_Fast(obj, "weights must be a sequence of numbers");
+  if (!seq)
+    return NULL;
+  *n = PySequence_Fast_GET_SIZE(seq);
+  out = malloc((*n ? *n : 1) * sizeof(double));
+  if (!out) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  for (i = 0; i < *n; ++i) {
+    out[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+    if (out[i] == -1.0 && PyErr_Occurred()) {
+      free(out);
+      Py_DECREF(seq);
+      return NULL;
+    }
+  }
+  Py_DECREF(seq);
+  return out;
+}
+
+struct ps_update {
+  PrioritySampleObject *sample;
+  struct jk_keys *keys;
+  const double *weights;
+  double *ranks;
+  uint64_t *hashes;
+};
+
+static void ps_update_hash(void *ctx, int t, int nt) {
+  struct ps_update *u = (struct ps_update *) ctx;
+  Py_ssize_t i, lo, hi;
+
+  jk_share(u->keys->n, t, nt, &lo, &hi);
+  for (i = lo; i < hi; ++i) {
+    u->hashes[i] = ps_hash(u->keys->ptr[i], u->keys->len[i],
+                           u->sample->seed);
+    u->ranks[i] = u->weights[i] > 0 ? ps_rank(u->hashes[i], u->weights[i])
+                                    : INFINITY;
+  }
+}
+
+static char prioritysample_update_doc[] = "update(keys, weights[, threads]) -- Offers each key with its weight. weights is a sequence or float buffer (array('d'), NumPy array) of the same length as keys; keys of weight 0 are never kept. Every key should be offered once, to one sketch. threads=0 picks a thread count from the number of CPUs; small batches always run on one thread.";
+
+static PyObject* prioritysample_update(PrioritySampleObject *self,
+                                       PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"keys", "weights", "threads", NULL};
+  PyObject *keys_obj, *weights_obj;
+  struct ps_update u;
+  struct jk_keys keys;
+  double *weights;
+  Py_ssize_t nweights, i;
+  int threads = 0, nt, failed = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|i", kwlist, &keys_obj,
+                                   &weights_obj, &threads))
+    return NULL;
+  weights = ps_weights_get(weights_obj, &nweights);
+  if (!weights)
+    return NULL;
+  if (jk_keys_get(keys_obj, &keys) < 0) {
+    free(weights);
+    return NULL;
+  }
+  if (nweights != keys.n) {
+    PyErr_SetString(PyExc_ValueError,
+                    "keys and weights must have the same length");
+    goto fail;
+  }
+  for (i = 0; i < nweights; ++i) {
+    if (!(weights[i] >= 0) || isinf(weights[i])) {
+      PyErr_SetString(PyExc_ValueError,
+                      "weights must be finite and not negative");
+      goto fail;
+    }
+  }
+
+  u.sample = self;
+  u.keys = &keys;
+  u.weights = weights;
+  u.ranks = malloc((keys.n ? keys.n : 1) * sizeof(double));
+  u.hashes = malloc((keys.n ? keys.n : 1) * sizeof(uint64_t));
+  if (!u.ranks || !u.hashes) {
+    free(u.ranks);
+    free(u.hashes);
+    PyErr_NoMemory();
+    goto fail;
+  }
+
+  nt = jk_thread_count(keys.n, threads);
+  Py_BEGIN_ALLOW_THREADS
+  JK_ENTER_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  jk_parallel(nt, ps_update_hash, &u);
+  JK_EXIT_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  Py_END_ALLOW_THREADS
+  /* with the GIL held, so that concurrent updates do not race */
+  for (i = 0; i < keys.n && !failed; ++i)
+    failed = ps_offer(self, keys.ptr[i], keys.len[i], u.hashes[i],
+                      u.ranks[i], weights[i]) < 0;
+  self->seen += (uint64_t) keys.n;
+
+  free(u.ranks);
+  free(u.hashes);
+  free(weights);
+  jk_keys_release(&keys);
+  if (failed)
+    return PyErr_NoMemory();
+  Py_RETURN_NONE;
+
+fail:
+  free(weights);
+  jk_keys_release(&keys);
+  return NULL;
+}
+
+/*
+  Flags the items of other whose key self holds too, through a table of
+  other's items keyed on their hashes.  Returns a calloc'd array of
+  other->n flags, or NULL when out of memory.
+*/
+static char *ps_shared(const PrioritySampleObject *self,
+                       const PrioritySampleObject *other) {
+  char *shared = calloc(other->n ? other->n : 1, 1);
+  uint64_t mask = 1, j;
+  uint32_t *slots, i;
+
+  if (!shared)
+    return NULL;
+  while (mask < 2 * (uint64_t) other->n)
+    mask <<= 1;
+  slots = calloc(mask, sizeof(*slots));
+  if (!slots) {
+    free(shared);
+    return NULL;
+  }
+  --mask;
+  for (i = 0; i < other->n; ++i) {
+    for (j = other->heap[i].h & mask; slots[j]; j = (j + 1) & mask)
+      ;
+    slots[j] = i + 1;
+  }
+  for (i = 0; i < self->n; ++i) {
+    const struct ps_item *a = &self->heap[i];
+
+    for (j = a->h & mask; slots[j]; j = (j + 1) & mask) {
+      const struct ps_item *b = &other->heap[slots[j] - 1];
+
+      if (b->h == a->h && b->len == a->len &&
+          memcmp(b->key, a->key, a->len) == 0)
+        shared[slots[j] - 1] = 1;
+    }
+  }
+  free(slots);
+  return shared;
+}
+
+static char prioritysample_merge_doc[] = "merge(other) -- Adds the sample of another PrioritySample of the same k and seed, built from other keys, giving the sample of both inputs together. A key kept by both is counted once.";
+
+static PyObject* prioritysample_merge(PrioritySampleObject *self,
+                                      PyObject *args) {
+  PrioritySampleObject *other;
+  char *shared;
+  uint32_t i;
+
+  if (!PyArg_ParseTuple(args, "O!", &PrioritySampleType, &other))
+    return NULL;
+  if (other->k != self->k || other->seed != self->seed) {
+    PyErr_SetString(PyExc_ValueError, "PrioritySamples differ in k or seed");
+    return NULL;
+  }
+  if (other == self)
+    Py_RETURN_NONE;
+  /* a key seen by both shards has the same hash; keep one copy */
+  shared = ps_shared(self, other);
+  if (!shared)
+    return PyErr_NoMemory();
+  for (i = 0; i < other->n; ++i) {
+    const struct ps_item *item = &other->heap[i];
+
+    if (shared[i] || item->rank >= ps_cutoff(self))
+      continue;
+    if (ps_offer(self, item->key, item->len, item->h, item->rank,
+                 item->weight) < 0) {
+      free(shared);
+      return PyErr_NoMemory();
+    }
+  }
+  free(shared);
+  self->seen += other->seen;
+  Py_RETURN_NONE;
+}
+
+static int ps_rank_cmp(const void *a, const void *b) {
+  double x = (*(const struct ps_item * const *) a)->rank;
+  double y = (*(const struct ps_item * const *) b)->rank;
+  return x < y ? -1 : x > y;
+}
+
+/* The kept items (all but the threshold one) by rank; *n receives the
+   count.  Returns a malloc'd array of pointers into the heap. */
+static struct ps_item **ps_sorted(PrioritySampleObject *s, uint32_t *n) {
+  struct ps_item **items = malloc((s->n ? s->n : 1) * sizeof(*items));
+  uint32_t i;
+
+  if (!items)
+    return NULL;
+  for (i = 0; i < s->n; ++i)
+    items[i] = &s->heap[i];
+  qsort(items, s->n, sizeof(*items), ps_rank_cmp);
+  *n = s->n < s->k + 1 ? s->n : s->k;
+  return items;
+}
+
+static char prioritysample_sample_doc[] = "sample() -- Returns the kept keys as a list of (key, weight, estimate) tuples, highest priority first. estimate is max(weight, threshold), each key's share of an unbiased estimate of the total weight.";
+
+static PyObject* prioritysample_sample(PrioritySampleObject *self) {
+  struct ps_item **items;
+  double tau = ps_tau(self);
+  PyObject *list;
+  uint32_t n, i;
+
+  items = ps_sorted(self, &n);
+  if (!items)
+    return PyErr_NoMemory();
+  list = PyList_New(n);
+  for (i = 0; list && i < n; ++i) {
+    PyObject *key = PyBytes_FromStringAndSize(items[i]->key, items[i]->len);
+    PyObject *t = key ? Py_BuildValue("(Ndd)", key, items[i]->weight,
+                                      items[i]->weight > tau
+                                          ? items[i]->weight : tau) : NULL;
+    if (!t) {
+      Py_CLEAR(list);
+      break;
+    }
+    PyList_SET_ITEM(list, i, t);
+  }
+  free(items);
+  return list;
+}
+
+/*
+  Sum of the estimates, and of their variance estimates
+  tau * max(0, tau - w), over the kept keys for which predicate(key) is
+  true (every key if predicate is None).  Returns 0 or -1.
+
+  The predicate may update() or merge() this sketch, which moves the
+  heap and frees evicted keys, so the kept keys and weights are copied
+  out before it is first called.
+ */
+static int ps_sum(PrioritySampleObject *self, PyObject *predicate,
+                  double *sum, double *variance) {
+  struct ps_item **items;
+  PyObject *keys = NULL;
+  double *weights;
+  double tau = ps_tau(self);
+  uint32_t n, i;
+
+  *sum = *variance = 0;
+  items = ps_sorted(self, &n);
+  if (!items) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  weights = malloc((n ? n : 1) * sizeof(*weights));
+  if (!weights) {
+    free(items);
+    PyErr_NoMemory();
+    return -1;
+  }
+  if (predicate != Py_None) {
+    keys = PyTuple_New(n);
+    for (i = 0; keys && i < n; ++i) {
+      PyObject *key = PyBytes_FromStringAndSize(items[i]->key,
+                                                items[i]->len);
+      if (!key)
+        Py_CLEAR(keys);
+      else
+        PyTuple_SET_ITEM(keys, i, key);
+    }
+    if (!keys) {
+      free(items);
+      free(weights);
+      return -1;
+    }
+  }
+  for (i = 0; i < n; ++i)
+    weights[i] = items[i]->weight;
+  free(items);
+
+  for (i = 0; i < n; ++i) {
+    double w = weights[i];
+
+    if (keys) {
+      PyObject *r = PyObject_CallFunctionObjArgs(predicate,
+                                                 PyTuple_GET_ITEM(keys, i),
+                                                 NULL);
+      int truth;
+
+      if (!r)
+        goto fail;
+      truth = PyObject_IsTrue(r);
+      Py_DECREF(r);
+      if (truth < 0)
+        goto fail;
+      if (!truth)
+        continue;
+    }
+    *sum += w > tau ? w : tau;
+    if (tau > w)
+      *variance += tau * (tau - w);
+  }
+  Py_XDECREF(keys);
+  free(weights);
+  return 0;
+
+fail:
+  Py_DECREF(keys);
+  free(weights);
+  return -1;
+}
+
+static char prioritysample_estimate_doc[] = "estimate([predicate]) -- Returns an unbiased estimate of the total weight of the keys offered for which predicate(key) is true, or of all of them.";
+
+static PyObject* prioritysample_estimate(PrioritySampleObject *self,
+                                         PyObject *args) {
+  PyObject *predicate = Py_None;
+  double sum, variance;
+
+  if (!PyArg_ParseTuple(args, "|O", &predicate))
+    return NULL;
+  if (ps_sum(self, predicate, &sum, &variance) < 0)
+    return NULL;
+  return PyFloat_FromDouble(sum);
+}
+
+static char prioritysample_variance_doc[] = "variance([predicate]) -- Returns an unbiased estimate of the variance of estimate(predicate).";
+
+static PyObject* prioritysample_variance(PrioritySampleObject *self,
+                                         PyObject *args) {
+  PyObject *predicate = Py_None;
+  double sum, variance;
+
+  if (!PyArg_ParseTuple(args, "|O", &predicate))
+    return NULL;
+  if (ps_sum(self, predicate, &sum, &variance) < 0)
+    return NULL;
+  return PyFloat_FromDouble(variance);
+}
+
+static char prioritysample_tobytes_doc[] = "tobytes() -- Returns the sketch serialized, for PrioritySample(data=...) on another node.";
+
+static PyObject* prioritysample_tobytes(PrioritySampleObject *self) {
+  Py_ssize_t size = 32;
+  PyObject *r;
+  uint8_t *p;
+  uint32_t i;
+
+  for (i = 0; i < self->n; ++i)
+    size += 20 + self->heap[i].len;
+  r = PyBytes_FromStringAndSize(NULL, size);
+  if (!r)
+    return NULL;
+  p = (uint8_t *) PyBytes_AS_STRING(r);
+  memcpy(p, PS_MAGIC, 8);
+  jk_put64(p + 8, self->k | ((uint64_t) self->seed << 32));
+  jk_put64(p + 16, self->n);
+  jk_put64(p + 24, self->seen);
+  p += 32;
+  /* the rank is recomputed from the hash and weight on loading */
+  for (i = 0; i < self->n; ++i) {
+    const struct ps_item *item = &self->heap[i];
+    uint64_t bits;
+
+    memcpy(&bits, &item->weight, sizeof(bits));
+    jk_put64(p, bits);
+    jk_put64(p + 8, item->h);
+    jk_put32(p + 16, item->len);
+    memcpy(p + 20, item->key, item->len);
+    p += 20 + item->len;
+  }
+  return r;
+}
+
+/* Map the heap for k; returns 0, or -1 with an exception set. */
+static int ps_alloc(PrioritySampleObject *self, PyObject *huge_pages) {
+  if (jk_memory_init(&self->mem, "PrioritySample", huge_pages, Py_None) < 0)
+    return -1;
+  self->size = ((size_t) self->k + 1) * sizeof(struct ps_item);
+  self->heap = jk_map(&self->mem, &self->size);
+  if (!self->heap) {
+    jk_memory_free(&self->mem);
+    PyErr_NoMemory();
+    return -1;
+  }
+  jk_memory_live(&self->mem,
+                 (ssize_t) (((size_t) self->k + 1) * sizeof(struct ps_item)));
+  return 0;
+}
+
+/* Load tobytes() output into an empty sketch; returns 0 or -1. */
+static int ps_load(PrioritySampleObject *self, const uint8_t *data,
+                   Py_ssize_t len, PyObject *huge_pages) {
+  const uint8_t *end = data + len;
+  uint64_t n, i;
+
+  if (len < 32 || memcmp(data, PS_MAGIC, 8) != 0)
+    goto bad;
+  self->k = (uint32_t) jk_get64(data + 8);
+  self->seed = (uint32_t) (jk_get64(data + 8) >> 32);
+  n = jk_get64(data + 16);
+  /* every item takes at least 20 bytes */
+  if (self->k == 0 || self->k > PS_MAX_K || n > (uint64_t) self->k + 1 ||
+      n > (uint64_t) (len - 32) / 20)
+    goto bad;
+  if (ps_alloc(self, huge_pages) < 0)
+    return -1;
+  self->seen = jk_get64(data + 24);
+  data += 32;
+  for (i = 0; i < n; ++i) {
+    uint64_t bits, h;
+    uint32_t klen;
+    double w;
+
+    if (end - data < 20)
+      goto bad;
+    bits = jk_get64(data);
+    memcpy(&w, &bits, sizeof(w));
+    h = jk_get64(data + 8);
+    klen = jk_get32(data + 16);
+    if ((uint64_t) (end - data - 20) < klen || !(w > 0))
+      goto bad;
+    if (ps_offer(self, (const char *) data + 20, klen, h, ps_rank(h, w),
+                 w) < 0) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    data += 20 + klen;
+  }
+  if (data != end)
+    goto bad;
+  return 0;
+
+bad:
+  PyErr_SetString(PyExc_ValueError, "not a serialized PrioritySample");
+  return -1;
+}
+
+static PyObject* prioritysample_get_threshold(PrioritySampleObject *self,
+                                              void *closure) {
+  return PyFloat_FromDouble(ps_tau(self));
+}
+
+static PyObject* prioritysample_get_k(PrioritySampleObject *self,
+                                      void *closure) {
+  return PyLong_FromUnsignedLong(self->k);
+}
+
+static PyObject* prioritysample_get_seen(PrioritySampleObject *self,
+                                         void *closure) {
+  return PyLong_FromUnsignedLongLong(self->seen);
+}
+
+static PyObject* prioritysample_get_memory(PrioritySampleObject *self,
+                                           void *closure) {
+  return jk_memory_dict(&self->mem);
+}
+
+static Py_ssize_t prioritysample_len(PrioritySampleObject *self) {
+  return self->n < self->k + 1 ? self->n : self->k;
+}
+
+static int prioritysample_init(PrioritySampleObject *self, PyObject *args,
+                               PyObject *kwds) {
+  static char *kwlist[] = {"k", "seed", "data", "huge_pages", NULL};
+  unsigned int k = 0, seed = 0;
+  const uint8_t *data = NULL;
+  Py_ssize_t data_len = 0;
+  PyObject *huge_pages = Py_None;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|IIz#O", kwlist, &k, &seed,
+                                   &data, &data_len, &huge_pages))
+    return -1;
+  if (self->heap) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "PrioritySample already initialized");
+    return -1;
+  }
+  if (data)
+    return ps_load(self, data, data_len, huge_pages);
+  if (k == 0 || k > PS_MAX_K) {
+    PyErr_SetString(PyExc_ValueError, "k must be in 1..2**30");
+    return -1;
+  }
+  self->k = k;
+  self->seed = seed;
+  return ps_alloc(self, huge_pages);
+}
+
+static void prioritysample_dealloc(PrioritySampleObject *self) {
+  uint32_t i;
+
+  if (self->mem.owner) {
+    for (i = 0; i < self->n; ++i)
+      free(self->heap[i].key);
+    jk_unmap(&self->mem, self->heap, self->size);
+    jk_memory_free(&self->mem);
+  }
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef prioritysample_methods[] = {
+  {"update",   (PyCFunction) prioritysample_update,
+   METH_VARARGS | METH_KEYWORDS, prioritysample_update_doc},
+  {"merge",    (PyCFunction) prioritysample_merge,    METH_VARARGS,
+   prioritysample_merge_doc},
+  {"sample",   (PyCFunction) prioritysample_sample,   METH_NOARGS,
+   prioritysample_sample_doc},
+  {"estimate", (PyCFunction) prioritysample_estimate, METH_VARARGS,
+   prioritysample_estimate_doc},
+  {"variance", (PyCFunction) prioritysample_variance, METH_VARARGS,
+   prioritysample_variance_doc},
+  {"tobytes",  (PyCFunction) prioritysample_tobytes,  METH_NOARGS,
+   prioritysample_tobytes_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef prioritysample_getset[] = {
+  {"k",         (getter) prioritysample_get_k,         NULL,
+   "Number of keys kept.", NULL},
+  {"threshold", (getter) prioritysample_get_threshold, NULL,
+   "tau: kept keys lighter than this estimate it as their weight; 0 "
+   "while fewer than k + 1 keys have been offered.", NULL},
+  {"seen",      (getter) prioritysample_get_seen,      NULL,
+   "Number of keys offered, merged sketches included.", NULL},
+  {"memory",    (getter) prioritysample_get_memory,    NULL,
+   "This sketch's entry in memory_usage().", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PySequenceMethods prioritysample_as_sequence = {
+  (lenfunc) prioritysample_len,   /* sq_length */
+};
+
+static char prioritysample_type_doc[] = "PrioritySample(k, seed=0, data=None, huge_pages=None) -- Weighted sample of k keys by priority sampling: each key's rank is a lookup3 hash of the key mapped to (0, 1) over its weight, and the k smallest are kept. Samples of disjoint inputs with the same k and seed merge into the sample of their union. data restores a sketch from tobytes().";
+
+static PyTypeObject PrioritySampleType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.PrioritySample",       /* tp_name */
+  sizeof(PrioritySampleObject),   /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) prioritysample_dealloc, /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  &prioritysample_as_sequence,    /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  prioritysample_type_doc,        /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  prioritysample_methods,         /* tp_methods */
+  0,                              /* tp_members */
+  prioritysample_getset,          /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) prioritysample_init, /* tp_init */
+  0,                              /* tp_alloc */
+  PyType_GenericNew,              /* tp_new */
+};
@@ -0,0 +1,455 @@
+/*
+  Hardware counter profiling for the Python entry points.
+
+    with jenkins.profile() as p:
+        ...
+    p.results()
+
+  On entry the profile opens a perf_event_open(2) counter group on the
+  calling thread: cycles, instructions, L1 data cache read misses, last
+  level cache misses and branch misses, user mode only.  While it is
+  active, every JK_ENTER()/JK_EXIT() pair in that thread reads the group
+  before and after the kernel and charges the difference to the entry
+  point, alongside its call and byte counts.  The whole with-block is
+  counted as well, so hashing can be compared against everything else
+  the thread did (argument parsing, building result objects, the
+  interpreter loop).
+
+  Each read is a system call, so per-entry-point figures include a few
+  hundred user mode instructions of read(2) wrapper; compare them between
+  runs rather than taking them as absolute.  Other threads are not
+  counted.
+
+  Events that the kernel or container refuses (perf_event_paranoid,
+  seccomp, no PMU in a VM) are left out; if none can be opened the
+  profile still counts calls and bytes, available is False and error
+  says why.
+ */
+
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define JK_HAVE_PERF 1
+#else
+#define JK_HAVE_PERF 0
+#endif
+
+enum jk_event {
+  JK_EV_CYCLES,
+  JK_EV_INSTRUCTIONS,
+  JK_EV_L1D_MISSES,
+  JK_EV_LLC_MISSES,
+  JK_EV_BRANCH_MISSES,
+  JK_NEVENTS
+};
+
+static const char *jk_event_names[JK_NEVENTS] = {
+  "cycles",
+  "instructions",
+  "l1d_misses",
+  "llc_misses",
+  "branch_misses"
+};
+
+struct jk_profile_counts {
+  uint64_t calls;
+  uint64_t bytes;
+  uint64_t events[JK_NEVENTS];
+};
+
+typedef struct {
+  PyObject_HEAD
+  int active;
+  int leader;                    /* group leader fd, -1 if none */
+  int nopen;                     /* events in the group */
+  int fds[JK_NEVENTS];           /* -1 where the event could not be opened */
+  int slot[JK_NEVENTS];          /* position of each event in a group read */
+  char error[160];
+  uint64_t start[JK_NEVENTS];    /* counts when the with-block began */
+  struct jk_profile_counts total;
+  struct jk_profile_counts f[JK_NFUNCS];
+} ProfileObject;
+
+static __thread ProfileObject *jk_profile_current;
+
+#if JK_HAVE_PERF
+
+static const struct { uint32_t type; uint64_t config; } jk_event_attrs[] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}
+};
+
+static int jk_perf_open(int ev, int group) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = jk_event_attrs[ev].type;
+  attr.config = jk_event_attrs[ev].config;
+  attr.disabled = (group == -1);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void jk_profile_close(ProfileObject *p) {
+  int ev;
+
+  for (ev = 0; ev < JK_NEVENTS; ++ev) {
+    if (p->fds[ev] >= 0)
+      close(p->fds[ev]);
+    p->fds[ev] = -1;
+    p->slot[ev] = -1;
+  }
+  p->leader = -1;
+  p->nopen = 0;
+}
+
+static void jk_profile_open(ProfileObject *p) {
+  int ev, err = 0;
+
+  for (ev = 0; ev < JK_NEVENTS; ++ev) {
+    int fd = jk_perf_open(ev, p->leader);
+
+    if (fd < 0) {
+      if (!err)
+        err = errno;
+      continue;
+    }
+    if (p->leader < 0)
+      p->leader = fd;
+    p->fds[ev] = fd;
+    p->slot[ev] = p->nopen++;
+  }
+
+  if (p->leader < 0) {
+    snprintf(p->error, sizeof(p->error),
+             "perf_event_open: %s%s", strerror(err),
+             (err == EACCES || err == EPERM)
+               ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+    return;
+  }
+  if (err)
+    snprintf(p->error, sizeof(p->error),
+             "some events unavailable: %s", strerror(err));
+
+  ioctl(p->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* Keep the fds so results() knows which events were recorded. */
+static void jk_profile_stop(ProfileObject *p) {
+  if (p->leader >= 0)
+    ioctl(p->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* Current counts of the open events; the others are left at zero. */
+static void jk_profile_read(ProfileObject *p, uint64_t *out) {
+  uint64_t buf[1 + JK_NEVENTS];
+  int ev;
+
+  memset(out, 0, JK_NEVENTS * sizeof(uint64_t));
+  if (p->leader < 0 || read(p->leader, buf, sizeof(buf)) <= 0)
+    return;
+  for (ev = 0; ev < JK_NEVENTS; ++ev)
+    if (p->slot[ev] >= 0 && (uint64_t) p->slot[ev] < buf[0])
+      out[ev] = buf[1 + p->slot[ev]];
+}
+
+#else /* !JK_HAVE_PERF */
+
+static void jk_profile_close(ProfileObject *p) {
+}
+
+static void jk_profile_open(ProfileObject *p) {
+  snprintf(p->error, sizeof(p->error),
+           "hardware counters need Linux perf_event_open");
+}
+
+static void jk_profile_stop(ProfileObject *p) {
+}
+
+static void jk_profile_read(ProfileObject *p, uint64_t *out) {
+  memset(out, 0, JK_NEVENTS * sizeof(uint64_t));
+}
+
+#endif /* JK_HAVE_PERF */
+
+static inline void jk_profile_account(ProfileObject *p, enum jk_func fn,
+                                      size_t len, uint64_t n,
+                                      const uint64_t *before) {
+  struct jk_profile_counts *c = &p->f[fn];
+  uint64_t after[JK_NEVENTS];
+  int ev;
+
+  jk_profile_read(p, after);
+  c->calls += n;
+  c->bytes += len;
+  for (ev = 0; ev < JK_NEVENTS; ++ev)
+    c->events[ev] += after[ev] - before[ev];
+}
+
+/* Used by JK_ENTER()/JK_EXIT() in instrument.c. */
+#define JK_PROFILE_ENTER(fn) \
+  ProfileObject *jk_prof_ = jk_profile_current; \
+  uint64_t jk_prof_before_[JK_NEVENTS]; \
+  if (jk_prof_) \
+    jk_profile_read(jk_prof_, jk_prof_before_)
+#define JK_PROFILE_EXIT(fn, len, n) \
+  if (jk_prof_) \
+    jk_profile_account(jk_prof_, (fn), (size_t) (len), (uint64_t) (n), \
+                       jk_prof_before_)
+
+static PyObject* jk_profile_counts_dict(const ProfileObject *p,
+                                        const struct jk_profile_counts *c) {
+  PyObject *d = Py_BuildValue("{sKsK}",
+                              "calls", (unsigned long long) c->calls,
+                              "bytes", (unsigned long long) c->bytes);
+  double cycles = (double) c->events[JK_EV_CYCLES];
+  double instructions = (double) c->events[JK_EV_INSTRUCTIONS];
+  int ev;
+
+  if (!d)
+    return NULL;
+
+  for (ev = 0; ev < JK_NEVENTS; ++ev) {
+    PyObject *v;
+
+    if (p->fds[ev] < 0)
+      continue;
+    v = PyLong_FromUnsignedLongLong(c->events[ev]);
+    if (!v || PyDict_SetItemString(d, jk_event_names[ev], v) < 0) {
+      Py_XDECREF(v);
+      Py_DECREF(d);
+      return NULL;
+    }
+    Py_DECREF(v);
+  }
+
+  if (p->fds[JK_EV_CYCLES] >= 0 && c->bytes) {
+    PyObject *v = PyFloat_FromDouble(cycles / c->bytes);
+    if (!v || PyDict_SetItemString(d, "cycles_per_byte", v) < 0) {
+      Py_XDECREF(v);
+      Py_DECREF(d);
+      return NULL;
+    }
+    Py_DECREF(v);
+  }
+  if (p->fds[JK_EV_CYCLES] >= 0 && p->fds[JK_EV_INSTRUCTIONS] >= 0 &&
+      cycles > 0) {
+    PyObject *v = PyFloat_FromDouble(instructions / cycles);
+    if (!v || PyDict_SetItemString(d, "ipc", v) < 0) {
+      Py_XDECREF(v);
+      Py_DECREF(d);
+      return NULL;
+    }
+    Py_DECREF(v);
+  }
+  return d;
+}
+
+static char profile_results_doc[] = "Returns a dict keyed by entry point name, plus 'total' for the whole with-block, holding calls, bytes, the hardware counters that could be opened, cycles_per_byte and ipc. Entry points that were not called are left out.";
+
+static PyObject* profile_results(ProfileObject *self) {
+  PyObject *result = PyDict_New(), *entry;
+  int fn;
+
+  if (!result)
+    return NULL;
+
+  for (fn = 0; fn < JK_NFUNCS; ++fn) {
+    if (!self->f[fn].calls)
+      continue;
+    entry = jk_profile_counts_dict(self, &self->f[fn]);
+    if (!entry || PyDict_SetItemString(result, jk_func_names[fn], entry) < 0) {
+      Py_XDECREF(entry);
+      Py_DECREF(result);
+      return NULL;
+    }
+    Py_DECREF(entry);
+  }
+
+  entry = jk_profile_counts_dict(self, &self->total);
+  if (!entry || PyDict_SetItemString(result, "total", entry) < 0) {
+    Py_XDECREF(entry);
+    Py_DECREF(result);
+    return NULL;
+  }
+  Py_DECREF(entry);
+  return result;
+}
+
+static PyObject* profile_enter(ProfileObject *self) {
+  if (self->active || jk_profile_current) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "a profile is already active in this thread");
+    return NULL;
+  }
+
+  /* a profile can be entered again; counts accumulate */
+  jk_profile_close(self);
+  self->error[0] = '\0';
+  jk_profile_open(self);
+  jk_profile_read(self, self->start);
+
+  self->active = 1;
+  jk_profile_current = self;
+  Py_INCREF(self);
+  Py_INCREF(self);
+  return (PyObject *) self;
+}
+
+static PyObject* profile_exit(ProfileObject *self, PyObject *args) {
+  uint64_t end[JK_NEVENTS];
+  int fn, ev;
+
+  if (!self->active || jk_profile_current != self) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "profile is not active in this thread");
+    return NULL;
+  }
+
+  jk_profile_read(self, end);
+  jk_profile_stop(self);
+  for (ev = 0; ev < JK_NEVENTS; ++ev)
+    self->total.events[ev] += end[ev] - self->start[ev];
+  /* f[] accumulates across with-blocks, so the total is recomputed */
+  self->total.calls = self->total.bytes = 0;
+  for (fn = 0; fn < JK_NFUNCS; ++fn) {
+    self->total.calls += self->f[fn].calls;
+    self->total.bytes += self->f[fn].bytes;
+  }
+
+  jk_profile_current = NULL;
+  self->active = 0;
+  Py_DECREF(self);
+  Py_RETURN_FALSE;
+}
+
+static PyObject* profile_get_available(ProfileObject *self, void *closure) {
+  return PyBool_FromLong(self->leader >= 0);
+}
+
+static PyObject* profile_get_error(ProfileObject *self, void *closure) {
+  if (!self->error[0])
+    Py_RETURN_NONE;
+  return Py_BuildValue("s", self->error);
+}
+
+static PyObject* profile_get_events(ProfileObject *self, void *closure) {
+  PyObject *list = PyList_New(0);
+  int ev;
+
+  if (!list)
+    return NULL;
+  for (ev = 0; ev < JK_NEVENTS; ++ev) {
+    PyObject *name;
+
+    if (self->fds[ev] < 0)
+      continue;
+    name = Py_BuildValue("s", jk_event_names[ev]);
+    if (!name || PyList_Append(list, name) < 0) {
+      Py_XDECREF(name);
+      Py_DECREF(list);
+      return NULL;
+    }
+    Py_DECREF(name);
+  }
+  return list;
+}
+
+static void profile_dealloc(ProfileObject *self) {
+  jk_profile_close(self);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef profile_methods[] = {
+  {"__enter__", (PyCFunction) profile_enter,   METH_NOARGS,  NULL},
+  {"__exit__",  (PyCFunction) profile_exit,    METH_VARARGS, NULL},
+  {"results",   (PyCFunction) profile_results, METH_NOARGS,  profile_results_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef profile_getset[] = {
+  {"available", (getter) profile_get_available, NULL,
+   "True if at least one hardware counter could be opened.", NULL},
+  {"error",     (getter) profile_get_error,     NULL,
+   "Why some or all counters are missing, or None.", NULL},
+  {"events",    (getter) profile_get_events,    NULL,
+   "Names of the hardware counters being recorded.", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static char profile_type_doc[] = "Hardware counter profile of the hash functions called in one thread. Create with jenkins.profile() and use as a context manager.";
+
+static PyTypeObject ProfileType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.Profile",              /* tp_name */
+  sizeof(ProfileObject),          /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) profile_dealloc,   /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  0,                              /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  profile_type_doc,               /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  profile_methods,                /* tp_methods */
+  0,                              /* tp_members */
+  profile_getset,                 /* tp_getset */
+};
+
+static char profile_doc[] = "Returns a new Profile. Use it as a context manager; the hash functions called by this thread inside the with-block are attributed cycles, instructions, cache misses and branch misses through Linux perf_event_open. Call results() on it afterwards.";
+
+static PyObject* profile_py(PyObject* self, PyObject* args) {
+  ProfileObject *p;
+  int ev;
+
+  if (!PyArg_ParseTuple(args, ""))
+    return NULL;
+
+  p = PyObject_New(ProfileObject, &ProfileType);
+  if (!p)
+    return NULL;
+
+  p->active = 0;
+  p->leader = -1;
+  p->nopen = 0;
+  p->error[0] = '\0';
+  for (ev = 0; ev < JK_NEVENTS; ++ev) {
+    p->fds[ev] = -1;
+    p->slot[ev] = -1;
+  }
+  memset(p->start, 0, sizeof(p->start));
+  memset(&p->total, 0, sizeof(p->total));
+  memset(p->f, 0, sizeof(p->f));
+  return (PyObject *) p;
+}
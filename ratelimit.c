@@ -0,0 +1,515 @@
+/*
+  RateLimiter: sliding-window request counts shared by every process that
+  maps the same file, updated with atomic instructions and no locks.
+
+  The window is divided into `buckets` time buckets, each holding a
+  Count-Min grid of depth rows by width 32-bit counters.  A key is hashed
+  once with hashlittle2; row r uses counter (pc + r * pb) mod width, and
+  a key's count is the smallest of its rows' counters, which can only
+  overestimate.  The count over the window is the sum over the buckets
+  it covers, so a request stops counting between window - window/buckets
+  and window seconds after it was made.
+
+  The file holds buckets + 1 grids used round-robin; each is tagged with
+  the time bucket it was cleared for (its epoch).  At any time one grid
+  lies outside the window and is the next to be used, so the first
+  caller to notice clears it ahead of time.  A grid that is stale when
+  it is needed (nobody came by for a whole bucket) is cleared then;
+  whoever claims its clearing word, by a compare-and-swap that stores the
+  time, zeroes it while the others wait for it, which only happens after
+  an idle bucket.  A claim older than RL_CLEAR_TIMEOUT belongs to a
+  process that died or stalled while clearing; the next caller takes it
+  over, and the stalled one gives up at its next chunk.  Grids whose
+  epoch is outside the window are skipped when counting, so old counts
+  never leak into a new window.
+
+  Time is CLOCK_MONOTONIC, which is the same for every process on a
+  machine.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RL_MAGIC         "JKRATE01"
+#define RL_CLEARING      ((uint64_t) 1 << 63)
+#define RL_NEVER         (RL_CLEARING - 1)   /* epoch of an unused grid */
+#define RL_WIDTH         65536
+#define RL_DEPTH         4
+#define RL_BUCKETS       10
+#define RL_MAX_DEPTH     16
+#define RL_MAX_BUCKETS   1024
+#define RL_GRID_HEADER   64
+#define RL_CLEAR_TIMEOUT ((uint64_t) 1000000000)  /* ns */
+#define RL_CLEAR_CHUNK   16384                    /* counters */
+
+struct rl_header {
+  char magic[8];
+  uint32_t width, depth, buckets, reserved;
+  uint64_t bucket_ns;
+};
+
+typedef struct {
+  PyObject_HEAD
+  PyObject *path;           /* bytes */
+  uint8_t *map;
+  size_t map_size;
+  size_t grid_size;         /* bytes per grid, header included */
+  uint32_t width, depth, buckets;
+  uint64_t bucket_ns;
+  uint64_t limit;
+  struct jk_memory mem;
+} RateLimiterObject;
+
+static uint64_t *rl_epoch(RateLimiterObject *r, uint64_t slot) {
+  return (uint64_t *) (r->map + RL_GRID_HEADER + slot * r->grid_size);
+}
+
+/* Clearing word: CLOCK_MONOTONIC time of the current claim, or 0. */
+static uint64_t *rl_claim(RateLimiterObject *r, uint64_t slot) {
+  return rl_epoch(r, slot) + 1;
+}
+
+static uint32_t *rl_counters(RateLimiterObject *r, uint64_t slot) {
+  return (uint32_t *) ((uint8_t *) rl_epoch(r, slot) + RL_GRID_HEADER);
+}
+
+static uint64_t rl_clock(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t rl_now(RateLimiterObject *r, double now) {
+  if (now >= 0)
+    return (uint64_t) (now * 1e9) / r->bucket_ns;
+  return rl_clock() / r->bucket_ns;
+}
+
+/* Zero a grid a chunk at a time; returns -1 if the claim was taken over. */
+static int rl_clear(RateLimiterObject *r, uint64_t slot, uint64_t stamp) {
+  uint32_t *counters = rl_counters(r, slot);
+  size_t n = (size_t) r->width * r->depth, i, len;
+
+  for (i = 0; i < n; i += len) {
+    if (__atomic_load_n(rl_claim(r, slot), __ATOMIC_ACQUIRE) != stamp)
+      return -1;
+    len = n - i < RL_CLEAR_CHUNK ? n - i : RL_CLEAR_CHUNK;
+    memset(counters + i, 0, len * sizeof(uint32_t));
+  }
+  return 0;
+}
+
+/* Make the grid for time bucket t current, clearing it if it is stale. */
+static void rl_prepare(RateLimiterObject *r, uint64_t t) {
+  uint64_t slot = t % (r->buckets + 1);
+  uint64_t *epoch = rl_epoch(r, slot), *claim = rl_claim(r, slot);
+
+  for (;;) {
+    uint64_t seen = __atomic_load_n(epoch, __ATOMIC_ACQUIRE);
+    uint64_t owner = seen & ~RL_CLEARING;
+    uint64_t held, stamp;
+
+    if (seen == t)
+      return;
+    /* a caller that stalled for a whole window finds a newer bucket
+       there; its request lands in that bucket */
+    if (owner != RL_NEVER && owner > t)
+      return;
+    /* claim the clearing unless someone claimed it recently; it takes a
+       memset */
+    held = __atomic_load_n(claim, __ATOMIC_ACQUIRE);
+    stamp = rl_clock();
+    if (held && stamp - held < RL_CLEAR_TIMEOUT) {
+      sched_yield();
+      continue;
+    }
+    if (!__atomic_compare_exchange_n(claim, &held, stamp, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      continue;
+    seen = __atomic_load_n(epoch, __ATOMIC_ACQUIRE);
+    owner = seen & ~RL_CLEARING;
+    if (seen != t && (owner == RL_NEVER || owner <= t)) {
+      __atomic_store_n(epoch, t | RL_CLEARING, __ATOMIC_RELEASE);
+      if (rl_clear(r, slot, stamp) == 0)
+        __atomic_store_n(epoch, t, __ATOMIC_RELEASE);
+    }
+    /* release the claim unless it was taken over */
+    __atomic_compare_exchange_n(claim, &stamp, 0, 0, __ATOMIC_ACQ_REL,
+                                __ATOMIC_ACQUIRE);
+  }
+}
+
+/* Counter indexes of a key, one per row. */
+static void rl_cells(RateLimiterObject *r, const void *key, size_t len,
+                     uint32_t *cells) {
+  uint32_t pc = 0, pb = 0, i;
+
+  hashlittle2(key, len, &pc, &pb);
+  pb |= 1;
+  for (i = 0; i < r->depth; ++i)
+    cells[i] = i * r->width + ((pc + i * pb) & (r->width - 1));
+}
+
+/* Estimated count of a key over the window ending in bucket t. */
+static uint64_t rl_count(RateLimiterObject *r, const uint32_t *cells,
+                         uint64_t t) {
+  uint64_t sums[RL_MAX_DEPTH], best, k;
+  uint32_t i;
+
+  memset(sums, 0, sizeof(sums));
+  for (k = 0; k < r->buckets && k <= t; ++k) {
+    uint64_t slot = (t - k) % (r->buckets + 1);
+    const uint32_t *counters;
+
+    if (__atomic_load_n(rl_epoch(r, slot), __ATOMIC_ACQUIRE) != t - k)
+      continue;
+    counters = rl_counters(r, slot);
+    for (i = 0; i < r->depth; ++i)
+      sums[i] += __atomic_load_n(&counters[cells[i]], __ATOMIC_RELAXED);
+  }
+  best = sums[0];
+  for (i = 1; i < r->depth; ++i)
+    if (sums[i] < best)
+      best = sums[i];
+  return best;
+}
+
+static void rl_add(RateLimiterObject *r, const uint32_t *cells, uint64_t t,
+                   uint32_t n) {
+  uint32_t *counters = rl_counters(r, t % (r->buckets + 1));
+  uint32_t i;
+
+  for (i = 0; i < r->depth; ++i)
+    __atomic_fetch_add(&counters[cells[i]], n, __ATOMIC_RELAXED);
+}
+
+static int rl_check(RateLimiterObject *r) {
+  if (!r->map) {
+    PyErr_SetString(PyExc_ValueError, "RateLimiter not initialized");
+    return -1;
+  }
+  return 0;
+}
+
+/* Parse (key, n, now) and prepare the current bucket. */
+static int rl_args(RateLimiterObject *r, PyObject *args, PyObject *kwds,
+                   uint32_t *cells, unsigned int *n, uint64_t *t) {
+  static char *kwlist[] = {"key", "n", "now", NULL};
+  PyObject *key, *owned;
+  const char *ptr;
+  size_t len;
+  double now = -1;
+
+  *n = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Id", kwlist, &key, n,
+                                   &now))
+    return -1;
+  if (rl_check(r) < 0 || jk_key_bytes(key, &owned, &ptr, &len) < 0)
+    return -1;
+  rl_cells(r, ptr, len, cells);
+  Py_XDECREF(owned);
+  *t = rl_now(r, now);
+  rl_prepare(r, *t);
+  /* the grid after this one is out of the window: clear it now */
+  if (__atomic_load_n(rl_epoch(r, (*t + 1) % (r->buckets + 1)),
+                      __ATOMIC_RELAXED) != *t + 1)
+    rl_prepare(r, *t + 1);
+  return 0;
+}
+
+static char ratelimiter_hit_doc[] = "hit(key[, n][, now]) -- Counts n (default 1) requests for key and returns True if that keeps its count over the window within the limit; otherwise counts nothing and returns False. Checking and counting are separate atomic steps, so concurrent callers can overshoot the limit by a few requests. now is a CLOCK_MONOTONIC time in seconds, by default the current one.";
+
+static PyObject* ratelimiter_hit(RateLimiterObject *self, PyObject *args,
+                                 PyObject *kwds) {
+  uint32_t cells[RL_MAX_DEPTH];
+  unsigned int n;
+  uint64_t t;
+
+  if (rl_args(self, args, kwds, cells, &n, &t) < 0)
+    return NULL;
+  if (rl_count(self, cells, t) + n > self->limit)
+    Py_RETURN_FALSE;
+  rl_add(self, cells, t, n);
+  Py_RETURN_TRUE;
+}
+
+static char ratelimiter_add_doc[] = "add(key[, n][, now]) -- Counts n (default 1) requests for key whatever the limit and returns its count over the window.";
+
+static PyObject* ratelimiter_add(RateLimiterObject *self, PyObject *args,
+                                 PyObject *kwds) {
+  uint32_t cells[RL_MAX_DEPTH];
+  unsigned int n;
+  uint64_t t;
+
+  if (rl_args(self, args, kwds, cells, &n, &t) < 0)
+    return NULL;
+  rl_add(self, cells, t, n);
+  return PyLong_FromUnsignedLongLong(rl_count(self, cells, t));
+}
+
+static char ratelimiter_count_doc[] = "count(key[, now]) -- Returns the requests counted for key over the window. Like any Count-Min sketch it can overestimate, when other keys share all of its counters, but never underestimates.";
+
+static PyObject* ratelimiter_count(RateLimiterObject *self, PyObject *args,
+                                   PyObject *kwds) {
+  static char *kwlist[] = {"key", "now", NULL};
+  uint32_t cells[RL_MAX_DEPTH];
+  PyObject *key, *owned;
+  const char *ptr;
+  size_t len;
+  double now = -1;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|d", kwlist, &key, &now))
+    return NULL;
+  if (rl_check(self) < 0 || jk_key_bytes(key, &owned, &ptr, &len) < 0)
+    return NULL;
+  rl_cells(self, ptr, len, cells);
+  Py_XDECREF(owned);
+  return PyLong_FromUnsignedLongLong(rl_count(self, cells,
+                                              rl_now(self, now)));
+}
+
+static char ratelimiter_reset_doc[] = "reset() -- Forgets every count, for all processes sharing the file.";
+
+static PyObject* ratelimiter_reset(RateLimiterObject *self) {
+  uint64_t slot;
+
+  if (rl_check(self) < 0)
+    return NULL;
+  for (slot = 0; slot <= self->buckets; ++slot)
+    __atomic_store_n(rl_epoch(self, slot), RL_NEVER,
+                     __ATOMIC_RELEASE);
+  Py_RETURN_NONE;
+}
+
+static PyObject* ratelimiter_get_limit(RateLimiterObject *self,
+                                       void *closure) {
+  return PyLong_FromUnsignedLongLong(self->limit);
+}
+
+static int ratelimiter_set_limit(RateLimiterObject *self, PyObject *value,
+                                 void *closure) {
+  unsigned long long limit;
+
+  if (!value) {
+    PyErr_SetString(PyExc_AttributeError, "cannot delete limit");
+    return -1;
+  }
+  if (!PyArg_Parse(value, "K", &limit))
+    return -1;
+  self->limit = limit;
+  return 0;
+}
+
+static PyObject* ratelimiter_get_window(RateLimiterObject *self,
+                                        void *closure) {
+  return PyFloat_FromDouble((double) self->bucket_ns * self->buckets / 1e9);
+}
+
+static PyObject* ratelimiter_get_memory(RateLimiterObject *self,
+                                        void *closure) {
+  return jk_memory_dict(&self->mem);
+}
+
+/* Open or create the shared file; sets errno, or *why for a bad file. */
+static int rl_open(RateLimiterObject *r, const char *path, const char **why) {
+  struct rl_header want, *have;
+  struct stat st;
+  int fd, rc = -1;
+
+  memset(&want, 0, sizeof(want));
+  memcpy(want.magic, RL_MAGIC, 8);
+  want.width = r->width;
+  want.depth = r->depth;
+  want.buckets = r->buckets;
+  want.bucket_ns = r->bucket_ns;
+  r->grid_size = RL_GRID_HEADER +
+                 (((size_t) r->width * r->depth * sizeof(uint32_t) + 63) &
+                  ~(size_t) 63);
+  r->map_size = RL_GRID_HEADER + (r->buckets + 1) * r->grid_size;
+
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return -1;
+  /* the first process to get here sizes the file and writes the header */
+  if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0)
+    goto done;
+  if (st.st_size == 0) {
+    if (ftruncate(fd, (off_t) r->map_size) < 0)
+      goto done;
+  } else if ((size_t) st.st_size != r->map_size) {
+    *why = "RateLimiter file has a different size";
+    goto done;
+  }
+  r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (r->map == MAP_FAILED) {
+    r->map = NULL;
+    goto done;
+  }
+  have = (struct rl_header *) r->map;
+  if (st.st_size == 0) {
+    uint64_t slot;
+
+    /* no grid matches any time until it is cleared for one */
+    for (slot = 0; slot <= r->buckets; ++slot)
+      *rl_epoch(r, slot) = RL_NEVER;
+    memcpy(have, &want, sizeof(want));
+  } else if (memcmp(have, &want, sizeof(want)) != 0) {
+    *why = "RateLimiter file was created with different settings";
+    munmap(r->map, r->map_size);
+    r->map = NULL;
+    goto done;
+  }
+  jk_memory_mapped(&r->mem, (ssize_t) r->map_size);
+  jk_memory_live(&r->mem, (ssize_t) r->map_size);
+  rc = 0;
+
+done:
+  /* the header is in place; the mapping does not need the descriptor */
+  flock(fd, LOCK_UN);
+  close(fd);
+  return rc;
+}
+
+static int ratelimiter_init(RateLimiterObject *self, PyObject *args,
+                            PyObject *kwds) {
+  static char *kwlist[] = {"path", "limit", "window", "buckets", "width",
+                           "depth", NULL};
+  unsigned long long limit;
+  unsigned int buckets = RL_BUCKETS, width = RL_WIDTH, depth = RL_DEPTH;
+  double window = 1.0;
+  const char *why = NULL;
+  PyObject *path;
+  int rc;
+
+#if PY_MAJOR_VERSION >= 3
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&K|dIII", kwlist,
+                                   PyUnicode_FSConverter, &path, &limit,
+                                   &window, &buckets, &width, &depth))
+    return -1;
+#else
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "SK|dIII", kwlist, &path,
+                                   &limit, &window, &buckets, &width, &depth))
+    return -1;
+  Py_INCREF(path);
+#endif
+  if (self->path) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_RuntimeError, "RateLimiter already initialized");
+    return -1;
+  }
+  self->path = path;
+  if (!(window > 0) || buckets < 1 || buckets > RL_MAX_BUCKETS ||
+      window * 1e9 / buckets < 1) {
+    PyErr_Format(PyExc_ValueError, "window must be positive and buckets "
+                 "in 1..%d", RL_MAX_BUCKETS);
+    return -1;
+  }
+  if (width < 2 || (width & (width - 1)) || depth < 1 ||
+      depth > RL_MAX_DEPTH) {
+    PyErr_Format(PyExc_ValueError, "width must be a power of two and depth "
+                 "in 1..%d", RL_MAX_DEPTH);
+    return -1;
+  }
+  self->limit = limit;
+  self->width = width;
+  self->depth = depth;
+  self->buckets = buckets;
+  self->bucket_ns = (uint64_t) (window * 1e9 / buckets);
+  if (jk_memory_init(&self->mem, "RateLimiter", Py_None, Py_None) < 0)
+    return -1;
+
+  Py_BEGIN_ALLOW_THREADS
+  rc = rl_open(self, PyBytes_AS_STRING(path), &why);
+  Py_END_ALLOW_THREADS
+  if (rc == 0)
+    return 0;
+  if (why)
+    PyErr_Format(PyExc_ValueError, "%s: %s", why, PyBytes_AS_STRING(path));
+  else
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(path));
+  return -1;
+}
+
+static void ratelimiter_dealloc(RateLimiterObject *self) {
+  if (self->mem.owner) {
+    if (self->map) {
+      munmap(self->map, self->map_size);
+      jk_memory_mapped(&self->mem, -(ssize_t) self->map_size);
+    }
+    jk_memory_free(&self->mem);
+  }
+  Py_XDECREF(self->path);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef ratelimiter_methods[] = {
+  {"hit",   (PyCFunction) ratelimiter_hit,   METH_VARARGS | METH_KEYWORDS,
+   ratelimiter_hit_doc},
+  {"add",   (PyCFunction) ratelimiter_add,   METH_VARARGS | METH_KEYWORDS,
+   ratelimiter_add_doc},
+  {"count", (PyCFunction) ratelimiter_count, METH_VARARGS | METH_KEYWORDS,
+   ratelimiter_count_doc},
+  {"reset", (PyCFunction) ratelimiter_reset, METH_NOARGS,
+   ratelimiter_reset_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef ratelimiter_getset[] = {
+  {"limit",  (getter) ratelimiter_get_limit,
+   (setter) ratelimiter_set_limit,
+   "Requests allowed per key per window, for this process.", NULL},
+  {"window", (getter) ratelimiter_get_window, NULL,
+   "Window length in seconds.", NULL},
+  {"memory", (getter) ratelimiter_get_memory, NULL,
+   "This limiter's entry in memory_usage().", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static char ratelimiter_type_doc[] = "RateLimiter(path, limit, window=1.0, buckets=10, width=65536, depth=4) -- Sliding-window per-key request counts in a file mapped shared by every process that opens it (put it in /dev/shm). Counts live in a Count-Min grid of depth rows of width counters per bucket and are updated with atomic instructions, without locks. Processes sharing a file must pass the same window, buckets, width and depth.";
+
+static PyTypeObject RateLimiterType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.RateLimiter",          /* tp_name */
+  sizeof(RateLimiterObject),      /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) ratelimiter_dealloc, /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  0,                              /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  ratelimiter_type_doc,           /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  ratelimiter_methods,            /* tp_methods */
+  0,                              /* tp_members */
+  ratelimiter_getset,             /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) ratelimiter_init,    /* tp_init */
+  0,                              /* tp_alloc */
+  PyType_GenericNew,              /* tp_new */
+};
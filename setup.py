@@ -1,6 +1,34 @@
+import os
+
 from distutils.core import setup, Extension
 
-mod = Extension("jenkins", sources=["jenkins.c"])
+macros = []
+include_dirs = []
+
+# Opt-in runtime counters, see instrument.c and jenkins.stats()
+if os.environ.get("JENKINS_STATS"):
+    macros.append(("JENKINS_STATS", "1"))
+
+# The *_array functions are built when NumPy is present; it stays optional
+# at run time.
+try:
+    import numpy
+except ImportError:
+    numpy = None
+if numpy is not None and not os.environ.get("JENKINS_NO_NUMPY"):
+    macros.append(("JENKINS_NUMPY", "1"))
+    include_dirs.append(numpy.get_include())
+
+mod = Extension("jenkins", sources=["jenkins.c"],
+                define_macros=macros,
+                libraries=["z"],
+                include_dirs=include_dirs,
+                depends=["lookup3.c", "oneatatime.c", "instrument.c",
+                         "profile.c", "arrays.c", "hll.c", "batch.c", "alloc.c",
+                         "sketch.c", "filehash.c", "stream.c",
+                         "gzhash.c", "logstore.c", "multiset.c",
+                         "blockfile.c", "ratelimit.c", "iblt.c",
+                         "priority.c", "ingest.c"])
 
 setup(name = "Jenkins",
       version = "0.33",
@@ -0,0 +1,717 @@
+/*
+  HLLArena: many HyperLogLog sketches (see hll.c) kept in one arena.
+
+  Keeping one Python object per (campaign, hour) group costs a PyObject
+  header, a separate allocation and a method dispatch per update.  An
+  arena holds ngroups sketches of the same precision.  Every group starts
+  sparse, as a sorted array of (register << 8 | rank) words, and switches
+  to 2^p dense registers once the sparse form would pass an eighth of
+  that size, so that groups with a handful of keys cost a few bytes.
+
+  Sketch storage comes from a jk_arena (see alloc.c), so it can be put
+  on huge pages or in a backing file and shows up in memory_usage().
+  Sparse blocks double as they grow; the block they leave behind goes on
+  a free list for its size class and is reused by the next group that
+  needs one.  Nothing is returned to the system until clear() or the
+  arena is freed.
+
+  update(group_codes, keys) hashes all keys with hashlittle2 and then
+  scatters the register updates.  Both phases run with the GIL released;
+  for large batches the hashing is split across threads by key range and
+  the scatter by group (thread t owns groups with code % nt == t), so no
+  two threads touch the same sketch.
+
+  Everything that reads or writes the groups does so under groups_lock,
+  taken with the GIL released, so that calls from several Python threads
+  (an update racing a clear() that unmaps the arena, say) are serialized.
+ */
+
+#define HLL_SPARSE_MIN    4            /* smallest sparse block, in entries */
+#define HLL_SIZE_CLASSES  32
+
+struct hll_group {
+  uint8_t *data;            /* NULL while empty */
+  uint32_t count;           /* sparse entries in use */
+  uint32_t cap;             /* sparse capacity, 0 once dense */
+};
+
+typedef struct {
+  PyObject_HEAD
+  int p;
+  Py_ssize_t ngroups;
+  struct hll_group *groups;
+  size_t groups_size;                    /* bytes mapped for groups */
+  struct jk_memory mem;
+  struct jk_arena arena;
+  void *free_blocks[HLL_SIZE_CLASSES];   /* singly linked through the block */
+  pthread_mutex_t lock;                  /* allocator only */
+  pthread_mutex_t groups_lock;           /* groups, held without the GIL */
+} HLLArenaObject;
+
+static int hll_size_class(size_t bytes) {
+  int c = 0;
+
+  while (((size_t) 1 << c) < bytes)
+    ++c;
+  return c;
+}
+
+/* Allocate a block of 2^c bytes; callable without the GIL. */
+static void *hll_arena_alloc(HLLArenaObject *a, int c) {
+  void *block;
+
+  pthread_mutex_lock(&a->lock);
+  block = a->free_blocks[c];
+  if (block)
+    a->free_blocks[c] = *(void **) block;
+  else
+    block = jk_arena_alloc(&a->arena, (size_t) 1 << c);
+  pthread_mutex_unlock(&a->lock);
+  if (block)
+    jk_memory_live(&a->mem, (ssize_t) 1 << c);
+  return block;
+}
+
+static void hll_arena_release(HLLArenaObject *a, void *block, int c) {
+  pthread_mutex_lock(&a->lock);
+  *(void **) block = a->free_blocks[c];
+  a->free_blocks[c] = block;
+  pthread_mutex_unlock(&a->lock);
+  jk_memory_live(&a->mem, -((ssize_t) 1 << c));
+}
+
+static void hll_arena_reset(HLLArenaObject *a) {
+  jk_arena_reset(&a->arena);
+  memset(a->free_blocks, 0, sizeof(a->free_blocks));
+  if (a->groups)
+    memset(a->groups, 0, a->ngroups * sizeof(struct hll_group));
+  a->mem.live = a->ngroups * sizeof(struct hll_group);
+}
+
+static int hll_group_dense(const HLLArenaObject *a, const struct hll_group *g) {
+  return g->data && g->cap == 0;
+}
+
+/* Switch a sparse group to dense registers. */
+static int hll_group_densify(HLLArenaObject *a, struct hll_group *g) {
+  uint8_t *regs = hll_arena_alloc(a, a->p);
+  const uint32_t *sparse = (const uint32_t *) g->data;
+  uint32_t i;
+
+  if (!regs)
+    return -1;
+  memset(regs, 0, hll_registers(a->p));
+  for (i = 0; i < g->count; ++i)
+    regs[sparse[i] >> 8] = (uint8_t) sparse[i];
+  if (g->data)
+    hll_arena_release(a, g->data, hll_size_class(g->cap * sizeof(uint32_t)));
+  g->data = regs;
+  g->cap = 0;
+  g->count = 0;
+  return 0;
+}
+
+/* Add one hash to a group; callable without the GIL. */
+static int hll_group_add(HLLArenaObject *a, struct hll_group *g, uint64_t h) {
+  uint32_t *sparse, entry, lo, hi;
+  size_t index;
+  uint8_t rank;
+
+  if (hll_group_dense(a, g)) {
+    hll_add_hash(g->data, a->p, h);
+    return 0;
+  }
+  hll_split(h, a->p, &index, &rank);
+
+  /* binary search the sparse entries, ordered by register */
+  sparse = (uint32_t *) g->data;
+  lo = 0;
+  hi = g->count;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if ((sparse[mid] >> 8) < index)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  entry = ((uint32_t) index << 8) | rank;
+  if (lo < g->count && (sparse[lo] >> 8) == index) {
+    if ((uint8_t) sparse[lo] < rank)
+      sparse[lo] = entry;
+    return 0;
+  }
+
+  if (g->count == g->cap) {
+    uint32_t cap = g->cap ? g->cap * 2 : HLL_SPARSE_MIN;
+    uint32_t *grown;
+
+    if ((size_t) cap * sizeof(uint32_t) > hll_registers(a->p) / 8) {
+      if (hll_group_densify(a, g) < 0)
+        return -1;
+      g->data[index] = rank;
+      return 0;
+    }
+    grown = hll_arena_alloc(a, hll_size_class(cap * sizeof(uint32_t)));
+    if (!grown)
+      return -1;
+    if (g->count)
+      memcpy(grown, sparse, g->count * sizeof(uint32_t));
+    if (g->data)
+      hll_arena_release(a, g->data,
+                        hll_size_class(g->cap * sizeof(uint32_t)));
+    g->data = (uint8_t *) grown;
+    g->cap = cap;
+    sparse = grown;
+  }
+
+  memmove(sparse + lo + 1, sparse + lo, (g->count - lo) * sizeof(uint32_t));
+  sparse[lo] = entry;
+  ++g->count;
+  return 0;
+}
+
+/* Dense registers of a group into regs (2^p bytes). */
+static void hll_group_registers(const HLLArenaObject *a,
+                                const struct hll_group *g, uint8_t *regs) {
+  const uint32_t *sparse = (const uint32_t *) g->data;
+  uint32_t i;
+
+  if (hll_group_dense(a, g)) {
+    memcpy(regs, g->data, hll_registers(a->p));
+    return;
+  }
+  memset(regs, 0, hll_registers(a->p));
+  for (i = 0; i < g->count; ++i)
+    regs[sparse[i] >> 8] = (uint8_t) sparse[i];
+}
+
+static double hll_group_estimate(const HLLArenaObject *a,
+                                 const struct hll_group *g, uint8_t *scratch) {
+  double m = (double) hll_registers(a->p);
+
+  if (!g->data)
+    return 0.0;
+  /* below the dense threshold linear counting is what hll_estimate uses */
+  if (!hll_group_dense(a, g))
+    return g->count ? m * log(m / (m - g->count)) : 0.0;
+  hll_group_registers(a, g, scratch);
+  return hll_estimate(scratch, a->p);
+}
+
+struct hll_update {
+  HLLArenaObject *arena;
+  struct jk_keys *keys;
+  const uint64_t *codes;
+  uint64_t *hashes;
+  int failed;
+};
+
+static void hll_update_hash(void *ctx, int t, int nt) {
+  struct hll_update *u = (struct hll_update *) ctx;
+  Py_ssize_t i, lo, hi;
+
+  jk_share(u->keys->n, t, nt, &lo, &hi);
+  for (i = lo; i < hi; ++i)
+    u->hashes[i] = hll_hash(u->keys->ptr[i], u->keys->len[i]);
+}
+
+static void hll_update_scatter(void *ctx, int t, int nt) {
+  struct hll_update *u = (struct hll_update *) ctx;
+  Py_ssize_t i;
+
+  for (i = 0; i < u->keys->n; ++i) {
+    uint64_t code = u->codes[i];
+
+    if (nt > 1 && (int) (code % (uint64_t) nt) != t)
+      continue;
+    if (hll_group_add(u->arena, &u->arena->groups[code], u->hashes[i]) < 0)
+      u->failed = 1;
+  }
+}
+
+static char hllarena_update_doc[] = "update(group_codes, keys[, threads]) -- Adds each key to the sketch of the group with the matching code. group_codes is a sequence or integer buffer (array.array, NumPy array) of the same length as keys; keys are bytes, unicode (hashed as UTF-8) or buffers. threads=0 picks a thread count from the number of CPUs; small batches always run on one thread.";
+
+static PyObject* hllarena_update(HLLArenaObject *self, PyObject *args,
+                                 PyObject *kwds) {
+  static char *kwlist[] = {"group_codes", "keys", "threads", NULL};
+  PyObject *codes_obj, *keys_obj;
+  struct hll_update u;
+  struct jk_keys keys;
+  uint64_t *codes;
+  Py_ssize_t ncodes, i;
+  int threads = 0, nt;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|i", kwlist,
+                                   &codes_obj, &keys_obj, &threads))
+    return NULL;
+
+  codes = jk_ints_get(codes_obj, &ncodes);
+  if (!codes)
+    return NULL;
+  if (jk_keys_get(keys_obj, &keys) < 0) {
+    free(codes);
+    return NULL;
+  }
+  if (ncodes != keys.n) {
+    PyErr_SetString(PyExc_ValueError,
+                    "group_codes and keys must have the same length");
+    goto fail;
+  }
+  for (i = 0; i < ncodes; ++i) {
+    if (codes[i] >= (uint64_t) self->ngroups) {
+      PyErr_Format(PyExc_ValueError, "group code %llu out of range",
+                   (unsigned long long) codes[i]);
+      goto fail;
+    }
+  }
+
+  u.arena = self;
+  u.keys = &keys;
+  u.codes = codes;
+  u.failed = 0;
+  u.hashes = malloc((keys.n ? keys.n : 1) * sizeof(uint64_t));
+  if (!u.hashes) {
+    PyErr_NoMemory();
+    goto fail;
+  }
+
+  nt = jk_thread_count(keys.n, threads);
+  Py_BEGIN_ALLOW_THREADS
+  JK_ENTER_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  jk_parallel(nt, hll_update_hash, &u);
+  JK_EXIT_BATCH(JK_HASHLITTLE2_BATCH, keys.bytes, keys.n);
+  pthread_mutex_lock(&self->groups_lock);
+  jk_parallel(nt, hll_update_scatter, &u);
+  pthread_mutex_unlock(&self->groups_lock);
+  Py_END_ALLOW_THREADS
+
+  free(u.hashes);
+  free(codes);
+  jk_keys_release(&keys);
+  if (u.failed)
+    return PyErr_NoMemory();
+  Py_RETURN_NONE;
+
+fail:
+  free(codes);
+  jk_keys_release(&keys);
+  return NULL;
+}
+
+/* A new array.array of the given typecode holding size bytes of values. */
+static PyObject* jk_array(const char *typecode, const void *values,
+                          Py_ssize_t size) {
+  PyObject *module, *array, *bytes, *r;
+
+  module = PyImport_ImportModule("array");
+  if (!module)
+    return NULL;
+  array = PyObject_CallMethod(module, "array", "s", typecode);
+  Py_DECREF(module);
+  if (!array)
+    return NULL;
+
+  bytes = PyBytes_FromStringAndSize((const char *) values, size);
+  if (!bytes) {
+    Py_DECREF(array);
+    return NULL;
+  }
+#if PY_MAJOR_VERSION >= 3
+  r = PyObject_CallMethod(array, "frombytes", "O", bytes);
+#else
+  r = PyObject_CallMethod(array, "fromstring", "O", bytes);
+#endif
+  Py_DECREF(bytes);
+  if (!r) {
+    Py_DECREF(array);
+    return NULL;
+  }
+  Py_DECREF(r);
+  return array;
+}
+
+/* A new array.array of doubles holding n values. */
+static PyObject* jk_double_array(const double *values, Py_ssize_t n) {
+  return jk_array("d", values, n * (Py_ssize_t) sizeof(double));
+}
+
+static char hllarena_estimate_doc[] = "estimate([group_codes]) -- Returns an array.array('d') of distinct count estimates, for every group or for the given groups.";
+
+static PyObject* hllarena_estimate(HLLArenaObject *self, PyObject *args) {
+  PyObject *codes_obj = NULL, *result;
+  uint64_t *codes = NULL;
+  Py_ssize_t n, i;
+  uint8_t *scratch;
+  double *values;
+
+  if (!PyArg_ParseTuple(args, "|O", &codes_obj))
+    return NULL;
+
+  if (codes_obj && codes_obj != Py_None) {
+    codes = jk_ints_get(codes_obj, &n);
+    if (!codes)
+      return NULL;
+    for (i = 0; i < n; ++i) {
+      if (codes[i] >= (uint64_t) self->ngroups) {
+        free(codes);
+        return PyErr_Format(PyExc_ValueError, "group code %llu out of range",
+                            (unsigned long long) codes[i]);
+      }
+    }
+  } else {
+    n = self->ngroups;
+  }
+
+  values = malloc((n ? n : 1) * sizeof(double));
+  scratch = malloc(hll_registers(self->p));
+  if (!values || !scratch) {
+    free(values);
+    free(scratch);
+    free(codes);
+    return PyErr_NoMemory();
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->groups_lock);
+  for (i = 0; i < n; ++i)
+    values[i] = hll_group_estimate(self,
+                                   &self->groups[codes ? (Py_ssize_t) codes[i]
+                                                       : i],
+                                   scratch);
+  pthread_mutex_unlock(&self->groups_lock);
+  Py_END_ALLOW_THREADS
+
+  result = jk_double_array(values, n);
+  free(values);
+  free(scratch);
+  free(codes);
+  return result;
+}
+
+static char hllarena_union_doc[] = "union_estimate(group_codes) -- Returns the distinct count estimate of the union of the given groups, e.g. one campaign over several hours.";
+
+static PyObject* hllarena_union(HLLArenaObject *self, PyObject *args) {
+  PyObject *codes_obj;
+  uint64_t *codes;
+  Py_ssize_t n, i;
+  uint8_t *regs, *scratch;
+  double estimate;
+
+  if (!PyArg_ParseTuple(args, "O", &codes_obj))
+    return NULL;
+  codes = jk_ints_get(codes_obj, &n);
+  if (!codes)
+    return NULL;
+  for (i = 0; i < n; ++i) {
+    if (codes[i] >= (uint64_t) self->ngroups) {
+      free(codes);
+      return PyErr_Format(PyExc_ValueError, "group code %llu out of range",
+                          (unsigned long long) codes[i]);
+    }
+  }
+
+  regs = calloc(1, hll_registers(self->p));
+  scratch = malloc(hll_registers(self->p));
+  if (!regs || !scratch) {
+    free(regs);
+    free(scratch);
+    free(codes);
+    return PyErr_NoMemory();
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->groups_lock);
+  for (i = 0; i < n; ++i) {
+    const struct hll_group *g = &self->groups[codes[i]];
+    if (!g->data)
+      continue;
+    hll_group_registers(self, g, scratch);
+    hll_merge(regs, scratch, self->p);
+  }
+  pthread_mutex_unlock(&self->groups_lock);
+  estimate = hll_estimate(regs, self->p);
+  Py_END_ALLOW_THREADS
+
+  free(regs);
+  free(scratch);
+  free(codes);
+  return PyFloat_FromDouble(estimate);
+}
+
+static PyTypeObject HLLArenaType;
+
+static char hllarena_merge_doc[] = "merge(other) -- Merges every group of another arena with the same number of groups and precision into this one.";
+
+static PyObject* hllarena_merge(HLLArenaObject *self, PyObject *args) {
+  HLLArenaObject *other;
+  Py_ssize_t gi;
+  int failed = 0;
+
+  if (!PyArg_ParseTuple(args, "O!", &HLLArenaType, &other))
+    return NULL;
+  if (other->ngroups != self->ngroups || other->p != self->p) {
+    PyErr_SetString(PyExc_ValueError,
+                    "arenas differ in number of groups or precision");
+    return NULL;
+  }
+  if (other == self)
+    Py_RETURN_NONE;
+
+  Py_BEGIN_ALLOW_THREADS
+  /* in address order, so that a.merge(b) and b.merge(a) cannot deadlock */
+  pthread_mutex_lock(self < other ? &self->groups_lock : &other->groups_lock);
+  pthread_mutex_lock(self < other ? &other->groups_lock : &self->groups_lock);
+  for (gi = 0; gi < self->ngroups && !failed; ++gi) {
+    const struct hll_group *src = &other->groups[gi];
+    struct hll_group *dst = &self->groups[gi];
+    uint32_t i;
+
+    if (!src->data)
+      continue;
+    if (hll_group_dense(other, src)) {
+      if (!hll_group_dense(self, dst) && hll_group_densify(self, dst) < 0) {
+        failed = 1;
+        break;
+      }
+      hll_merge(dst->data, src->data, self->p);
+      continue;
+    }
+    for (i = 0; i < src->count; ++i) {
+      uint32_t e = ((const uint32_t *) src->data)[i];
+      /* rebuild a hash that lands on the same register with the same rank */
+      uint64_t h = ((uint64_t) (e >> 8) << (64 - self->p)) |
+                   (((uint64_t) 1 << (64 - self->p)) >> (uint8_t) e);
+      if (hll_group_add(self, dst, h) < 0) {
+        failed = 1;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&other->groups_lock);
+  pthread_mutex_unlock(&self->groups_lock);
+  Py_END_ALLOW_THREADS
+
+  if (failed)
+    return PyErr_NoMemory();
+  Py_RETURN_NONE;
+}
+
+static char hllarena_sketch_doc[] = "sketch(group_code) -- Returns the group's sketch serialized as bytes, in the format read by jenkins_hll_estimate() and jenkins_hll_merge() in the SQLite extension.";
+
+static PyObject* hllarena_sketch(HLLArenaObject *self, PyObject *args) {
+  Py_ssize_t code;
+  PyObject *result;
+  uint8_t *buf;
+
+  if (!PyArg_ParseTuple(args, "n", &code))
+    return NULL;
+  if (code < 0 || code >= self->ngroups) {
+    PyErr_SetString(PyExc_IndexError, "group code out of range");
+    return NULL;
+  }
+
+  result = PyBytes_FromStringAndSize(NULL, hll_size(self->p));
+  if (!result)
+    return NULL;
+  buf = (uint8_t *) PyBytes_AS_STRING(result);
+  buf[0] = HLL_VERSION;
+  buf[1] = (uint8_t) self->p;
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->groups_lock);
+  hll_group_registers(self, &self->groups[code], buf + HLL_HEADER);
+  pthread_mutex_unlock(&self->groups_lock);
+  Py_END_ALLOW_THREADS
+  return result;
+}
+
+static char hllarena_load_doc[] = "load(group_code, sketch) -- Merges a serialized sketch of the same precision, as returned by sketch(), into a group.";
+
+static PyObject* hllarena_load(HLLArenaObject *self, PyObject *args) {
+  const uint8_t *buf;
+  Py_ssize_t code, len;
+  struct hll_group *g;
+  int failed = 0;
+
+  if (!PyArg_ParseTuple(args, "ns#", &code, &buf, &len))
+    return NULL;
+  if (code < 0 || code >= self->ngroups) {
+    PyErr_SetString(PyExc_IndexError, "group code out of range");
+    return NULL;
+  }
+  if (hll_check(buf, (size_t) len) != self->p) {
+    PyErr_SetString(PyExc_ValueError,
+                    "not a sketch of the arena's precision");
+    return NULL;
+  }
+
+  g = &self->groups[code];
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->groups_lock);
+  if (hll_group_dense(self, g) || hll_group_densify(self, g) == 0)
+    hll_merge(g->data, buf + HLL_HEADER, self->p);
+  else
+    failed = 1;
+  pthread_mutex_unlock(&self->groups_lock);
+  Py_END_ALLOW_THREADS
+
+  if (failed)
+    return PyErr_NoMemory();
+  Py_RETURN_NONE;
+}
+
+static char hllarena_clear_doc[] = "clear() -- Empties every group and frees the arena's memory.";
+
+static PyObject* hllarena_clear(HLLArenaObject *self) {
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&self->groups_lock);
+  hll_arena_reset(self);
+  pthread_mutex_unlock(&self->groups_lock);
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+static PyObject* hllarena_get_memory(HLLArenaObject *self, void *closure) {
+  return jk_memory_dict(&self->mem);
+}
+
+static PyObject* hllarena_get_p(HLLArenaObject *self, void *closure) {
+  return PyLong_FromLong(self->p);
+}
+
+static Py_ssize_t hllarena_len(HLLArenaObject *self) {
+  return self->ngroups;
+}
+
+static int hllarena_init(HLLArenaObject *self, PyObject *args,
+                         PyObject *kwds) {
+  static char *kwlist[] = {"ngroups", "p", "huge_pages", "path", NULL};
+  PyObject *huge_pages = Py_None, *path = Py_None;
+  Py_ssize_t ngroups;
+  int p = HLL_DEFAULT_P;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "n|iOO", kwlist, &ngroups, &p,
+                                   &huge_pages, &path))
+    return -1;
+  if (ngroups < 0) {
+    PyErr_SetString(PyExc_ValueError, "ngroups must not be negative");
+    return -1;
+  }
+  if (p < HLL_MIN_P || p > HLL_MAX_P) {
+    PyErr_Format(PyExc_ValueError, "p must be in %d..%d",
+                 HLL_MIN_P, HLL_MAX_P);
+    return -1;
+  }
+  if (self->groups) {
+    PyErr_SetString(PyExc_RuntimeError, "HLLArena already initialized");
+    return -1;
+  }
+
+  if (jk_memory_init(&self->mem, "HLLArena", huge_pages, path) < 0)
+    return -1;
+  jk_arena_init(&self->arena, &self->mem);
+  self->groups_size = (ngroups ? ngroups : 1) * sizeof(struct hll_group);
+  self->groups = jk_map(&self->mem, &self->groups_size);
+  if (!self->groups) {
+    PyErr_SetFromErrno(PyExc_MemoryError);
+    return -1;
+  }
+  jk_memory_live(&self->mem, ngroups * sizeof(struct hll_group));
+  self->ngroups = ngroups;
+  self->p = p;
+  return 0;
+}
+
+static PyObject* hllarena_new(PyTypeObject *type, PyObject *args,
+                              PyObject *kwds) {
+  HLLArenaObject *self = (HLLArenaObject *) type->tp_alloc(type, 0);
+
+  if (!self)
+    return NULL;
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_mutex_init(&self->groups_lock, NULL);
+  return (PyObject *) self;
+}
+
+static void hllarena_dealloc(HLLArenaObject *self) {
+  if (self->mem.owner) {
+    jk_arena_reset(&self->arena);
+    jk_unmap(&self->mem, self->groups, self->groups_size);
+    jk_memory_free(&self->mem);
+  }
+  pthread_mutex_destroy(&self->lock);
+  pthread_mutex_destroy(&self->groups_lock);
+  Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef hllarena_methods[] = {
+  {"update",         (PyCFunction) hllarena_update,
+   METH_VARARGS | METH_KEYWORDS, hllarena_update_doc},
+  {"estimate",       (PyCFunction) hllarena_estimate, METH_VARARGS,
+   hllarena_estimate_doc},
+  {"union_estimate", (PyCFunction) hllarena_union,    METH_VARARGS,
+   hllarena_union_doc},
+  {"merge",          (PyCFunction) hllarena_merge,    METH_VARARGS,
+   hllarena_merge_doc},
+  {"sketch",         (PyCFunction) hllarena_sketch,   METH_VARARGS,
+   hllarena_sketch_doc},
+  {"load",           (PyCFunction) hllarena_load,     METH_VARARGS,
+   hllarena_load_doc},
+  {"clear",          (PyCFunction) hllarena_clear,    METH_NOARGS,
+   hllarena_clear_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef hllarena_getset[] = {
+  {"p",      (getter) hllarena_get_p,      NULL,
+   "Precision: each dense sketch has 2**p registers.", NULL},
+  {"memory", (getter) hllarena_get_memory, NULL,
+   "This arena's entry in memory_usage().", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PySequenceMethods hllarena_as_sequence = {
+  (lenfunc) hllarena_len,         /* sq_length */
+};
+
+static char hllarena_type_doc[] = "HLLArena(ngroups, p=14, huge_pages=None, path=None) -- ngroups HyperLogLog sketches of precision p, stored sparse-to-dense in one arena and updated in batches of (group code, key) pairs. huge_pages and path choose where the memory comes from, see memory_usage().";
+
+static PyTypeObject HLLArenaType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "jenkins.HLLArena",             /* tp_name */
+  sizeof(HLLArenaObject),         /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor) hllarena_dealloc,  /* tp_dealloc */
+  0,                              /* tp_print */
+  0,                              /* tp_getattr */
+  0,                              /* tp_setattr */
+  0,                              /* tp_compare */
+  0,                              /* tp_repr */
+  0,                              /* tp_as_number */
+  &hllarena_as_sequence,          /* tp_as_sequence */
+  0,                              /* tp_as_mapping */
+  0,                              /* tp_hash */
+  0,                              /* tp_call */
+  0,                              /* tp_str */
+  0,                              /* tp_getattro */
+  0,                              /* tp_setattro */
+  0,                              /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,             /* tp_flags */
+  hllarena_type_doc,              /* tp_doc */
+  0,                              /* tp_traverse */
+  0,                              /* tp_clear */
+  0,                              /* tp_richcompare */
+  0,                              /* tp_weaklistoffset */
+  0,                              /* tp_iter */
+  0,                              /* tp_iternext */
+  hllarena_methods,               /* tp_methods */
+  0,                              /* tp_members */
+  hllarena_getset,                /* tp_getset */
+  0,                              /* tp_base */
+  0,                              /* tp_dict */
+  0,                              /* tp_descr_get */
+  0,                              /* tp_descr_set */
+  0,                              /* tp_dictoffset */
+  (initproc) hllarena_init,       /* tp_init */
+  0,                              /* tp_alloc */
+  hllarena_new,                   /* tp_new */
+};
@@ -0,0 +1,275 @@
+/*
+  SQLite loadable extension exposing the lookup3 and one-at-a-time hashes.
+
+    .load ./jenkins                        (sqlite3 shell)
+    SELECT load_extension('./jenkins');
+
+  Scalar functions:
+
+    jenkins_hashlittle(x [, seed])          32-bit hashlittle()
+    jenkins_hashlittle2_64(x [, c [, b]])   pc + (pb << 32) from hashlittle2(),
+                                            as a signed 64-bit integer
+    jenkins_oneatatime(x)                   32-bit one-at-a-time hash
+    jenkins_bucket(x, n)                    hashlittle(x, 0) % n, in [0, n)
+    jenkins_hll_estimate(sketch)            distinct count of a sketch
+
+  Aggregates:
+
+    jenkins_hll(x [, p])                    HyperLogLog sketch of x as a blob
+    jenkins_hll_count(x [, p])              estimated number of distinct x
+    jenkins_hll_merge(sketch)               union of sketches
+
+  Values are hashed as their bytes: BLOBs as they are, TEXT as UTF-8,
+  INTEGERs as 8 little-endian bytes and REALs as their 8 IEEE-754 bytes,
+  little-endian.  So jenkins_hashlittle(x'616263') equals
+  jenkins.hashlittle(b'abc') in Python, and jenkins_hashlittle(5) equals
+  jenkins.hashlittle_array(numpy.int64(5)).  NULL hashes to NULL and is
+  skipped by the aggregates.
+
+  Every function is registered SQLITE_DETERMINISTIC and, having no side
+  effects, SQLITE_INNOCUOUS, so the scalar ones can be used in indexes on
+  expressions, generated columns and CHECK constraints, also with the
+  default trusted_schema=0.
+ */
+#include <string.h>
+
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+
+#include "../lookup3.c"
+#include "../oneatatime.c"
+#include "../hll.c"
+
+/* Bytes to hash for a value; returns NULL for SQL NULL. */
+static const void *value_key(sqlite3_value *v, uint8_t scratch[8],
+                             size_t *len) {
+  sqlite3_int64 i;
+  double d;
+  uint64_t u;
+  int b;
+
+  switch (sqlite3_value_type(v)) {
+  case SQLITE_INTEGER:
+    i = sqlite3_value_int64(v);
+    memcpy(&u, &i, 8);
+    break;
+  case SQLITE_FLOAT:
+    d = sqlite3_value_double(v);
+    memcpy(&u, &d, 8);
+    break;
+  case SQLITE_TEXT:
+    *len = (size_t) sqlite3_value_bytes(v);
+    return sqlite3_value_text(v);
+  case SQLITE_BLOB:
+    /* sqlite3_value_blob() returns NULL for an empty blob */
+    *len = (size_t) sqlite3_value_bytes(v);
+    return *len ? sqlite3_value_blob(v) : (const void *) scratch;
+  default:
+    return NULL;
+  }
+
+  for (b = 0; b < 8; ++b)
+    scratch[b] = (uint8_t) (u >> (8 * b));
+  *len = 8;
+  return scratch;
+}
+
+static uint32_t arg_u32(sqlite3_value **argv, int argc, int i) {
+  return i < argc ? (uint32_t) sqlite3_value_int64(argv[i]) : 0;
+}
+
+static void hashlittle_func(sqlite3_context *ctx, int argc,
+                            sqlite3_value **argv) {
+  uint8_t scratch[8];
+  size_t len;
+  const void *key = value_key(argv[0], scratch, &len);
+
+  if (!key)
+    return;
+  sqlite3_result_int64(ctx, hashlittle(key, len, arg_u32(argv, argc, 1)));
+}
+
+static void hashlittle2_64_func(sqlite3_context *ctx, int argc,
+                                sqlite3_value **argv) {
+  uint8_t scratch[8];
+  size_t len;
+  const void *key = value_key(argv[0], scratch, &len);
+  uint32_t pc = arg_u32(argv, argc, 1), pb = arg_u32(argv, argc, 2);
+  uint64_t h;
+  sqlite3_int64 r;
+
+  if (!key)
+    return;
+  hashlittle2(key, len, &pc, &pb);
+  h = pc + (((uint64_t) pb) << 32);
+  memcpy(&r, &h, 8);
+  sqlite3_result_int64(ctx, r);
+}
+
+static void oneatatime_func(sqlite3_context *ctx, int argc,
+                            sqlite3_value **argv) {
+  uint8_t scratch[8];
+  size_t len;
+  const void *key = value_key(argv[0], scratch, &len);
+
+  if (!key)
+    return;
+  sqlite3_result_int64(ctx, one_at_a_time((const char *) key, len));
+}
+
+static void bucket_func(sqlite3_context *ctx, int argc,
+                        sqlite3_value **argv) {
+  uint8_t scratch[8];
+  size_t len;
+  const void *key = value_key(argv[0], scratch, &len);
+  sqlite3_int64 n = sqlite3_value_int64(argv[1]);
+
+  if (!key)
+    return;
+  if (n <= 0 || n > 0xffffffffLL) {
+    sqlite3_result_error(ctx, "jenkins_bucket: n must be in 1..2^32-1", -1);
+    return;
+  }
+  sqlite3_result_int64(ctx, hashlittle(key, len, 0) % (uint64_t) n);
+}
+
+static void hll_estimate_func(sqlite3_context *ctx, int argc,
+                              sqlite3_value **argv) {
+  const uint8_t *buf = sqlite3_value_blob(argv[0]);
+  int p;
+
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+    return;
+  p = hll_check(buf, (size_t) sqlite3_value_bytes(argv[0]));
+  if (p < 0) {
+    sqlite3_result_error(ctx, "jenkins_hll_estimate: not a sketch", -1);
+    return;
+  }
+  sqlite3_result_int64(ctx, (sqlite3_int64)
+                            (hll_estimate(buf + HLL_HEADER, p) + 0.5));
+}
+
+/* Aggregate state: a serialized sketch, allocated on the first row. */
+static uint8_t *hll_state(sqlite3_context *ctx, int p) {
+  uint8_t **state = sqlite3_aggregate_context(ctx, sizeof(uint8_t *));
+
+  if (!state)
+    return NULL;
+  if (!*state && p) {
+    *state = sqlite3_malloc((int) hll_size(p));
+    if (!*state) {
+      sqlite3_result_error_nomem(ctx);
+      return NULL;
+    }
+    memset(*state, 0, hll_size(p));
+    (*state)[0] = HLL_VERSION;
+    (*state)[1] = (uint8_t) p;
+  }
+  return *state;
+}
+
+static void hll_step(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  uint8_t scratch[8], *sketch;
+  size_t len;
+  const void *key = value_key(argv[0], scratch, &len);
+  int p = argc > 1 ? sqlite3_value_int(argv[1]) : HLL_DEFAULT_P;
+
+  if (p < HLL_MIN_P || p > HLL_MAX_P) {
+    sqlite3_result_error(ctx, "jenkins_hll: precision must be in 4..18", -1);
+    return;
+  }
+  sketch = hll_state(ctx, p);
+  if (!sketch || !key)
+    return;
+  hll_add_hash(sketch + HLL_HEADER, sketch[1], hll_hash(key, len));
+}
+
+static void hll_merge_step(sqlite3_context *ctx, int argc,
+                           sqlite3_value **argv) {
+  const uint8_t *buf;
+  uint8_t *sketch;
+  int p;
+
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+    return;
+  buf = sqlite3_value_blob(argv[0]);
+  p = hll_check(buf, (size_t) sqlite3_value_bytes(argv[0]));
+  if (p < 0) {
+    sqlite3_result_error(ctx, "jenkins_hll_merge: not a sketch", -1);
+    return;
+  }
+  sketch = hll_state(ctx, p);
+  if (!sketch)
+    return;
+  if (sketch[1] != p) {
+    sqlite3_result_error(ctx,
+                         "jenkins_hll_merge: sketches differ in precision", -1);
+    return;
+  }
+  hll_merge(sketch + HLL_HEADER, buf + HLL_HEADER, p);
+}
+
+static void hll_final(sqlite3_context *ctx) {
+  uint8_t *sketch = hll_state(ctx, 0);
+
+  if (!sketch)
+    return;
+  sqlite3_result_blob(ctx, sketch, (int) hll_size(sketch[1]), sqlite3_free);
+}
+
+static void hll_count_final(sqlite3_context *ctx) {
+  uint8_t *sketch = hll_state(ctx, 0);
+
+  if (!sketch) {
+    sqlite3_result_int64(ctx, 0);
+    return;
+  }
+  sqlite3_result_int64(ctx, (sqlite3_int64)
+                            (hll_estimate(sketch + HLL_HEADER, sketch[1]) + 0.5));
+  sqlite3_free(sketch);
+}
+
+/* SQLITE_INNOCUOUS (3.31+) lets schemas use them with trusted_schema=0 */
+#ifndef SQLITE_INNOCUOUS
+# define SQLITE_INNOCUOUS 0
+#endif
+#define DET (SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS)
+
+static const struct {
+  const char *name;
+  int nargs;
+  void (*func)(sqlite3_context *, int, sqlite3_value **);
+  void (*step)(sqlite3_context *, int, sqlite3_value **);
+  void (*final)(sqlite3_context *);
+} functions[] = {
+  {"jenkins_hashlittle",     1, hashlittle_func,     NULL, NULL},
+  {"jenkins_hashlittle",     2, hashlittle_func,     NULL, NULL},
+  {"jenkins_hashlittle2_64", 1, hashlittle2_64_func, NULL, NULL},
+  {"jenkins_hashlittle2_64", 2, hashlittle2_64_func, NULL, NULL},
+  {"jenkins_hashlittle2_64", 3, hashlittle2_64_func, NULL, NULL},
+  {"jenkins_oneatatime",     1, oneatatime_func,     NULL, NULL},
+  {"jenkins_bucket",         2, bucket_func,         NULL, NULL},
+  {"jenkins_hll_estimate",   1, hll_estimate_func,   NULL, NULL},
+  {"jenkins_hll",            1, NULL, hll_step,       hll_final},
+  {"jenkins_hll",            2, NULL, hll_step,       hll_final},
+  {"jenkins_hll_count",      1, NULL, hll_step,       hll_count_final},
+  {"jenkins_hll_count",      2, NULL, hll_step,       hll_count_final},
+  {"jenkins_hll_merge",      1, NULL, hll_merge_step, hll_final},
+  {NULL, 0, NULL, NULL, NULL}
+};
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_jenkins_init(sqlite3 *db, char **pzErrMsg,
+                         const sqlite3_api_routines *pApi) {
+  int i, rc = SQLITE_OK;
+
+  SQLITE_EXTENSION_INIT2(pApi);
+
+  for (i = 0; functions[i].name && rc == SQLITE_OK; ++i)
+    rc = sqlite3_create_function(db, functions[i].name, functions[i].nargs,
+                                 DET, NULL, functions[i].func,
+                                 functions[i].step, functions[i].final);
+  return rc;
+}
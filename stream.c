@@ -0,0 +1,104 @@
+/*
+-------------------------------------------------------------------------------
+stream.c -- hashlittle2() computed over data that arrives in pieces.
+
+lookup3 mixes the key length into its initial state, so the total length
+has to be known before the first byte.  Given that, feeding the key in
+any number of pieces to hashlittle2_update() and calling
+hashlittle2_final() gives exactly hashlittle2(key, length, pc, pb).
+
+Full 12-byte blocks are mixed as soon as at least one more byte is known
+to follow; the last 1..12 bytes are kept back for final(), as in
+hashlittle2().  Bytes are read as little-endian words on every machine,
+matching hashlittle2() on little-endian hardware.
+
+Like lookup3.c this has no Python dependency and is meant to be
+#included after it.
+-------------------------------------------------------------------------------
+*/
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct hashlittle2_state {
+  uint32_t a, b, c;
+  uint8_t tail[12];
+  size_t ntail;             /* bytes in tail */
+  uint64_t length;          /* declared total */
+  uint64_t seen;            /* bytes fed so far */
+};
+
+static uint32_t hashlittle2_word(const uint8_t *k) {
+  return (uint32_t) k[0] | ((uint32_t) k[1] << 8) |
+         ((uint32_t) k[2] << 16) | ((uint32_t) k[3] << 24);
+}
+
+static void hashlittle2_init(struct hashlittle2_state *s, uint64_t length,
+                             uint32_t pc, uint32_t pb) {
+  s->a = s->b = s->c = 0xdeadbeef + ((uint32_t) length) + pc;
+  s->c += pb;
+  s->ntail = 0;
+  s->length = length;
+  s->seen = 0;
+}
+
+static void hashlittle2_update(struct hashlittle2_state *s, const void *data,
+                               size_t len) {
+  const uint8_t *k = (const uint8_t *) data;
+  uint32_t a = s->a, b = s->b, c = s->c;
+
+  s->seen += len;
+
+  /* top up a partial block; it can be mixed once more bytes follow */
+  if (s->ntail) {
+    size_t take = 12 - s->ntail;
+
+    if (take > len)
+      take = len;
+    memcpy(s->tail + s->ntail, k, take);
+    s->ntail += take;
+    k += take;
+    len -= take;
+    if (s->ntail < 12 || len == 0)
+      return;
+    a += hashlittle2_word(s->tail);
+    b += hashlittle2_word(s->tail + 4);
+    c += hashlittle2_word(s->tail + 8);
+    mix(a, b, c);
+    s->ntail = 0;
+  }
+
+  while (len > 12) {
+    a += hashlittle2_word(k);
+    b += hashlittle2_word(k + 4);
+    c += hashlittle2_word(k + 8);
+    mix(a, b, c);
+    k += 12;
+    len -= 12;
+  }
+  memcpy(s->tail, k, len);
+  s->ntail = len;
+
+  s->a = a;
+  s->b = b;
+  s->c = c;
+}
+
+/* Returns 0, or -1 if the bytes fed do not add up to the declared length. */
+static int hashlittle2_final(struct hashlittle2_state *s, uint32_t *pc,
+                             uint32_t *pb) {
+  uint32_t a = s->a, b = s->b, c = s->c;
+
+  if (s->seen != s->length)
+    return -1;
+  if (s->ntail) {
+    memset(s->tail + s->ntail, 0, 12 - s->ntail);
+    a += hashlittle2_word(s->tail);
+    b += hashlittle2_word(s->tail + 4);
+    c += hashlittle2_word(s->tail + 8);
+    final(a, b, c);
+  }
+  *pc = c;
+  *pb = b;
+  return 0;
+}
@@ -0,0 +1,43 @@
+"""BlockFile regression tests.  Run with python -m unittest discover tests."""
+import os
+import shutil
+import tempfile
+import threading
+import unittest
+
+import jenkins
+
+
+class ConcurrencyTest(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.path = os.path.join(self.dir, "data.blk")
+        jenkins.write_blockfile(self.path, os.urandom(1 << 20) * 16)
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def test_concurrent_verify(self):
+        # verify() from several threads used to join the same threads twice
+        for _ in range(10):
+            f = jenkins.BlockFile(self.path)
+
+            def verify(i):
+                for j in range(10):
+                    f.verify(wait=(i + j) % 3 != 0, threads=4)
+                    f.read(j * 4096, 100)
+
+            threads = [threading.Thread(target=verify, args=(i,))
+                       for i in range(4)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+            f.verify()
+            self.assertEqual(f.checked, f.nblocks)
+            self.assertEqual(f.bad, [])
+
+
+if __name__ == "__main__":
+    unittest.main()
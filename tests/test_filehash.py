@@ -0,0 +1,114 @@
+"""FileHashCache regression tests.  Run with python -m unittest discover tests."""
+import os
+import shutil
+import struct
+import tempfile
+import time
+import unittest
+
+import jenkins
+
+# jk_fc_header is 64 bytes; each jk_fc_entry is dev, ino, size, mtime_ns,
+# ctime_ns (8 bytes each) then pc, pb (4 bytes each)
+HEADER_SIZE = 64
+ENTRY = struct.Struct("=QQQqqII")
+
+
+class FileHashCacheTest(unittest.TestCase):
+
+    def setUp(self):
+        self.path = tempfile.mkdtemp()
+        self.cache_path = os.path.join(self.path, "cache")
+
+    def tearDown(self):
+        shutil.rmtree(self.path)
+
+    def write(self, name, data):
+        path = os.path.join(self.path, name)
+        with open(path, "wb") as f:
+            f.write(data)
+        return path
+
+    def settle(self):
+        # only files unchanged for a second are cached
+        time.sleep(1.1)
+
+    def test_racy_files_not_cached(self):
+        # a file written just now could change again within the same
+        # timestamp tick, so its hash must not be recorded
+        path = self.write("a", b"racy")
+        cache = jenkins.FileHashCache(self.cache_path)
+        self.assertEqual(jenkins.hashfiles([path], cache),
+                         [jenkins.hashfile(path)])
+        self.assertEqual(len(cache), 0)
+
+    def test_recent_ctime_not_cached(self):
+        # setting mtime back (as cp -p or tar do) does not make a fresh
+        # file safe to cache: its ctime is still recent
+        path = self.write("a", b"old mtime")
+        past = time.time() - 3600
+        os.utime(path, (past, past))
+        cache = jenkins.FileHashCache(self.cache_path)
+        jenkins.hashfiles([path], cache)
+        self.assertEqual(len(cache), 0)
+
+    def test_commit_reload_hit(self):
+        paths = [self.write("f%d" % i, b"x" * i) for i in range(20)]
+        expected = [jenkins.hashfile(p) for p in paths]
+        self.settle()
+        cache = jenkins.FileHashCache(self.cache_path)
+        self.assertEqual(jenkins.hashfiles(paths, cache), expected)
+        self.assertEqual(len(cache), 20)
+        cache.commit()
+
+        cache = jenkins.FileHashCache(self.cache_path)
+        self.assertEqual(len(cache), 20)
+        self.assertEqual(jenkins.hashfiles(paths, cache), expected)
+
+    def test_hit_skips_read(self):
+        # plant a different hash in the committed table: a hit returns it
+        # without reading the file
+        path = self.write("a", b"contents")
+        self.settle()
+        cache = jenkins.FileHashCache(self.cache_path)
+        jenkins.hashfiles([path], cache)
+        cache.commit()
+
+        ino = os.stat(path).st_ino
+        with open(self.cache_path, "r+b") as f:
+            table = bytearray(f.read())
+            for off in range(HEADER_SIZE, len(table), ENTRY.size):
+                entry = list(ENTRY.unpack_from(table, off))
+                if entry[1] == ino:
+                    entry[5:] = [12345, 67890]
+                    ENTRY.pack_into(table, off, *entry)
+            f.seek(0)
+            f.write(table)
+
+        cache = jenkins.FileHashCache(self.cache_path)
+        self.assertEqual(jenkins.hashfiles([path], cache), [(12345, 67890)])
+
+    def test_changed_file_misses(self):
+        path = self.write("a", b"before")
+        self.settle()
+        cache = jenkins.FileHashCache(self.cache_path)
+        jenkins.hashfiles([path], cache)
+        self.assertEqual(len(cache), 1)
+
+        self.write("a", b"after!")
+        self.assertEqual(jenkins.hashfiles([path], cache),
+                         [jenkins.hashlittle2(b"after!")])
+
+    def test_hashfile_matches_hashlittle2(self):
+        # hashfile() streams the file in blocks; block boundaries must not
+        # change the result
+        for n in (0, 1, 12, 13, 256 * 1024 - 1, 256 * 1024 + 5):
+            data = bytes(bytearray(i * 7 & 0xff for i in range(n)))
+            path = self.write("b", data)
+            self.assertEqual(jenkins.hashfile(path), jenkins.hashlittle2(data))
+            self.assertEqual(jenkins.hashfile(path, 3, 4),
+                             jenkins.hashlittle2(data, 3, 4))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,76 @@
+"""hashgzip regression tests.  Run with python -m unittest discover tests."""
+import gzip
+import io
+import os
+import shutil
+import tempfile
+import unittest
+import zlib
+
+import jenkins
+
+
+def gzipped(data):
+    buf = io.BytesIO()
+    f = gzip.GzipFile(fileobj=buf, mode="wb")
+    f.write(data)
+    f.close()
+    return buf.getvalue()
+
+
+class HashGzipTest(unittest.TestCase):
+
+    def setUp(self):
+        self.path = tempfile.mkdtemp()
+        self.data = bytes(bytearray(i * 31 % 251 for i in range(300000)))
+
+    def tearDown(self):
+        shutil.rmtree(self.path)
+
+    def write(self, data):
+        path = os.path.join(self.path, "f")
+        with open(path, "wb") as f:
+            f.write(data)
+        return path
+
+    def check(self, path, data):
+        for pipeline in (False, True):
+            self.assertEqual(jenkins.hashgzip(path, pipeline=pipeline),
+                             jenkins.hashlittle2(data))
+            self.assertEqual(jenkins.hashgzip(path, 5, 6, pipeline=pipeline),
+                             jenkins.hashlittle2(data, 5, 6))
+
+    def test_single_member(self):
+        self.check(self.write(gzipped(self.data)), self.data)
+
+    def test_multi_member(self):
+        # the trailer only gives the last member's length, so the first
+        # pass comes up short of the real total and is redone
+        a, b = self.data[:100000], self.data[100000:]
+        self.check(self.write(gzipped(a) + gzipped(b)), self.data)
+        self.check(self.write(gzipped(b"") + gzipped(a)), a)
+
+    def test_zlib(self):
+        self.check(self.write(zlib.compress(self.data)), self.data)
+
+    def test_empty(self):
+        self.check(self.write(gzipped(b"")), b"")
+
+    def test_corrupt(self):
+        good = gzipped(self.data)
+        for data in (good[:len(good) // 2],                # truncated
+                     good[:20] + b"\xff" * 64 + good[84:],  # bad deflate
+                     b"not compressed at all",
+                     b""):
+            path = self.write(data)
+            for pipeline in (False, True):
+                self.assertRaises(ValueError, jenkins.hashgzip, path,
+                                  pipeline=pipeline)
+
+    def test_missing(self):
+        self.assertRaises(OSError, jenkins.hashgzip,
+                          os.path.join(self.path, "missing"))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,45 @@
+"""HLLArena regression tests.  Run with python -m unittest discover tests."""
+import threading
+import unittest
+
+import jenkins
+
+
+class ConcurrencyTest(unittest.TestCase):
+
+    def test_clear_during_update(self):
+        # clear() used to unmap the arena under a running update()
+        arena = jenkins.HLLArena(4096, p=10)
+        keys = [b"key-%d" % i for i in range(20000)]
+        codes = [i % 4096 for i in range(len(keys))]
+        stop = []
+
+        def update():
+            while not stop:
+                arena.update(codes, keys, threads=2)
+
+        def other():
+            while not stop:
+                arena.clear()
+                arena.estimate([0, 1, 2])
+                arena.union_estimate([3, 4])
+                arena.merge(jenkins.HLLArena(4096, p=10))
+                arena.load(7, arena.sketch(7))
+
+        threads = [threading.Thread(target=update) for _ in range(4)]
+        threads.append(threading.Thread(target=other))
+        for t in threads:
+            t.start()
+        timer = threading.Timer(3.0, stop.append, [True])
+        timer.start()
+        for t in threads:
+            t.join()
+
+        arena.clear()
+        arena.update(codes, keys)
+        self.assertAlmostEqual(sum(arena.estimate()), len(keys),
+                               delta=len(keys) * 0.1)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,78 @@
+"""IBLT regression tests.  Run with python -m unittest discover tests."""
+import struct
+import threading
+import unittest
+
+import jenkins
+
+
+class InitTest(unittest.TestCase):
+
+    def test_uninitialized(self):
+        # objects made by __new__ alone used to crash on first use
+        table = jenkins.IBLT.__new__(jenkins.IBLT)
+        self.assertRaises(ValueError, table.insert, [b""])
+        self.assertRaises(ValueError, table.decode)
+        self.assertRaises(ValueError, table.tobytes)
+        self.assertRaises(ValueError, jenkins.IBLT(10).subtract, table)
+        est = jenkins.StrataEstimator.__new__(jenkins.StrataEstimator)
+        self.assertRaises(ValueError, est.tobytes)
+        self.assertRaises(ValueError, jenkins.StrataEstimator().estimate, est)
+        self.assertRaises(ValueError, jenkins.hash_iter, [b"x" * 8], est)
+        self.assertRaises(ValueError, jenkins.hash_iter, [b"x" * 8], table)
+
+    def test_header_larger_than_data(self):
+        # the header sizes used to be allocated before the data was checked
+        header = struct.pack("<IIII", 0x7ffffffe, 4096, 3, 0)
+        self.assertRaises(ValueError, jenkins.IBLT, data=b"JKIBLT01" + header)
+        header = struct.pack("<IIII", 0x7ffffffe, 4096, 3 | (48 << 8), 0)
+        self.assertRaises(ValueError, jenkins.StrataEstimator,
+                          data=b"JKSTRA01" + header)
+
+    def test_round_trip(self):
+        table = jenkins.IBLT(30)
+        table.insert([b"%08d" % i for i in range(10)])
+        inserted, removed, complete = \
+            jenkins.IBLT(data=table.tobytes()).decode()
+        self.assertTrue(complete)
+        self.assertEqual(sorted(inserted), [b"%08d" % i for i in range(10)])
+        self.assertEqual(removed, [])
+
+
+class ConcurrencyTest(unittest.TestCase):
+
+    def test_concurrent_updates(self):
+        # insert() and remove() XORed into the cells without a lock, so
+        # threads racing each other or subtract() lost updates
+        keys = [b"%08d" % i for i in range(20000)]
+        table = jenkins.IBLT(300)
+        est = jenkins.StrataEstimator()
+        other = jenkins.IBLT(300)
+
+        def worker(i):
+            part = keys[i::4]
+            for _ in range(20):
+                table.insert(part)
+                est.insert(part)
+                table.subtract(other)
+                table.remove(part)
+                jenkins.hash_iter(part, est)
+                est.remove(part)
+                est.remove(part)
+                table.tobytes()
+                est.estimate(est)
+
+        threads = [threading.Thread(target=worker, args=(i,))
+                   for i in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(table.tobytes(), jenkins.IBLT(300).tobytes())
+        self.assertEqual(est.tobytes(), jenkins.StrataEstimator().tobytes())
+        self.assertEqual(table.decode(), ([], [], True))
+        self.assertEqual(est.estimate(jenkins.StrataEstimator()), 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,80 @@
+"""hash_iter regression tests.  Run with python -m unittest discover tests."""
+import unittest
+
+import jenkins
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+
+def hash64(key):
+    pc, pb = jenkins.hashlittle2(key)
+    return pc + (pb << 32)
+
+
+class Failing(Exception):
+    pass
+
+
+def failing_after(keys, n):
+    for i, key in enumerate(keys):
+        if i == n:
+            raise Failing()
+        yield key
+
+
+class HashIterTest(unittest.TestCase):
+
+    def setUp(self):
+        self.keys = [b"key%d" % i for i in range(10000)]
+
+    def test_array(self):
+        for chunk_size in (1, 7, 4096, 65536):
+            r = jenkins.hash_iter(iter(self.keys), chunk_size=chunk_size)
+            self.assertEqual(list(r), [hash64(k) for k in self.keys])
+
+    @unittest.skipUnless(numpy is not None and
+                         hasattr(jenkins, "hashlittle2_array"),
+                         "needs NumPy")
+    def test_array_matches_hashlittle2_array(self):
+        r = jenkins.hash_iter(iter(self.keys), chunk_size=1000)
+        expected = jenkins.hashlittle2_array(numpy.array(self.keys))
+        self.assertEqual(list(r), [int(h) for h in expected])
+
+    def test_into_multiset(self):
+        ms = jenkins.MultisetHash()
+        n = jenkins.hash_iter(iter(self.keys), ms, chunk_size=1000)
+        self.assertEqual(n, len(self.keys))
+        expected = jenkins.MultisetHash()
+        expected.update(self.keys)
+        self.assertEqual(ms, expected)
+        self.assertEqual(ms.digest(), expected.digest())
+
+    def test_partial_on_error(self):
+        # keys before the iterator's exception are still added, including
+        # those in a chunk that was not yet full
+        ms = jenkins.MultisetHash()
+        self.assertRaises(Failing, jenkins.hash_iter,
+                          failing_after(self.keys, 2500), ms, chunk_size=1000)
+        expected = jenkins.MultisetHash()
+        expected.update(self.keys[:2500])
+        self.assertEqual(ms, expected)
+        self.assertEqual(ms.count, 2500)
+
+    def test_large_keys_flush(self):
+        # a chunk is handed over at ING_MAX_BYTES (4 MiB) of key data
+        # whatever chunk_size says
+        keys = [bytes(bytearray([i])) * (1536 * 1024 + i) for i in range(9)]
+        r = jenkins.hash_iter(iter(keys), chunk_size=65536)
+        self.assertEqual(list(r), [hash64(k) for k in keys])
+        ms = jenkins.MultisetHash()
+        self.assertEqual(jenkins.hash_iter(iter(keys), ms), len(keys))
+        expected = jenkins.MultisetHash()
+        expected.update(keys)
+        self.assertEqual(ms, expected)
+
+
+if __name__ == "__main__":
+    unittest.main()
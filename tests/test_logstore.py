@@ -0,0 +1,92 @@
+"""LogStore regression tests.  Run with python -m unittest discover tests."""
+import shutil
+import tempfile
+import threading
+import unittest
+
+import jenkins
+
+
+class ConcurrencyTest(unittest.TestCase):
+
+    def setUp(self):
+        self.path = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.path)
+
+    def test_close_during_use(self):
+        # close() used to free the index under running get()s and commits,
+        # and concurrent compact() calls could leave a compactor unjoined
+        db = jenkins.LogStore(self.path, segment_size=1 << 16)
+        for i in range(2000):
+            db.put(b"k%d" % i, b"v" * 50)
+        db.commit()
+        errors = []
+
+        def worker(kind):
+            i = 0
+            while True:
+                i += 1
+                key = b"k%d" % (i % 2000)
+                try:
+                    if kind == 0:
+                        db.get(key)
+                    elif kind == 1:
+                        db.put(key, b"x" * 40)
+                    elif kind == 2:
+                        db.delete(key)
+                    elif kind == 3:
+                        db.commit()
+                    elif kind == 4:
+                        db.compact(wait=i % 2 == 0)
+                    else:
+                        db.put_many([(key, b"y")] * 10)
+                except ValueError as e:
+                    if "closed" not in str(e):
+                        errors.append(e)
+                    return
+
+        threads = [threading.Thread(target=worker, args=(k % 6,))
+                   for k in range(12)]
+        for t in threads:
+            t.start()
+        timer = threading.Timer(0.5, db.close)
+        timer.start()
+        for t in threads:
+            t.join()
+        timer.join()
+
+        self.assertEqual(errors, [])
+        self.assertRaises(ValueError, db.get, b"k0")
+        db = jenkins.LogStore(self.path)
+        db.put(b"k0", b"z")
+        self.assertEqual(db.get(b"k0"), b"z")
+        db.close()
+
+
+class ReopenTest(unittest.TestCase):
+
+    def setUp(self):
+        self.path = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.path)
+
+    def test_deletes_outrank_compacted_copies(self):
+        # the deletes load first; growing the keydir used to forget them
+        db = jenkins.LogStore(self.path)
+        for i in range(5000):
+            db.put(b"k%d" % i, b"v")
+        db.compact(wait=True)
+        for i in range(5000):
+            db.delete(b"k%d" % i)
+        db.close()
+        db = jenkins.LogStore(self.path)
+        self.assertEqual(len(db), 0)
+        self.assertEqual(db.get(b"k1"), None)
+        db.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,82 @@
+"""MultisetHash regression tests.  Run with python -m unittest discover tests."""
+import random
+import struct
+import unittest
+
+import jenkins
+
+
+def key_hash(key):
+    # low 64 bits: hashlittle2 unseeded; high 64 bits: the seeded run
+    pc, pb = jenkins.hashlittle2(key)
+    hc, hb = jenkins.hashlittle2(key, 0x9e3779b9, 0x7f4a7c15)
+    return pc + (pb << 32) + ((hc + (hb << 32)) << 64)
+
+
+class MultisetHashTest(unittest.TestCase):
+
+    def setUp(self):
+        self.keys = [b"key%d" % i for i in range(5000)] + [b"dup"] * 3
+
+    def test_order_independent(self):
+        shuffled = list(self.keys)
+        random.Random(1).shuffle(shuffled)
+        a = jenkins.MultisetHash(self.keys)
+        b = jenkins.MultisetHash()
+        for key in shuffled:
+            b.add(key)
+        c = jenkins.MultisetHash()
+        c.update(shuffled, threads=4)
+        self.assertEqual(a, b)
+        self.assertEqual(a, c)
+        self.assertEqual(a.digest(), c.digest())
+
+    def test_multiplicity_counts(self):
+        # a sum, unlike XOR, tells a key added twice from one never added
+        once = jenkins.MultisetHash([b"a"])
+        thrice = jenkins.MultisetHash([b"a", b"b", b"b"])
+        self.assertNotEqual(once, thrice)
+        thrice.remove(b"b")
+        self.assertNotEqual(once, thrice)
+        thrice.remove(b"b")
+        self.assertEqual(once, thrice)
+
+    def test_add_remove_round_trip(self):
+        ms = jenkins.MultisetHash(self.keys[:100])
+        before = ms.digest()
+        ms.update(self.keys[100:])
+        ms.subtract(self.keys[100:])
+        self.assertEqual(ms.digest(), before)
+        for key in self.keys[:100]:
+            ms.remove(key)
+        self.assertEqual(ms, jenkins.MultisetHash())
+        self.assertEqual(ms.count, 0)
+
+    def test_merge(self):
+        a = jenkins.MultisetHash(self.keys[:2000])
+        b = jenkins.MultisetHash(self.keys[2000:])
+        whole = jenkins.MultisetHash(self.keys)
+        c = a.copy()
+        c.merge(b)
+        self.assertEqual(c, whole)
+        d = a.copy()
+        d.update(b)
+        self.assertEqual(d, whole)
+        whole.subtract(b)
+        self.assertEqual(whole, a)
+
+    def test_digest_layout(self):
+        # 128-bit sum then 64-bit count, each little-endian
+        ms = jenkins.MultisetHash(self.keys)
+        total = sum(key_hash(k) for k in self.keys) % (1 << 128)
+        expected = struct.pack("<QQQ", total & (2 ** 64 - 1), total >> 64,
+                               len(self.keys))
+        self.assertEqual(len(ms.digest()), 24)
+        self.assertEqual(ms.digest(), expected)
+        self.assertEqual(ms.hexdigest(),
+                         "".join("%02x" % b for b in bytearray(expected)))
+        self.assertEqual(jenkins.MultisetHash(digest=expected), ms)
+
+
+if __name__ == "__main__":
+    unittest.main()
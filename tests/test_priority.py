@@ -0,0 +1,64 @@
+"""PrioritySample regression tests.  Run with python -m unittest discover tests."""
+import struct
+import unittest
+
+import jenkins
+
+
+class MergeTest(unittest.TestCase):
+
+    def test_overlapping_shards(self):
+        k = 5000
+        keys = [b"key%d" % i for i in range(4 * k)]
+        a = jenkins.PrioritySample(k)
+        b = jenkins.PrioritySample(k)
+        a.update(keys[:2 * k], [1.0] * (2 * k))
+        b.update(keys[k:], [1.0] * (3 * k))
+        a.merge(b)
+        whole = jenkins.PrioritySample(k)
+        whole.update(keys, [1.0] * len(keys))
+        self.assertEqual(sorted(s[0] for s in a.sample()),
+                         sorted(s[0] for s in whole.sample()))
+        self.assertEqual(a.threshold, whole.threshold)
+
+
+class LoadTest(unittest.TestCase):
+
+    def test_bad_headers(self):
+        # k = 2**32 - 1 used to wrap the heap size to 0
+        for k, n in ((0xffffffff, 0), ((1 << 30) + 1, 0), (100, 50)):
+            data = b"JKPRIO01" + struct.pack("<QQQ", k, n, 0)
+            self.assertRaises(ValueError, jenkins.PrioritySample, data=data)
+
+    def test_round_trip(self):
+        s = jenkins.PrioritySample(10, seed=3)
+        s.update([b"a", b"b", b"c"], [1.0, 2.0, 3.0])
+        t = jenkins.PrioritySample(data=s.tobytes())
+        self.assertEqual(t.k, 10)
+        self.assertEqual(sorted(t.sample()), sorted(s.sample()))
+
+
+class PredicateTest(unittest.TestCase):
+
+    def test_predicate_updates_sketch(self):
+        # estimate() used to read kept keys and weights straight from the
+        # heap, which an update() inside the predicate moves and frees
+        k = 200
+        s = jenkins.PrioritySample(k)
+        s.update([b"key%d" % i for i in range(4 * k)], [1.0] * (4 * k))
+        expected = s.estimate(lambda key: key.endswith(b"7"))
+        batches = iter(range(1000))
+
+        def predicate(key):
+            n = next(batches)
+            s.update([b"heavy%d.%d" % (n, i) for i in range(k)],
+                     [1e6] * k)
+            return key.endswith(b"7")
+
+        self.assertEqual(s.estimate(predicate), expected)
+        self.assertTrue(all(key.startswith(b"heavy")
+                            for key, _, _ in s.sample()))
+
+
+if __name__ == "__main__":
+    unittest.main()
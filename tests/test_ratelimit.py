@@ -0,0 +1,36 @@
+"""RateLimiter regression tests.  Run with python -m unittest discover tests."""
+import os
+import shutil
+import struct
+import tempfile
+import unittest
+
+import jenkins
+
+
+class ClearingTest(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.path = os.path.join(self.dir, "limits")
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def test_dead_clearer(self):
+        # a process that died while clearing a grid used to leave every
+        # other caller spinning on it forever
+        limiter = jenkins.RateLimiter(self.path, limit=5, window=10,
+                                      buckets=10, width=1024, depth=4)
+        grid = 64 + 1024 * 4 * 4
+        with open(self.path, "r+b") as f:
+            # grid of bucket 100: epoch 100 being cleared, claimed long ago
+            f.seek(64 + (100 % 11) * grid)
+            f.write(struct.pack("<QQ", 100 | (1 << 63), 1))
+        hits = [limiter.hit(b"key", now=100.0) for _ in range(7)]
+        self.assertEqual(hits, [True] * 5 + [False] * 2)
+        self.assertEqual(limiter.count(b"key", now=100.0), 5)
+
+
+if __name__ == "__main__":
+    unittest.main()